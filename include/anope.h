@@ -74,9 +74,9 @@ namespace Anope
 		inline bool equals_cs(const std::string &_str) const { return this->_string == _str; }
 		inline bool equals_cs(const string &_str) const { return this->_string == _str._string; }
 
-		inline bool equals_ci(const char *_str) const { return ci::string(this->_string.c_str()) == _str; }
-		inline bool equals_ci(const std::string &_str) const { return ci::string(this->_string.c_str()) == _str.c_str(); }
-		inline bool equals_ci(const string &_str) const { return ci::string(this->_string.c_str()) == _str._string.c_str(); }
+		inline bool equals_ci(const char *_str) const { return this->_string.length() == ci::ci_char_traits::length(_str) && !ci::ci_char_traits::compare(this->_string.c_str(), _str, this->_string.length()); }
+		inline bool equals_ci(const std::string &_str) const { return this->_string.length() == _str.length() && !ci::ci_char_traits::compare(this->_string.c_str(), _str.c_str(), _str.length()); }
+		inline bool equals_ci(const string &_str) const { return this->_string.length() == _str._string.length() && !ci::ci_char_traits::compare(this->_string.c_str(), _str._string.c_str(), _str._string.length()); }
 
 		/**
 		 * Inequality operators, exact opposites of the above.
@@ -308,11 +308,18 @@ namespace Anope
 	inline const string operator+(const char *_str, const string &str) { string tmp(_str); tmp += str; return tmp; }
 	inline const string operator+(const std::string &_str, const string &str) { string tmp(_str); tmp += str; return tmp; }
 
+	/* hash_ci and compare fold each character through the casemap as they go, instead of
+	 * making lower case copies of the strings, as they are used for every nick and channel lookup.
+	 */
 	struct hash_ci
 	{
 		inline size_t operator()(const string &s) const
 		{
-			return TR1NS::hash<std::string>()(s.lower().str());
+			/* FNV-1a */
+			size_t h = 2166136261U;
+			for (const char *p = s.c_str(), *end = p + s.length(); p != end; ++p)
+				h = (h ^ casemap_lower[static_cast<unsigned char>(*p)]) * 16777619U;
+			return h;
 		}
 	};
 
@@ -328,7 +335,13 @@ namespace Anope
 	{
 		inline bool operator()(const string &s1, const string &s2) const
 		{
-			return s1.equals_ci(s2);
+			if (s1.length() != s2.length())
+				return false;
+
+			for (const char *p1 = s1.c_str(), *p2 = s2.c_str(), *end = p1 + s1.length(); p1 != end; ++p1, ++p2)
+				if (*p1 != *p2 && casemap_lower[static_cast<unsigned char>(*p1)] != casemap_lower[static_cast<unsigned char>(*p2)])
+					return false;
+			return true;
 		}
 	};
 
@@ -358,6 +371,12 @@ namespace Anope
 	 */
 	extern CoreExport time_t CurTime;
 
+	/** The current time of a monotonic clock in milliseconds, updated along with CurTime.
+	 * It has no fixed starting point, but unlike CurTime it never jumps if the system
+	 * time is changed, so use it for measuring intervals.
+	 */
+	extern CoreExport uint64_t CurTimeMS;
+
 	/** The debug level we are running at.
 	 */
 	extern CoreExport int Debug;
@@ -411,6 +430,15 @@ namespace Anope
 	 */
 	extern void HandleSignal();
 
+	/** Updates CurTime and CurTimeMS, called by the socket engine each time it wakes up
+	 */
+	extern CoreExport void UpdateTime();
+
+	/** Reads the monotonic clock
+	 * @return The time of the monotonic clock in microseconds
+	 */
+	extern CoreExport uint64_t MicroTime();
+
 	/** One of the first functions called, does general initialization such as reading
 	 * command line args, loading the configuration, doing the initial fork() if necessary,
 	 * initializating language support, loading modules, and loading databases.
@@ -430,6 +458,63 @@ namespace Anope
 	 */
 	extern CoreExport bool Match(const string &str, const string &mask, bool case_sensitive = false, bool use_regex = false);
 
+	/** A wildcard pattern (using * and ?) split into its literal segments ahead of time, for
+	 * masks which are matched against many strings. The segments are case folded once, and
+	 * each is found in the string by searching for one of its characters with memchr.
+	 */
+	class CoreExport Glob
+	{
+		struct Segment
+		{
+			/* The segment as given, ? matches any character */
+			string raw;
+			/* The segment case folded, or the same as raw if the glob is case sensitive */
+			string folded;
+			/* The position of the character searched for when finding the segment, or npos if it is all ? */
+			size_t anchor;
+			/* The characters which fold to the anchor, if there are at most two, for memchr */
+			unsigned char search[2];
+			unsigned nsearch;
+		};
+
+		string mask;
+		bool case_sensitive;
+		/* Whether the mask contains a * */
+		bool wildcard;
+		/* Text before the first *, text after the last *, and the non empty text between them */
+		mutable Segment prefix, suffix;
+		mutable std::vector<Segment> middle;
+		/* The casemap generation the segments were folded in */
+		mutable unsigned long generation;
+
+		void Fold(Segment &seg) const;
+
+	 public:
+		/** Constructor
+		 * @param m The mask
+		 * @param cs Whether matches are case sensitive
+		 */
+		Glob(const string &m = "", bool cs = false);
+
+		/** Get the mask
+		 */
+		const string &GetMask() const;
+
+		/** Check whether a string matches, the same as Anope::Match(str, mask, case_sensitive)
+		 * @param str The string
+		 * @return true if the string matches
+		 */
+		bool Matches(const string &str) const;
+
+		/** Check whether a string matches a mask without compiling it. Used by Anope::Match.
+		 * @param str The string
+		 * @param mask The mask
+		 * @param case_sensitive Whether the match is case sensitive
+		 * @return true if the string matches
+		 */
+		static bool Match(const string &str, const string &mask, bool case_sensitive);
+	};
+
 	/** Converts a string to hex
 	 * @param the data to be converted
 	 * @return a anope::string containing the hex value
@@ -544,6 +629,67 @@ namespace Anope
 	extern CoreExport Anope::string Random(size_t len);
 }
 
+/** Parts of the main loop timed by LoopStats
+ */
+enum LoopPhase
+{
+	/* Waiting in the socket engine */
+	LOOP_WAIT,
+	/* Processing socket events */
+	LOOP_SOCKETS,
+	/* Ticking timers */
+	LOOP_TIMERS,
+	/* Sending stacked modes */
+	LOOP_MODES,
+	/* All of the above except waiting, the lag of each iteration */
+	LOOP_BUSY,
+	LOOP_SIZE
+};
+
+/** Keeps a histogram of how long each part of an iteration of the main loop takes.
+ * The main loop switches between phases with Enter, and the time spent in each
+ * phase is added to its histogram once per iteration.
+ */
+class CoreExport LoopStats
+{
+ public:
+	/** Number of buckets in each histogram. Bucket n counts iterations which
+	 * took less than 2^n microseconds, the last bucket counts all others.
+	 */
+	static const unsigned BUCKETS = 24;
+
+	static unsigned long Histogram[LOOP_SIZE][BUCKETS];
+	/* Longest time spent in each phase in one iteration, in microseconds */
+	static uint64_t Max[LOOP_SIZE];
+	/* Total time spent in each phase, in microseconds */
+	static uint64_t Total[LOOP_SIZE];
+	/* Number of iterations counted */
+	static unsigned long Iterations;
+
+	/** Charge the time since the last call to the current phase and switch to another
+	 * @param phase The phase to switch to
+	 * @return The phase which was current
+	 */
+	static LoopPhase Enter(LoopPhase phase);
+
+	/** Ends an iteration of the main loop, adding the time spent in each phase to the histograms
+	 */
+	static void EndIteration();
+
+	/** Estimate a percentile of the time spent in a phase from its histogram
+	 * @param phase The phase
+	 * @param percent The percentile
+	 * @return The upper bound of the bucket the percentile falls in, in microseconds
+	 */
+	static uint64_t Percentile(LoopPhase phase, unsigned percent);
+
+	/** Get the name of a phase
+	 * @param phase The phase
+	 * @return The name, eg "sockets"
+	 */
+	static const char *GetPhaseName(LoopPhase phase);
+};
+
 /** sepstream allows for splitting token separated lists.
  * Each successive call to sepstream::GetToken() returns
  * the next token, until none remain, at which point the method returns
@@ -32,6 +32,8 @@ struct ChanUserContainer : public Extensible
 class CoreExport Channel : public Base, public Extensible
 {
 	static std::vector<Channel *> deleting;
+	/* Channels with joins which have not been checked yet */
+	static std::vector<Channel *> joins_pending;
 
  public:
 	typedef std::multimap<Anope::string, Anope::string> ModeList;
@@ -40,6 +42,15 @@ class CoreExport Channel : public Base, public Extensible
 	 */
 	ModeList modes;
 
+	/* Users who joined while the uplink was bursting, who have not been checked yet */
+	std::vector<User *> pending_joins;
+
+	/** Kick a user who has joined if they are not allowed in, otherwise give them
+	 * the modes they should have and call OnJoinChannel
+	 * @param u The user
+	 */
+	void EnforceJoin(User *u);
+
  public:
  	/* Channel name */
 	Anope::string name;
@@ -289,6 +300,22 @@ class CoreExport Channel : public Base, public Extensible
 	 */
 	bool CheckKick(User *user);
 
+	/** Check a user who has just joined the channel, see CheckKick and SetCorrectModes.
+	 * While the uplink is bursting this is deferred until the burst ends, so every
+	 * channel is checked once in a single pass.
+	 * @param u The user
+	 */
+	void CheckJoin(User *u);
+
+	/** Check the users who joined this channel while the uplink was bursting
+	 */
+	void CheckPendingJoins();
+
+	/** Check the users who joined any channel while the uplink was bursting
+	 * @return The number of joins checked
+	 */
+	static unsigned CheckAllPendingJoins();
+
 	/** Finds a channel
 	 * @param name The channel to find
 	 * @return The channel, if found
@@ -99,12 +99,12 @@ namespace Configuration
 		bool DefPrivmsg;
 		/* Default language */
 		Anope::string DefLanguage;
-		/* options:timeoutcheck */
-		time_t TimeoutCheck;
 		/* options:usestrictprivmsg */
 		bool UseStrictPrivmsg;
 		/* networkinfo:nickchars */
 		Anope::string NickChars;
+		/* options:regexengine */
+		Anope::string RegexEngine;
 
 		/* either "/msg " or "/" */
 		Anope::string StrictPrivmsg;
@@ -112,6 +112,12 @@ namespace Configuration
 		std::vector<Uplink> Uplinks;
 		/* A vector of our logfile options */
 		std::vector<LogInfo> LogInfos;
+		/* The log types at least one log block may log, see LogInfo::GetTypes */
+		unsigned LogTypes;
+		/* options:logbuffer, in bytes */
+		size_t LogBufferSize;
+		/* options:logflushinterval */
+		time_t LogFlushInterval;
 		/* Array of ulined servers */
 		std::vector<Anope::string> Ulines;
 		/* List of available opertypes */
@@ -33,6 +33,16 @@ namespace Anope
 	extern unsigned char tolower(unsigned char);
 	extern unsigned char toupper(unsigned char);
 
+	/* The casemap's lower case of every character, for loops which fold many characters */
+	extern CoreExport const unsigned char *const casemap_lower;
+	/* Incremented whenever the casemap is rebuilt */
+	extern CoreExport unsigned long casemap_generation;
+
+	/* Finds the characters the casemap folds to c, if there are at most two of them, so a case
+	 * insensitive search for c can be done with memchr. Returns how many there are, or 0 if there are more.
+	 */
+	extern CoreExport unsigned FoldedFrom(unsigned char c, unsigned char search[2]);
+
 	/* ASCII case insensitive ctype. */
 	template<typename char_type>
 	class ascii_ctype : public std::ctype<char_type>
@@ -38,14 +38,63 @@ enum LogType
 	LOG_DEBUG_4
 };
 
+/** A block of a log file as recorded in the file's index, which the log writer keeps
+ * next to each log file. The index records for every block of lines which trigrams,
+ * folded to lower case, the lines may contain, so searches can skip the blocks which
+ * can not match. Lines written while no index was kept are not covered by any block.
+ */
+struct CoreExport LogIndexBlock
+{
+	/* The size blocks are ended at, and the number of bits in the trigram bitmap */
+	static const unsigned Size = 8192, Bits = 4096;
+
+	/* Where the block starts in the log file, and its length */
+	uint64_t offset;
+	uint32_t length;
+	uint32_t reserved;
+	/* Bitmap of the hashes of the trigrams in the block */
+	unsigned char trigrams[Bits / 8];
+
+	LogIndexBlock(uint64_t off = 0);
+
+	/** Add the trigrams of text to the bitmap
+	 * @param text The text
+	 * @param len The length of the text
+	 */
+	void Add(const char *text, size_t len);
+
+	/** Check whether this block may contain all of the trigrams of another
+	 * @param other The block, usually built from the text being searched for
+	 * @return true if every bit set in other is set here
+	 */
+	bool Contains(const LogIndexBlock &other) const;
+
+	/** Check whether any trigram has been added
+	 */
+	bool Empty() const;
+
+	/** Get the name of the index of a log file
+	 */
+	static Anope::string GetIndexName(const Anope::string &logfile);
+};
+
+/* A log file being written to by the log writer */
 struct LogFile
 {
 	Anope::string filename;
 	std::ofstream stream;
+	/* The index of the file, and the block being built of the lines written since it was last written to */
+	std::ofstream index;
+	LogIndexBlock block;
 
 	LogFile(const Anope::string &name);
 	~LogFile();
 	const Anope::string &GetName() const;
+
+	/** Write a line to the file and add it to the index
+	 * @param line The line, without the line ending
+	 */
+	void Write(const Anope::string &line);
 };
 
 /* Represents a single log message */
@@ -102,6 +151,14 @@ class CoreExport Log
  public:
 	Anope::string BuildPrefix() const;
 
+	/** Check whether anything could consume a message of the given type.
+	 * Messages of the types below LOG_RAWIO are always wanted, as modules may act on them in OnLog.
+	 * Raw IO and debug messages are only wanted if the debug level or a log block asks for them.
+	 * @param type The log type
+	 * @return true if a message of this type may be logged somewhere
+	 */
+	static bool IsEnabled(LogType type);
+
 	template<typename T> Log &operator<<(T val)
 	{
 		this->buf << val;
@@ -109,13 +166,21 @@ class CoreExport Log
 	}
 };
 
+/** Log a message only if something would consume it, as with Log::IsEnabled. Otherwise
+ * neither the message nor the operands given to it are evaluated, which makes this
+ * suitable for raw IO and debug messages logged on hot paths:
+ * LOG_IF_ENABLED(LOG_RAWIO) << "Received: " << buffer;
+ */
+#define LOG_IF_ENABLED(type) if (!Log::IsEnabled(type)) { } else Log(type)
+
 /* Configured in the configuration file, actually does the message logging */
 class CoreExport LogInfo
 {
  public:
  	BotInfo *bot;
 	std::vector<Anope::string> targets;
-	std::vector<LogFile *> logfiles;
+	/* The file targets, and the names of the files they are logged to today */
+	std::vector<std::pair<Anope::string, Anope::string> > logfiles;
 	int last_day;
 	std::vector<Anope::string> sources;
 	int log_age;
@@ -133,12 +198,44 @@ class CoreExport LogInfo
 
 	~LogInfo();
 
+	/** Set the names of the files logged to, which change each day
+	 */
 	void OpenLogFiles();
 
 	bool HasType(LogType ltype, const Anope::string &type) const;
 
+	/** Get the log types this may log, ignoring categories and the debug level.
+	 * @return A bitmask with the bit of every such log type set
+	 */
+	unsigned GetTypes() const;
+
 	/* Logs the message l if configured to */
 	void ProcessMessage(const Log *l);
 };
 
+/** Writes log files from a separate thread, so a slow disk can not stall services.
+ * Messages for log files are queued to it by the main thread, up to options:logbuffer
+ * kilobytes, and messages which do not fit are dropped. Until the writer is started,
+ * and after it is stopped, messages are written to the log files directly.
+ */
+class CoreExport LogWriter
+{
+ public:
+	/** Start the writer thread
+	 */
+	static void Start();
+
+	/** Write every queued message and stop the writer thread
+	 */
+	static void Stop();
+
+	/** Close the files of targets which are no longer configured, after a rehash
+	 */
+	static void CloseUnused();
+
+	/** Get the number of messages dropped because the queue was full
+	 */
+	static unsigned long Dropped();
+};
+
 #endif // LOGGER_H
@@ -407,7 +407,7 @@ class CoreExport Entry
 	/** Get the banned mask for this entry
 	 * @return The mask
 	 */
-	const Anope::string GetMask() const;
+	const Anope::string &GetMask() const;
 
 	const Anope::string GetNUHMask() const;
 
@@ -23,7 +23,7 @@
 
 /** This definition is used as shorthand for the various classes
  * and functions needed to make a module loadable by the OS.
- * It defines the class factory and external AnopeInit and AnopeFini functions.
+ * It defines the class factory and external AnopeInit, AnopeEvents and AnopeFini functions.
  */
 #ifdef _WIN32
 # define MODULE_INIT(x) \
@@ -36,6 +36,11 @@
 	{ \
 		return TRUE; \
 	} \
+	extern "C" DllExport void AnopeEvents(bool *); \
+	extern "C" void AnopeEvents(bool *implements) \
+	{ \
+		FindModuleEvents<x>(implements); \
+	} \
 	extern "C" DllExport void AnopeFini(x *); \
 	extern "C" void AnopeFini(x *m) \
 	{ \
@@ -55,6 +60,10 @@
 	{ \
 		return new x(modname, creator); \
 	} \
+	extern "C" DllExport void AnopeEvents(bool *implements) \
+	{ \
+		FindModuleEvents<x>(implements); \
+	} \
 	extern "C" DllExport void AnopeFini(x *m) \
 	{ \
 		delete m; \
@@ -79,22 +88,18 @@
 if (true) \
 { \
 	std::vector<Module *> &_modules = ModuleManager::EventHandlers[I_ ## ename]; \
-	for (std::vector<Module *>::iterator _i = _modules.begin(); _i != _modules.end();) \
+	for (std::vector<Module *>::iterator _i = _modules.begin(); _i != _modules.end(); ++_i) \
 	{ \
 		try \
 		{ \
+			HookTimer _t(*_i, I_ ## ename); \
 			(*_i)->ename args; \
+			_t.Stop(); \
 		} \
 		catch (const ModuleException &modexcept) \
 		{ \
 			Log() << "Exception caught: " << modexcept.GetReason(); \
 		} \
-		catch (const NotImplementedException &) \
-		{ \
-			_i = _modules.erase(_i); \
-			continue; \
-		} \
-		++_i; \
 	} \
 } \
 else \
@@ -113,11 +118,13 @@ if (true) \
 { \
 	ret = EVENT_CONTINUE; \
 	std::vector<Module *> &_modules = ModuleManager::EventHandlers[I_ ## ename]; \
-	for (std::vector<Module *>::iterator _i = _modules.begin(); _i != _modules.end();) \
+	for (std::vector<Module *>::iterator _i = _modules.begin(); _i != _modules.end(); ++_i) \
 	{ \
 		try \
 		{ \
+			HookTimer _t(*_i, I_ ## ename); \
 			EventReturn res = (*_i)->ename args; \
+			_t.Stop(); \
 			if (res != EVENT_CONTINUE) \
 			{ \
 				ret = res; \
@@ -128,12 +135,6 @@ if (true) \
 		{ \
 			Log() << "Exception caught: " << modexcept.GetReason(); \
 		} \
-		catch (const NotImplementedException &) \
-		{ \
-			_i = _modules.erase(_i); \
-			continue; \
-		} \
-		++_i; \
 	} \
 } \
 else \
@@ -297,8 +298,8 @@ class CoreExport Module : public Extensible
 
 	virtual void Prioritize();
 
-	/* Everything below here are events. Modules must ModuleManager::Attach to these events
-	 * before they will be called.
+	/* Everything below here are events. Modules are attached to each event they override,
+	 * see FindModuleEvents.
 	 */
 
 	/** Called on startup after database load, but before
@@ -1129,6 +1130,170 @@ enum Implementation
 	I_SIZE
 };
 
+/** Whether a handler is a module's own, or the one declared by Module,
+ * which only throws NotImplementedException
+ */
+template<typename C, typename F> inline bool ImplementsEvent(F C::*) { return true; }
+template<typename F> inline bool ImplementsEvent(F Module::*) { return false; }
+
+/** Finds the events a module class has handlers for, so the module is
+ * only attached to those. Used by MODULE_INIT.
+ * @param implements Set to whether each event is implemented
+ */
+template<typename T> void FindModuleEvents(bool *implements)
+{
+	implements[I_OnPostInit] = ImplementsEvent(&T::OnPostInit);
+	implements[I_OnPreUserKicked] = ImplementsEvent(&T::OnPreUserKicked);
+	implements[I_OnUserKicked] = ImplementsEvent(&T::OnUserKicked);
+	implements[I_OnReload] = ImplementsEvent(&T::OnReload);
+	implements[I_OnPreBotAssign] = ImplementsEvent(&T::OnPreBotAssign);
+	implements[I_OnBotAssign] = ImplementsEvent(&T::OnBotAssign);
+	implements[I_OnBotUnAssign] = ImplementsEvent(&T::OnBotUnAssign);
+	implements[I_OnUserConnect] = ImplementsEvent(&T::OnUserConnect);
+	implements[I_OnNewServer] = ImplementsEvent(&T::OnNewServer);
+	implements[I_OnUserNickChange] = ImplementsEvent(&T::OnUserNickChange);
+	implements[I_OnPreHelp] = ImplementsEvent(&T::OnPreHelp);
+	implements[I_OnPostHelp] = ImplementsEvent(&T::OnPostHelp);
+	implements[I_OnPreCommand] = ImplementsEvent(&T::OnPreCommand);
+	implements[I_OnPostCommand] = ImplementsEvent(&T::OnPostCommand);
+	implements[I_OnSaveDatabase] = ImplementsEvent(&T::OnSaveDatabase);
+	implements[I_OnLoadDatabase] = ImplementsEvent(&T::OnLoadDatabase);
+	implements[I_OnEncrypt] = ImplementsEvent(&T::OnEncrypt);
+	implements[I_OnDecrypt] = ImplementsEvent(&T::OnDecrypt);
+	implements[I_OnBotFantasy] = ImplementsEvent(&T::OnBotFantasy);
+	implements[I_OnBotNoFantasyAccess] = ImplementsEvent(&T::OnBotNoFantasyAccess);
+	implements[I_OnBotBan] = ImplementsEvent(&T::OnBotBan);
+	implements[I_OnBadWordAdd] = ImplementsEvent(&T::OnBadWordAdd);
+	implements[I_OnBadWordDel] = ImplementsEvent(&T::OnBadWordDel);
+	implements[I_OnCreateBot] = ImplementsEvent(&T::OnCreateBot);
+	implements[I_OnDelBot] = ImplementsEvent(&T::OnDelBot);
+	implements[I_OnBotKick] = ImplementsEvent(&T::OnBotKick);
+	implements[I_OnPrePartChannel] = ImplementsEvent(&T::OnPrePartChannel);
+	implements[I_OnPartChannel] = ImplementsEvent(&T::OnPartChannel);
+	implements[I_OnLeaveChannel] = ImplementsEvent(&T::OnLeaveChannel);
+	implements[I_OnJoinChannel] = ImplementsEvent(&T::OnJoinChannel);
+	implements[I_OnTopicUpdated] = ImplementsEvent(&T::OnTopicUpdated);
+	implements[I_OnPreChanExpire] = ImplementsEvent(&T::OnPreChanExpire);
+	implements[I_OnChanExpire] = ImplementsEvent(&T::OnChanExpire);
+	implements[I_OnPreServerConnect] = ImplementsEvent(&T::OnPreServerConnect);
+	implements[I_OnServerConnect] = ImplementsEvent(&T::OnServerConnect);
+	implements[I_OnPreUplinkSync] = ImplementsEvent(&T::OnPreUplinkSync);
+	implements[I_OnServerDisconnect] = ImplementsEvent(&T::OnServerDisconnect);
+	implements[I_OnRestart] = ImplementsEvent(&T::OnRestart);
+	implements[I_OnShutdown] = ImplementsEvent(&T::OnShutdown);
+	implements[I_OnPreNickExpire] = ImplementsEvent(&T::OnPreNickExpire);
+	implements[I_OnNickExpire] = ImplementsEvent(&T::OnNickExpire);
+	implements[I_OnDefconLevel] = ImplementsEvent(&T::OnDefconLevel);
+	implements[I_OnExceptionAdd] = ImplementsEvent(&T::OnExceptionAdd);
+	implements[I_OnExceptionDel] = ImplementsEvent(&T::OnExceptionDel);
+	implements[I_OnAddXLine] = ImplementsEvent(&T::OnAddXLine);
+	implements[I_OnDelXLine] = ImplementsEvent(&T::OnDelXLine);
+	implements[I_IsServicesOper] = ImplementsEvent(&T::IsServicesOper);
+	implements[I_OnServerQuit] = ImplementsEvent(&T::OnServerQuit);
+	implements[I_OnUserQuit] = ImplementsEvent(&T::OnUserQuit);
+	implements[I_OnPreUserLogoff] = ImplementsEvent(&T::OnPreUserLogoff);
+	implements[I_OnPostUserLogoff] = ImplementsEvent(&T::OnPostUserLogoff);
+	implements[I_OnBotCreate] = ImplementsEvent(&T::OnBotCreate);
+	implements[I_OnBotChange] = ImplementsEvent(&T::OnBotChange);
+	implements[I_OnBotDelete] = ImplementsEvent(&T::OnBotDelete);
+	implements[I_OnAccessDel] = ImplementsEvent(&T::OnAccessDel);
+	implements[I_OnAccessAdd] = ImplementsEvent(&T::OnAccessAdd);
+	implements[I_OnAccessClear] = ImplementsEvent(&T::OnAccessClear);
+	implements[I_OnLevelChange] = ImplementsEvent(&T::OnLevelChange);
+	implements[I_OnChanDrop] = ImplementsEvent(&T::OnChanDrop);
+	implements[I_OnChanRegistered] = ImplementsEvent(&T::OnChanRegistered);
+	implements[I_OnChanSuspend] = ImplementsEvent(&T::OnChanSuspend);
+	implements[I_OnChanUnsuspend] = ImplementsEvent(&T::OnChanUnsuspend);
+	implements[I_OnCreateChan] = ImplementsEvent(&T::OnCreateChan);
+	implements[I_OnDelChan] = ImplementsEvent(&T::OnDelChan);
+	implements[I_OnChannelCreate] = ImplementsEvent(&T::OnChannelCreate);
+	implements[I_OnChannelDelete] = ImplementsEvent(&T::OnChannelDelete);
+	implements[I_OnAkickAdd] = ImplementsEvent(&T::OnAkickAdd);
+	implements[I_OnAkickDel] = ImplementsEvent(&T::OnAkickDel);
+	implements[I_OnCheckKick] = ImplementsEvent(&T::OnCheckKick);
+	implements[I_OnChanInfo] = ImplementsEvent(&T::OnChanInfo);
+	implements[I_OnCheckPriv] = ImplementsEvent(&T::OnCheckPriv);
+	implements[I_OnGroupCheckPriv] = ImplementsEvent(&T::OnGroupCheckPriv);
+	implements[I_OnNickDrop] = ImplementsEvent(&T::OnNickDrop);
+	implements[I_OnNickGroup] = ImplementsEvent(&T::OnNickGroup);
+	implements[I_OnNickIdentify] = ImplementsEvent(&T::OnNickIdentify);
+	implements[I_OnUserLogin] = ImplementsEvent(&T::OnUserLogin);
+	implements[I_OnNickLogout] = ImplementsEvent(&T::OnNickLogout);
+	implements[I_OnNickRegister] = ImplementsEvent(&T::OnNickRegister);
+	implements[I_OnNickConfirm] = ImplementsEvent(&T::OnNickConfirm);
+	implements[I_OnNickSuspend] = ImplementsEvent(&T::OnNickSuspend);
+	implements[I_OnNickUnsuspended] = ImplementsEvent(&T::OnNickUnsuspended);
+	implements[I_OnDelNick] = ImplementsEvent(&T::OnDelNick);
+	implements[I_OnNickCoreCreate] = ImplementsEvent(&T::OnNickCoreCreate);
+	implements[I_OnDelCore] = ImplementsEvent(&T::OnDelCore);
+	implements[I_OnChangeCoreDisplay] = ImplementsEvent(&T::OnChangeCoreDisplay);
+	implements[I_OnNickClearAccess] = ImplementsEvent(&T::OnNickClearAccess);
+	implements[I_OnNickAddAccess] = ImplementsEvent(&T::OnNickAddAccess);
+	implements[I_OnNickEraseAccess] = ImplementsEvent(&T::OnNickEraseAccess);
+	implements[I_OnNickClearCert] = ImplementsEvent(&T::OnNickClearCert);
+	implements[I_OnNickAddCert] = ImplementsEvent(&T::OnNickAddCert);
+	implements[I_OnNickEraseCert] = ImplementsEvent(&T::OnNickEraseCert);
+	implements[I_OnNickInfo] = ImplementsEvent(&T::OnNickInfo);
+	implements[I_OnBotInfo] = ImplementsEvent(&T::OnBotInfo);
+	implements[I_OnCheckAuthentication] = ImplementsEvent(&T::OnCheckAuthentication);
+	implements[I_OnNickUpdate] = ImplementsEvent(&T::OnNickUpdate);
+	implements[I_OnFingerprint] = ImplementsEvent(&T::OnFingerprint);
+	implements[I_OnUserAway] = ImplementsEvent(&T::OnUserAway);
+	implements[I_OnInvite] = ImplementsEvent(&T::OnInvite);
+	implements[I_OnDeleteVhost] = ImplementsEvent(&T::OnDeleteVhost);
+	implements[I_OnSetVhost] = ImplementsEvent(&T::OnSetVhost);
+	implements[I_OnSetDisplayedHost] = ImplementsEvent(&T::OnSetDisplayedHost);
+	implements[I_OnMemoSend] = ImplementsEvent(&T::OnMemoSend);
+	implements[I_OnMemoDel] = ImplementsEvent(&T::OnMemoDel);
+	implements[I_OnChannelModeSet] = ImplementsEvent(&T::OnChannelModeSet);
+	implements[I_OnChannelModeUnset] = ImplementsEvent(&T::OnChannelModeUnset);
+	implements[I_OnUserModeSet] = ImplementsEvent(&T::OnUserModeSet);
+	implements[I_OnUserModeUnset] = ImplementsEvent(&T::OnUserModeUnset);
+	implements[I_OnChannelModeAdd] = ImplementsEvent(&T::OnChannelModeAdd);
+	implements[I_OnUserModeAdd] = ImplementsEvent(&T::OnUserModeAdd);
+	implements[I_OnMLock] = ImplementsEvent(&T::OnMLock);
+	implements[I_OnUnMLock] = ImplementsEvent(&T::OnUnMLock);
+	implements[I_OnModuleLoad] = ImplementsEvent(&T::OnModuleLoad);
+	implements[I_OnModuleUnload] = ImplementsEvent(&T::OnModuleUnload);
+	implements[I_OnServerSync] = ImplementsEvent(&T::OnServerSync);
+	implements[I_OnUplinkSync] = ImplementsEvent(&T::OnUplinkSync);
+	implements[I_OnBotPrivmsg] = ImplementsEvent(&T::OnBotPrivmsg);
+	implements[I_OnBotNotice] = ImplementsEvent(&T::OnBotNotice);
+	implements[I_OnPrivmsg] = ImplementsEvent(&T::OnPrivmsg);
+	implements[I_OnLog] = ImplementsEvent(&T::OnLog);
+	implements[I_OnLogMessage] = ImplementsEvent(&T::OnLogMessage);
+	implements[I_OnDnsRequest] = ImplementsEvent(&T::OnDnsRequest);
+	implements[I_OnCheckModes] = ImplementsEvent(&T::OnCheckModes);
+	implements[I_OnChannelSync] = ImplementsEvent(&T::OnChannelSync);
+	implements[I_OnSetCorrectModes] = ImplementsEvent(&T::OnSetCorrectModes);
+	implements[I_OnSerializeCheck] = ImplementsEvent(&T::OnSerializeCheck);
+	implements[I_OnSerializableConstruct] = ImplementsEvent(&T::OnSerializableConstruct);
+	implements[I_OnSerializableDestruct] = ImplementsEvent(&T::OnSerializableDestruct);
+	implements[I_OnSerializableUpdate] = ImplementsEvent(&T::OnSerializableUpdate);
+	implements[I_OnSerializeTypeCreate] = ImplementsEvent(&T::OnSerializeTypeCreate);
+	implements[I_OnSetChannelOption] = ImplementsEvent(&T::OnSetChannelOption);
+	implements[I_OnSetNickOption] = ImplementsEvent(&T::OnSetNickOption);
+	implements[I_OnMessage] = ImplementsEvent(&T::OnMessage);
+	implements[I_OnCanSet] = ImplementsEvent(&T::OnCanSet);
+	implements[I_OnCheckDelete] = ImplementsEvent(&T::OnCheckDelete);
+	implements[I_OnExpireTick] = ImplementsEvent(&T::OnExpireTick);
+	implements[I_OnNickValidate] = ImplementsEvent(&T::OnNickValidate);
+}
+
+/** Time spent in one module's handler for one event, measured if hook profiling is enabled
+ */
+struct HookStats
+{
+	Module *module;
+	Implementation event;
+	/* Number of calls */
+	unsigned long calls;
+	/* Total and longest time spent in the handler, in microseconds */
+	uint64_t total, max;
+
+	HookStats() : module(NULL), event(I_SIZE), calls(0), total(0), max(0) { }
+};
+
 /** Used to manage modules.
  */
 class CoreExport ModuleManager
@@ -1138,6 +1303,14 @@ class CoreExport ModuleManager
 	 */
 	static std::vector<Module *> EventHandlers[I_SIZE];
 
+	/** Whether the time spent in event handlers is measured, set by options:hookprofile
+	 */
+	static bool ProfileHooks;
+
+	/** Time spent in event handlers of each module, indexed by event
+	 */
+	static std::map<Module *, std::vector<HookStats> > HookProfile;
+
  	/** List of all modules loaded in Anope
 	 */
 	static std::list<Module *> Modules;
@@ -1216,6 +1389,26 @@ class CoreExport ModuleManager
 	 */
 	static void UnloadAll();
 
+	/** Get the name of an event
+	 * @param i The event
+	 * @return The name, eg "OnPrivmsg"
+	 */
+	static const char *GetEventName(Implementation i);
+
+	/** Get the time spent in every event handler which has been called since hook profiling was enabled
+	 * @param stats Filled in with the handlers, the ones which took the most time in total first
+	 */
+	static void GetHookStats(std::vector<HookStats> &stats);
+
+	/** Forget the time spent in all event handlers
+	 */
+	static void ResetHookStats();
+
+	/** Set how often the event handlers which have taken the most time are logged
+	 * @param interval The interval in seconds, or 0 to not log them
+	 */
+	static void SetHookProfileLog(time_t interval);
+
  private:
 	/** Call the module_delete function to safely delete the module
 	 * @param m the module to delete
@@ -1229,4 +1422,35 @@ class CoreExport ModuleManager
 	static ModuleVersion GetVersion(void *handle);
 };
 
+/** Measures how long a module's event handler takes, if hook profiling is enabled.
+ * Handlers which throw are not counted, as Stop is only called once they return.
+ */
+class CoreExport HookTimer
+{
+	Module *mod;
+	Implementation event;
+	uint64_t start;
+
+	void Start();
+	void Record();
+
+ public:
+	HookTimer(Module *m, Implementation i) : mod(NULL), event(i), start(0)
+	{
+		if (ModuleManager::ProfileHooks)
+		{
+			this->mod = m;
+			this->Start();
+		}
+	}
+
+	/** Count the time since the handler was called, called after it returns
+	 */
+	void Stop()
+	{
+		if (this->mod)
+			this->Record();
+	}
+};
+
 #endif // MODULES_H
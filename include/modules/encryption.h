@@ -32,4 +32,113 @@ namespace Encryption
 		virtual Context *CreateContext(IV * = NULL) = 0;
 		virtual IV GetDefaultIV() = 0;
 	};
+
+	/** Checks passwords for IdentifyRequests on behalf of an encryption module.
+	 * If the pool has worker threads the check is done on one of them and the
+	 * request is held until it finishes, otherwise it is done immediately.
+	 */
+	class CheckPool : public ThreadPool
+	{
+		class CheckTask : public ThreadPool::Task
+		{
+		 public:
+			CheckPool *pool;
+			/* Set to NULL if the request goes away before the check finishes */
+			IdentifyRequest *req;
+			Anope::string password, stored, hash;
+			bool matches;
+
+			CheckTask(CheckPool *p, IdentifyRequest *r, const Anope::string &s, const Anope::string &h) : pool(p), req(r), password(r->GetPassword()), stored(s), hash(h), matches(false)
+			{
+				pool->checks.insert(this);
+			}
+
+			~CheckTask()
+			{
+				pool->checks.erase(this);
+			}
+
+			void Run() anope_override
+			{
+				matches = pool->Compare(password, hash);
+			}
+
+			void OnFinish() anope_override
+			{
+				if (!req)
+					return;
+
+				/* Only accept the result if the password was not changed while we were checking it */
+				const NickAlias *na = NickAlias::Find(req->GetAccount());
+				if (matches && na && na->nc->pass.equals_cs(stored))
+					pool->OnMatch(req, na->nc);
+				req->Release(pool->owner);
+			}
+		};
+
+		/* Checks which have not finished yet */
+		std::set<CheckTask *> checks;
+
+	 protected:
+		Module *owner;
+
+	 public:
+		CheckPool(Module *o) : ThreadPool(o->name, 0), owner(o) { }
+
+		~CheckPool()
+		{
+			/* Workers call Compare, and deleting a check touches checks, so both must happen while we still exist */
+			this->ClearTasks();
+		}
+
+		/** Compare a password to a hash. This is called from worker threads.
+		 * @param password The password
+		 * @param hash The hash as given to Check()
+		 * @return true if the password matches
+		 */
+		virtual bool Compare(const Anope::string &password, const Anope::string &hash) = 0;
+
+		/** Called when a password matched
+		 * @param req The request
+		 * @param nc The account the password belongs to
+		 */
+		virtual void OnMatch(IdentifyRequest *req, NickCore *nc)
+		{
+			/* if we are NOT the first module in the list,
+			 * we want to re-encrypt the pass with the new encryption
+			 */
+			if (ModuleManager::FindFirstOf(ENCRYPTION) != owner)
+				Anope::Encrypt(req->GetPassword(), nc->pass);
+			req->Success(owner);
+		}
+
+		/** Check the password of a request
+		 * @param req The request
+		 * @param nc The account
+		 * @param hash The part of the account's password to pass to Compare()
+		 */
+		void Check(IdentifyRequest *req, NickCore *nc, const Anope::string &hash)
+		{
+			if (!this->GetThreads())
+			{
+				if (this->Compare(req->GetPassword(), hash))
+					this->OnMatch(req, nc);
+				return;
+			}
+
+			req->Hold(owner);
+			this->Add(new CheckTask(this, req, nc->pass, hash));
+			Log(LOG_DEBUG) << owner->name << ": queued password check for " << req->GetAccount() << ", " << this->QueueSize() << " checks waiting";
+		}
+
+		/** Forget about requests owned by a module which is being unloaded
+		 * @param m The module
+		 */
+		void OnModuleUnload(Module *m)
+		{
+			for (std::set<CheckTask *>::iterator it = checks.begin(), it_end = checks.end(); it != it_end; ++it)
+				if ((*it)->req && (*it)->req->GetOwner() == m)
+					(*it)->req = NULL;
+		}
+	};
 }
@@ -28,8 +28,22 @@ struct ForbidData
 	ForbidType type;
 
 	virtual ~ForbidData() { }
+
+	/** Check if a string matches the mask of this forbid. The mask is compiled
+	 * the first time it is matched, and again if it has changed.
+	 * @param str The string
+	 * @return true if it matches
+	 */
+	bool Matches(const Anope::string &str)
+	{
+		if (compiled_mask.GetMask() != mask)
+			compiled_mask = Anope::CompiledMask(mask, true);
+		return compiled_mask.Matches(str);
+	}
  protected:
 	ForbidData() : created(0), expires(0) { }
+ private:
+	Anope::CompiledMask compiled_mask;
 };
 
 class ForbidService : public Service
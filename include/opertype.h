@@ -63,6 +63,11 @@ class CoreExport OperType
 	 */
 	std::list<Anope::string> commands;
 
+	/** privs and commands as wildcards, with a leading ~ removed, so
+	 * they are not split up again on every check.
+	 */
+	std::list<Anope::Glob> priv_globs, command_globs;
+
 	/** Set of opertypes we inherit from
 	 */
 	std::set<OperType *> inheritances;
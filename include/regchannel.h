@@ -19,11 +19,17 @@
 
 typedef Anope::hash_map<ChannelInfo *> registered_channel_map;
 
+struct ChanAccessIndex;
+struct AutoKickIndex;
+
 extern CoreExport Serialize::Checker<registered_channel_map> RegisteredChannelList;
 
 /* AutoKick data. */
 class CoreExport AutoKick : public Serializable
 {
+	/* The mask parsed as a ban, kept until the mask changes */
+	mutable Entry *entry;
+
  public:
 	/* Channel this autokick is on */
 	Serialize::Reference<ChannelInfo> ci;
@@ -40,6 +46,11 @@ class CoreExport AutoKick : public Serializable
 	~AutoKick();
 	void Serialize(Serialize::Data &data) const anope_override;
 	static Serializable* Unserialize(Serializable *obj, Serialize::Data &);
+
+	/** Get the mask of this akick parsed as a ban, so it does not have to be parsed every time it is matched
+	 * @return The parsed mask
+	 */
+	const Entry &GetEntry() const;
 };
 
 /* It matters that Base is here before Extensible (it is inherited by Serializable)
@@ -54,6 +65,16 @@ class CoreExport ChannelInfo : public Serializable, public Extensible
 	Serialize::Checker<std::vector<ChanAccess *> > access;			/* List of authorized users */
 	Serialize::Checker<std::vector<AutoKick *> > akick;			/* List of users to kickban */
 	Anope::map<int16_t> levels;
+	ChanAccessIndex *access_index;						/* Index of the access list, built when first needed */
+	AutoKickIndex *akick_index;						/* Index of the akick list, built when first needed */
+
+	/** Drop the index of the access list, it is rebuilt when next needed
+	 */
+	void InvalidateAccessIndex();
+
+	/** Drop the index of the akick list, it is rebuilt when next needed
+	 */
+	void InvalidateAkickIndex();
 
  public:
  	friend class ChanAccess;
@@ -135,6 +156,15 @@ class CoreExport ChannelInfo : public Serializable, public Extensible
 	AccessGroup AccessFor(const User *u, bool updateLastUsed = true);
 	AccessGroup AccessFor(const NickCore *nc, bool updateLastUsed = true);
 
+	/** Find the access entries which could match a user or account, without checking
+	 * every entry. Entries are given in access list order, and still need to be checked
+	 * with ChanAccess::Matches.
+	 * @param u The user, or NULL
+	 * @param account The account, or NULL
+	 * @param entries Filled with the entries
+	 */
+	void FindAccessCandidates(const User *u, const NickCore *account, std::vector<ChanAccess *> &entries);
+
 	/** Get the size of the accss vector for this channel
 	 * @return The access vector size
 	 */
@@ -188,6 +218,13 @@ class CoreExport ChannelInfo : public Serializable, public Extensible
 	 */
 	unsigned GetAkickCount() const;
 
+	/** Find the akicks which could match a user, without checking every akick.
+	 * Akicks are given in akick list order, and still need to be checked.
+	 * @param u The user
+	 * @param akicks Filled with the akicks
+	 */
+	void FindAkickCandidates(User *u, std::vector<AutoKick *> &akicks);
+
 	/** Erase an entry from the channel akick list
 	 * @param index The index of the akick
 	 */
@@ -39,7 +39,87 @@ class CoreExport RegexProvider : public Service
 {
  public:
 	RegexProvider(Module *o, const Anope::string &n) : Service(o, "Regex", n) { }
+	/* Removes the regexes compiled by this provider from the regex cache */
+	virtual ~RegexProvider();
 	virtual Regex *Compile(const Anope::string &) = 0;
 };
 
+namespace Anope { class CompiledMask; }
+
+/** A bounded, least recently used cache of compiled regexes, keyed by regex engine
+ * and expression. It is flushed when the configuration is reloaded, and regexes
+ * compiled by a regex engine are removed when the engine is unloaded.
+ */
+class CoreExport RegexCache
+{
+	friend class Anope::CompiledMask;
+
+	/* Masks which have their own compiled regex */
+	static std::set<Anope::CompiledMask *> Masks;
+
+ public:
+	/** Get a compiled regex, compiling it if it is not cached. The regex is owned
+	 * by the cache, and may be deleted by the next call to Get.
+	 * @param engine The name of the regex engine, eg regex/pcre
+	 * @param expression The expression
+	 * @return The regex, or NULL if the engine does not exist or the expression is invalid
+	 */
+	static Regex *Get(const Anope::string &engine, const Anope::string &expression);
+
+	/** Remove every regex from the cache, and from compiled masks
+	 */
+	static void Flush();
+
+	/** Remove the regexes compiled by an engine from the cache and from compiled masks
+	 * @param engine The name of the regex engine
+	 */
+	static void Flush(const Anope::string &engine);
+};
+
+namespace Anope
+{
+	/** A mask which is matched against many strings, such as a forbid. A regex mask
+	 * (enclosed in //) is compiled the first time it is matched and kept, instead of
+	 * being looked up on every match.
+	 */
+	class CoreExport CompiledMask
+	{
+		friend class ::RegexCache;
+
+		Anope::string mask;
+		bool use_regex;
+		/* The mask as a case insensitive wildcard, for strings the regex does not match */
+		Glob glob;
+		/* The regex if the mask is one and it has been compiled */
+		mutable Regex *regex;
+		/* The engine regex was compiled with */
+		mutable Anope::string engine;
+		/* Whether compiling the regex has been tried */
+		mutable bool compiled;
+
+		void Reset() const;
+
+	 public:
+		/** Constructor
+		 * @param m The mask
+		 * @param r Whether to treat masks enclosed in // as regexes
+		 */
+		CompiledMask(const Anope::string &m = "", bool r = false);
+		CompiledMask(const CompiledMask &other);
+		~CompiledMask();
+		CompiledMask &operator=(const CompiledMask &other);
+
+		/** Get the mask
+		 */
+		const Anope::string &GetMask() const;
+
+		/** Check if a string matches the mask, the same as Anope::Match(str, mask, case_sensitive, use_regex)
+		 * @param str The string
+		 * @param case_sensitive Whether the match is case sensitive
+		 * @return true if the string matches
+		 */
+		bool Matches(const Anope::string &str, bool case_sensitive = false) const;
+	};
+}
+
 #endif // REGEXPR_H
@@ -114,6 +114,8 @@ class CoreExport Serialize::Type : public Base
 
 	static std::vector<Anope::string> TypeOrder;
 	static std::map<Anope::string, Serialize::Type *> Types;
+	/* Bumped when every type may have been changed outside of Anope */
+	static unsigned long generation;
 
 	/* The name of this type, should be a class name */
 	Anope::string name;
@@ -129,6 +131,12 @@ class CoreExport Serialize::Type : public Base
 	 */
 	time_t timestamp;
 
+	/* The generation this type last checked for changes at, 0 if it has been marked stale */
+	unsigned long checked;
+
+	/* Asks the database modules to update this type */
+	void Refresh();
+
  public:
  	/* Map of Serializable::id to Serializable objects */
 	std::map<uint64_t, Serializable *> objects;
@@ -155,8 +163,26 @@ class CoreExport Serialize::Type : public Base
 	Serializable *Unserialize(Serializable *obj, Serialize::Data &data);
 
 	/** Check if this object type has any pending changes and update them.
+	 * This only goes to the database modules if the type has been marked
+	 * stale since the last check, so it is cheap to call often.
+	 */
+	inline void Check()
+	{
+		if (this->checked != generation)
+		{
+			this->checked = generation;
+			this->Refresh();
+		}
+	}
+
+	/** Marks this type as possibly changed outside of Anope, so the
+	 * next Check() asks the database modules for changes.
+	 */
+	void MarkStale() { this->checked = 0; }
+
+	/** Marks every type stale
 	 */
-	void Check();
+	static void MarkAllStale();
 
 	/** Gets the timestamp for the object type. That is, the time we know
 	 * all objects of this type are updated at least to.
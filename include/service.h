@@ -43,6 +43,9 @@ class CoreExport Service : public virtual Base
 	}
 
  public:
+	/* Incremented whenever a service or alias is added or removed, so lookups can be cached */
+	static unsigned long Generation;
+
  	static Service *FindService(const Anope::string &t, const Anope::string &n)
 	{
 		std::map<Anope::string, std::map<Anope::string, Service *> >::const_iterator it = Services.find(t);
@@ -70,6 +73,7 @@ class CoreExport Service : public virtual Base
 	{
 		std::map<Anope::string, Anope::string> &smap = Aliases[t];
 		smap[n] = v;
+		++Generation;
 	}
 
 	static void DelAlias(const Anope::string &t, const Anope::string &n)
@@ -78,6 +82,7 @@ class CoreExport Service : public virtual Base
 		smap.erase(n);
 		if (smap.empty())
 			Aliases.erase(t);
+		++Generation;
 	}
 
 	Module *owner;
@@ -102,6 +107,7 @@ class CoreExport Service : public virtual Base
 		if (smap.find(this->name) != smap.end())
 			throw ModuleException("Service " + this->type + " with name " + this->name + " already exists");
 		smap[this->name] = this;
+		++Generation;
 	}
 
 	void Unregister()
@@ -110,6 +116,7 @@ class CoreExport Service : public virtual Base
 		smap.erase(this->name);
 		if (smap.empty())
 			Services.erase(this->type);
+		++Generation;
 	}
 };
 
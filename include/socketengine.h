@@ -45,6 +45,10 @@ class CoreExport SocketEngine
 	static void SetLastError(int);
 
 	static bool IgnoreErrno();
+
+	/** Check whether the last socket call failed only because it would block
+	 */
+	static bool WouldBlock();
 };
 
 #endif // SOCKETENGINE_H
@@ -115,6 +115,86 @@ class CoreExport cidr
 	};
 };
 
+/** A chunked byte queue used for socket I/O. Data is appended to the tail and
+ * consumed from the head without ever moving the bytes that remain queued, so
+ * the cost of draining the buffer is linear in the amount of data sent.
+ */
+class CoreExport SocketBuffer
+{
+ public:
+	/* Size of each chunk */
+	static const size_t CHUNK_SIZE = 16384;
+
+ private:
+	struct Chunk
+	{
+		char data[CHUNK_SIZE];
+		/* Offset of the first unconsumed byte */
+		size_t start;
+		/* Offset one past the last byte written */
+		size_t end;
+	};
+
+	std::deque<Chunk *> chunks;
+	/* Emptied chunks kept around for reuse */
+	std::vector<Chunk *> spare;
+	/* Total number of bytes queued */
+	size_t len;
+
+	Chunk *NewChunk();
+	void FreeChunk(Chunk *c);
+
+ public:
+	SocketBuffer();
+	~SocketBuffer();
+
+	/** Append data to the end of the buffer
+	 * @param data The data
+	 * @param sz The length of data
+	 */
+	void Append(const char *data, size_t sz);
+
+	/** Remove data from the front of the buffer
+	 * @param sz The number of bytes to remove
+	 */
+	void Consume(size_t sz);
+
+	/** Remove all data from the buffer
+	 */
+	void Clear();
+
+	/** Get the number of bytes in the buffer
+	 */
+	inline size_t Length() const { return this->len; }
+
+	/** Check if the buffer is empty
+	 */
+	inline bool Empty() const { return this->len == 0; }
+
+	/** Get the number of contiguous segments the data is stored in
+	 */
+	inline size_t Segments() const { return this->chunks.size(); }
+
+	/** Get a contiguous segment of data
+	 * @param i The segment number, 0 is the front of the buffer
+	 * @param sz Set to the length of the segment
+	 * @return The segment
+	 */
+	const char *Segment(size_t i, size_t &sz) const;
+
+	/** Extract the first line from the buffer. The buffer is scanned in place
+	 * and the line is copied exactly once, into line.
+	 * @param line Set to the line, without the trailing newline
+	 * @return true if a complete line was found
+	 */
+	bool GetLine(Anope::string &line);
+
+	/** Remove any of the given characters from the front of the buffer
+	 * @param what The characters to remove
+	 */
+	void LTrim(const char *what);
+};
+
 class SocketException : public CoreException
 {
  public:
@@ -138,6 +218,11 @@ enum SocketFlag
 	SF_CONNECTED,
 	SF_ACCEPTING,
 	SF_ACCEPTED,
+	/* Set by Process and ProcessRead/ProcessWrite when reading or writing stopped because the
+	 * socket would block, so edge triggered socket engines know to wait for the next event
+	 */
+	SF_READ_BLOCKED,
+	SF_WRITE_BLOCKED,
 	SF_SIZE
 };
 
@@ -162,6 +247,14 @@ class CoreExport SocketIO
 	virtual int Send(Socket *s, const char *buf, size_t sz);
 	int Send(Socket *s, const Anope::string &buf);
 
+	/** Write as much of a buffer as possible to the socket. The data is not
+	 * consumed from the buffer.
+	 * @param s The socket
+	 * @param buf The buffer to write from
+	 * @return Number of bytes written
+	 */
+	virtual int Send(Socket *s, const SocketBuffer &buf);
+
 	/** Accept a connection from a socket
 	 * @param s The socket
 	 * @return The new socket
@@ -278,9 +371,9 @@ class CoreExport BufferedSocket : public virtual Socket
 {
  protected:
  	/* Things read from the socket */
- 	Anope::string read_buffer;
+ 	SocketBuffer read_buffer;
 	/* Things to be written to the socket */
-	Anope::string write_buffer;
+	SocketBuffer write_buffer;
 	/* How much data was received from this socket on this recv() */
 	int recv_len;
 
@@ -302,6 +395,12 @@ class CoreExport BufferedSocket : public virtual Socket
 	 */
 	const Anope::string GetLine();
 
+	/** Gets the new line from the input buffer into an existing string, whose memory is reused
+	 * @param line Set to the line
+	 * @return true if there was a line
+	 */
+	bool GetLine(Anope::string &line);
+
 	/** Write to the socket
 	* @param message The message
 	*/
@@ -325,18 +424,8 @@ class CoreExport BufferedSocket : public virtual Socket
 class CoreExport BinarySocket : public virtual Socket
 {
  protected:
-	struct DataBlock
-	{
-		char *orig;
-		char *buf;
-		size_t len;
-
-		DataBlock(const char *b, size_t l);
-		~DataBlock();
-	};
-
 	/* Data to be written out */
-	std::deque<DataBlock *> write_buffer;
+	SocketBuffer write_buffer;
 
  public:
 	BinarySocket();
@@ -459,8 +548,46 @@ class CoreExport ClientSocket : public virtual Socket
 	virtual void OnError(const Anope::string &error);
 };
 
+/** Work which is run at the end of the current iteration of the main loop.
+ * Queueing a task which is already queued does nothing, so a task can be queued
+ * every time there is something for it to do and still run once. Tasks can be
+ * queued from any thread.
+ */
+class CoreExport DeferredTask
+{
+	/* Whether this task is queued */
+	bool queued;
+
+ public:
+	DeferredTask();
+	virtual ~DeferredTask();
+
+	/** Queue this task to run at the end of the current iteration of the main loop
+	 */
+	void Queue();
+
+	/** Called at the end of an iteration of the main loop this task was queued in
+	 */
+	virtual void Run() = 0;
+
+	/** Run the tasks which are queued, called by the main loop.
+	 * Tasks queued while doing so are run in the next iteration.
+	 */
+	static void RunQueued();
+};
+
 class CoreExport Pipe : public Socket
 {
+	/* Calls OnNotify when the pipe is notified */
+	class NotifyTask : public DeferredTask
+	{
+		Pipe *pipe;
+
+	 public:
+		NotifyTask(Pipe *p) : pipe(p) { }
+		void Run() anope_override;
+	} notify_task;
+
  public:
  	/** The FD of the write pipe
 	 * this->sock is the readfd
@@ -494,12 +621,14 @@ class CoreExport Pipe : public Socket
 	 */
 	bool SetWriteBlocking(bool state);
 
-	/** Called when this pipe needs to be woken up
-	 * Is the same as Write("\0", 1)
+	/** Called when this pipe needs to be woken up, OnNotify is called at the end of
+	 * the current iteration of the main loop however many times this is called.
+	 * Can be called from any thread, but not from another process, which should
+	 * Write to the pipe instead.
 	 */
 	void Notify();
 
-	/** Called after ProcessRead comes back from Notify(), overload to do something useful
+	/** Called after Notify(), or when data has been written to the pipe, overload to do something useful
 	 */
 	virtual void OnNotify() = 0;
 };
@@ -117,4 +117,105 @@ class CoreExport Condition : public Mutex
 	void Wait();
 };
 
+/** A pool of worker threads which run tasks queued from the main thread.
+ * Finished tasks are handed back to the main thread through the pool's pipe.
+ */
+class CoreExport ThreadPool : public Pipe
+{
+ public:
+	/** A unit of work for a thread pool
+	 */
+	class CoreExport Task
+	{
+	 public:
+		virtual ~Task() { }
+
+		/** Called from a worker thread. This must not touch anything
+		 * not owned by the task.
+		 */
+		virtual void Run() = 0;
+
+		/** Called from the main thread after Run() has finished.
+		 * The task is deleted after this returns.
+		 */
+		virtual void OnFinish() = 0;
+	};
+
+ private:
+	class Worker;
+
+	/* Name of the pool, for statistics */
+	Anope::string name;
+	/* Protects pending and finished */
+	Condition lock;
+	/* Tasks waiting to be run. A NULL task tells a worker to exit */
+	std::deque<Task *> pending;
+	/* Tasks which have been run, waiting for OnFinish */
+	std::deque<Task *> finished;
+	/* The worker threads */
+	std::vector<Worker *> workers;
+	/* The largest number of tasks that have been waiting at once */
+	size_t peak;
+	/* The number of tasks which have finished */
+	unsigned long completed;
+
+	void StopWorkers();
+
+ protected:
+	/** Join the worker threads and delete every task which has not finished, without calling OnFinish.
+	 * Derived classes which tasks call into must call this in their destructor, before their own
+	 * members are destroyed.
+	 */
+	void ClearTasks();
+
+ public:
+	/* All thread pools */
+	static std::set<ThreadPool *> Pools;
+
+	/** Constructor
+	 * @param n The name of the pool
+	 * @param threads The number of worker threads to start
+	 */
+	ThreadPool(const Anope::string &n, unsigned threads = 1);
+
+	/** Destructor, joins the worker threads and deletes any tasks which have not finished.
+	 * Derived classes which tasks call into must call ClearTasks() in their destructor.
+	 */
+	virtual ~ThreadPool();
+
+	/** Get the name of the pool
+	 */
+	const Anope::string &GetName() const;
+
+	/** Change the number of worker threads. Tasks already queued are kept.
+	 * @param threads The new number of threads
+	 */
+	void SetThreads(unsigned threads);
+
+	/** Get the number of worker threads
+	 */
+	unsigned GetThreads() const;
+
+	/** Queue a task to be run by a worker thread. The pool takes ownership of the task.
+	 * @param t The task
+	 */
+	void Add(Task *t);
+
+	/** Get the number of tasks waiting for a worker
+	 */
+	size_t QueueSize();
+
+	/** Get the largest number of tasks that have been waiting for a worker at once
+	 */
+	size_t PeakQueueSize() const;
+
+	/** Get the number of tasks that have finished
+	 */
+	unsigned long Completed() const;
+
+	/** Called when tasks have finished, calls their OnFinish
+	 */
+	void OnNotify() anope_override;
+};
+
 #endif // THREADENGINE_H
@@ -25,9 +25,9 @@ class CoreExport Timer
 	 */
 	time_t settime;
 
-	/** The triggering time
+	/** The triggering time, in milliseconds of the monotonic clock
 	 */
-	time_t trigger;
+	uint64_t expires;
 
 	/** Numer of seconds between triggers
 	 */
@@ -37,6 +37,13 @@ class CoreExport Timer
 	 */
 	bool repeat;
 
+	/** The wheel level this timer is in, and its links in that level's slot
+	 */
+	unsigned level;
+	Timer *next, **prev;
+
+	friend class TimerManager;
+
  public:
 	/** Constructor, initializes the triggering time
 	 * @param time_from_now The number of seconds from now to trigger the timer
@@ -62,6 +69,11 @@ class CoreExport Timer
 	 */
 	void SetTimer(time_t t);
 
+	/** Set the trigger time to a new value, for timers which need to trigger between seconds
+	 * @param ms The new time of the system clock, in milliseconds
+	 */
+	void SetTimerMS(uint64_t ms);
+
 	/** Retrieve the triggering time
 	 * @return The trigger time
 	 */
@@ -101,12 +113,22 @@ class CoreExport Timer
 /** This class manages sets of Timers, and triggers them at their defined times.
  * This will ensure timers are not missed, as well as removing timers that have
  * expired and allowing the addition of new ones.
+ *
+ * Timers are kept in a hierarchical timer wheel, so adding and deleting them
+ * takes constant time regardless of how many timers exist.
  */
 class CoreExport TimerManager
 {
-	/** A list of timers
+	/** Puts a timer into the wheel slot for its trigger time
+	 * @param t The timer
+	 */
+	static void Place(Timer *t);
+
+	/** Moves the timers in a slot of an upper level of the wheel down into the lower levels
+	 * @param level The level
+	 * @param slot The slot
 	 */
-	static std::multimap<time_t, Timer *> Timers;
+	static void Cascade(unsigned level, unsigned slot);
  public:
 	/** Add a timer to the list
 	 * @param t A Timer derived class to add
@@ -126,6 +148,12 @@ class CoreExport TimerManager
 	/** Deletes all timers owned by the given module
 	 */
 	static void DeleteTimersFor(Module *m);
+
+	/** Get how long until the next timer may be due
+	 * @param max The longest time to return
+	 * @return The number of milliseconds until the next timer may be due, at most max
+	 */
+	static long GetTimeout(long max);
 };
 
 #endif // TIMERS_H
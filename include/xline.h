@@ -56,6 +56,15 @@ class CoreExport XLineManager : public Service
 	Serialize::Checker<std::vector<XLine *> > xlines;
 	/* Akills can have the same IDs, sometimes */
 	static Serialize::Checker<std::multimap<Anope::string, XLine *, ci::less> > XLinesByUID;
+	/* Index of the xlines in this XLineManager, used by CheckAllXLines */
+	struct Index;
+	Index *xline_index;
+	/* The earliest time an xline in this XLineManager expires, 0 if none do */
+	time_t next_expire;
+
+	/** Remove any expired xlines
+	 */
+	void Expire();
  public:
 	/* List of XLine managers we check users against in XLineManager::CheckAll */
 	static std::list<XLineManager *> XLineManagers;
@@ -158,6 +167,13 @@ class CoreExport XLineManager : public Service
 	 */
 	virtual bool Check(User *u, const XLine *x) = 0;
 
+	/** Whether a user must match the host (or CIDR range) of a non-regex xline for Check() to
+	 * succeed. If so the xlines are indexed by host and CheckAllXLines only checks those whose
+	 * host the user could match, otherwise every xline is checked.
+	 * @return true to index xlines by host
+	 */
+	virtual bool IndexByHost() const;
+
 	/** Called when a user matches a xline in this XLineManager
 	 * @param u The user
 	 * @param x The XLine they match
@@ -227,11 +227,13 @@ class CommandBSBadwords : public Command
 		}
 		else
 		{
+			Anope::CompiledMask wordmask(word);
+
 			for (unsigned i = 0, end = bw->GetBadWordCount(); i < end; ++i)
 			{
 				const BadWord *b = bw->GetBadWord(i);
 
-				if (!word.empty() && !Anope::Match(b->word, word))
+				if (!word.empty() && !wordmask.Matches(b->word))
 					continue;
 
 				ListFormatter::ListEntry entry;
@@ -543,11 +543,16 @@ class CSAKick : public Module
 		if (!c->ci || c->MatchesList(u, "EXCEPT"))
 			return EVENT_CONTINUE;
 
-		for (unsigned j = 0, end = c->ci->GetAkickCount(); j < end; ++j)
+		std::vector<AutoKick *> akicks;
+		c->ci->FindAkickCandidates(u, akicks);
+
+		for (unsigned j = 0; j < akicks.size(); ++j)
 		{
-			AutoKick *autokick = c->ci->GetAkick(j);
+			AutoKick *autokick = akicks[j];
 			bool kick = false;
 
+			autokick->QueueUpdate();
+
 			if (autokick->nc)
 				kick = autokick->nc == u->Account();
 			else if (IRCD->IsChannelValid(autokick->mask))
@@ -556,7 +561,7 @@ class CSAKick : public Module
 				kick = chan != NULL && chan->FindUser(u);
 			}
 			else
-				kick = Entry("BAN", autokick->mask).Matches(u);
+				kick = autokick->GetEntry().Matches(u);
 
 			if (kick)
 			{
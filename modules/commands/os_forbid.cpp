@@ -99,7 +99,7 @@ class MyForbidService : public ForbidService
 		{
 			ForbidData *d = this->forbids(ftype)[i - 1];
 
-			if (Anope::Match(mask, d->mask, false, true))
+			if (d->Matches(mask))
 				return d;
 		}
 		return NULL;
@@ -13,8 +13,323 @@
 
 static unsigned int HARDMAX = 65536;
 
+/** A search of the log files, run on a worker thread. The files are searched from the most
+ * recent line back, using their indexes to skip blocks which can not match, and matches are
+ * handed back to the main thread to be sent as they are found.
+ */
+class LogSearch : public ThreadPool::Task
+{
+	/* Sends the matches found so far from the main thread */
+	class SendTask : public DeferredTask
+	{
+		LogSearch *search;
+
+	 public:
+		SendTask(LogSearch *s) : search(s) { }
+
+		void Run() anope_override
+		{
+			search->Send();
+		}
+	} send_task;
+
+	std::set<LogSearch *> &searches;
+	CommandSource source;
+	/* Whether the search runs on a worker, so the user could go away while it does */
+	bool async;
+	Anope::string search_string;
+	/* The files to search, the most recent first */
+	std::vector<Anope::string> files;
+	unsigned limit;
+
+	/* How lines are matched */
+	Regex *regex;
+	/* The module providing regex, which must not be unloaded while the search uses it */
+	Module *regex_owner;
+	/* Whether lines are matched against glob, for wildcard patterns and regexes without a regex engine */
+	bool wildcard;
+	Anope::Glob glob;
+	/* The trigrams every matching line contains, none if the indexes can not help */
+	LogIndexBlock required;
+
+	/* Protects results, cancelled and running, and is signalled when running is cleared */
+	Condition lock;
+	/* Matches waiting to be sent by the main thread */
+	std::vector<Anope::string> results;
+	bool cancelled;
+	/* Whether a thread is in Run */
+	bool running;
+
+	/* The matches found by the worker, and sent by the main thread */
+	unsigned found, sent;
+
+	bool IsCancelled()
+	{
+		lock.Lock();
+		bool c = cancelled;
+		lock.Unlock();
+		return c;
+	}
+
+	bool Matches(const Anope::string &buf) const
+	{
+		if (regex)
+			return regex->Matches(buf);
+		if (wildcard)
+			return glob.Matches(buf);
+		return buf.find_ci(search_string) != Anope::string::npos;
+	}
+
+	/* Search part of a log file, which starts and ends on a line boundary */
+	void SearchRange(std::ifstream &fd, uint64_t start, uint64_t end)
+	{
+		std::deque<Anope::string> matches;
+		unsigned remaining = limit - found;
+
+		fd.clear();
+		fd.seekg(start);
+
+		uint64_t pos = start;
+		Anope::string buf;
+		for (unsigned lines = 0; pos < end && std::getline(fd, buf.str()); ++lines)
+		{
+			pos += buf.length() + 1;
+
+			if (!buf.empty() && buf[buf.length() - 1] == '\r')
+				buf.erase(buf.length() - 1);
+
+			if (Matches(buf))
+			{
+				/* Only the most recent matches in the range are wanted */
+				matches.push_back(buf);
+				if (matches.size() > remaining)
+					matches.pop_front();
+			}
+
+			if (!(lines & 4095) && IsCancelled())
+				return;
+		}
+
+		if (matches.empty())
+			return;
+
+		found += matches.size();
+
+		lock.Lock();
+		results.insert(results.end(), matches.rbegin(), matches.rend());
+		lock.Unlock();
+		send_task.Queue();
+	}
+
+	void SearchFile(const Anope::string &name)
+	{
+		std::ifstream fd(name.c_str(), std::ios_base::in | std::ios_base::binary);
+		if (!fd.is_open())
+			return;
+
+		fd.seekg(0, std::ios_base::end);
+		uint64_t size = fd.tellg();
+
+		std::vector<LogIndexBlock> blocks;
+		std::ifstream idx(LogIndexBlock::GetIndexName(name).c_str(), std::ios_base::in | std::ios_base::binary);
+		for (LogIndexBlock block; idx.read(reinterpret_cast<char *>(&block), sizeof(block));)
+			blocks.push_back(block);
+
+		/* The ranges of the file which may have matches. Lines not covered by the index are always searched */
+		std::vector<std::pair<uint64_t, uint64_t> > ranges;
+		uint64_t pos = 0;
+		for (unsigned i = 0; i < blocks.size(); ++i)
+		{
+			const LogIndexBlock &block = blocks[i];
+			uint64_t block_end = std::min<uint64_t>(block.offset + block.length, size);
+			if (block.offset < pos || block.offset >= block_end)
+				continue;
+
+			if (block.offset > pos)
+				ranges.push_back(std::make_pair(pos, block.offset));
+			if (block.Contains(required))
+			{
+				if (!ranges.empty() && ranges.back().second == block.offset)
+					ranges.back().second = block_end;
+				else
+					ranges.push_back(std::make_pair(block.offset, block_end));
+			}
+			pos = block_end;
+		}
+		if (pos < size)
+			ranges.push_back(std::make_pair(pos, size));
+
+		for (unsigned i = ranges.size(); i > 0 && found < limit && !IsCancelled(); --i)
+			SearchRange(fd, ranges[i - 1].first, ranges[i - 1].second);
+	}
+
+ public:
+	LogSearch(std::set<LogSearch *> &s, CommandSource &src, bool a, const Anope::string &str, const std::vector<Anope::string> &f, unsigned l)
+		: send_task(this), searches(s), source(src), async(a), search_string(str), files(f), limit(l), regex(NULL), regex_owner(NULL), wildcard(false), cancelled(false), running(false), found(0), sent(0)
+	{
+		searches.insert(this);
+
+		if (search_string.length() > 2 && search_string[0] == '/' && search_string[search_string.length() - 1] == '/')
+		{
+			/* The index can not help with regexes */
+			ServiceReference<RegexProvider> provider("Regex", Config->RegexEngine);
+			if (provider)
+				try
+				{
+					regex = provider->Compile(search_string.substr(1, search_string.length() - 2));
+					regex_owner = provider->owner;
+				}
+				catch (const RegexException &) { }
+			wildcard = true;
+			glob = Anope::Glob(search_string);
+		}
+		else if (search_string.find_first_of("?*") != Anope::string::npos)
+		{
+			wildcard = true;
+			glob = Anope::Glob("*" + search_string + "*");
+
+			sepstream sep(search_string, '*');
+			for (Anope::string token; sep.GetToken(token);)
+			{
+				sepstream qsep(token, '?');
+				for (Anope::string part; qsep.GetToken(part);)
+					required.Add(part.c_str(), part.length());
+			}
+		}
+		else
+			required.Add(search_string.c_str(), search_string.length());
+	}
+
+	~LogSearch()
+	{
+		delete regex;
+		searches.erase(this);
+	}
+
+	/** Stop the search as soon as possible, nothing more is sent
+	 */
+	void Cancel()
+	{
+		lock.Lock();
+		cancelled = true;
+		results.clear();
+		lock.Unlock();
+	}
+
+	/** Get the user who started the search
+	 */
+	User *GetUser()
+	{
+		return source.GetUser();
+	}
+
+	/** Wait for a cancelled search to stop running on its worker
+	 */
+	void WaitStopped()
+	{
+		lock.Lock();
+		while (running)
+			lock.Wait();
+		lock.Unlock();
+	}
+
+	/** Check whether the search uses a regex from the given module
+	 */
+	bool UsesRegexFrom(Module *m) const
+	{
+		return regex && regex_owner == m;
+	}
+
+	/** Delete the regex, as the module providing it is being unloaded. The search must be
+	 * cancelled and not running
+	 */
+	void DropRegex()
+	{
+		delete regex;
+		regex = NULL;
+		regex_owner = NULL;
+
+		if (!async || source.GetUser())
+			source.Reply(_("Search for \002%s\002 cancelled, as the regex engine was unloaded."), search_string.c_str());
+	}
+
+	/* Called from a worker thread, or the main thread if there are no workers */
+	void Run() anope_override
+	{
+		lock.Lock();
+		running = !cancelled;
+		lock.Unlock();
+
+		for (unsigned i = 0; running && i < files.size() && found < limit && !IsCancelled(); ++i)
+			SearchFile(files[i]);
+
+		lock.Lock();
+		running = false;
+		lock.Wakeup();
+		lock.Unlock();
+	}
+
+	/** Send the matches found so far
+	 */
+	void Send()
+	{
+		lock.Lock();
+		std::vector<Anope::string> matches;
+		matches.swap(results);
+		bool c = cancelled;
+		lock.Unlock();
+
+		if (c || matches.empty())
+			return;
+
+		if (async && !source.GetUser())
+		{
+			/* They went away */
+			Cancel();
+			return;
+		}
+
+		if (!sent)
+			source.Reply(_("Matches for \002%s\002:"), search_string.c_str());
+		for (unsigned i = 0; i < matches.size(); ++i)
+			source.Reply("#%d: %s", ++sent, matches[i].c_str());
+	}
+
+	void OnFinish() anope_override
+	{
+		this->Send();
+
+		if (IsCancelled())
+			return;
+
+		if (!sent)
+			source.Reply(_("No matches for \002%s\002 found."), search_string.c_str());
+		else
+			source.Reply(_("Showed %d matches for \002%s\002, most recent first."), sent, search_string.c_str());
+	}
+};
+
+class LogSearchPool : public ThreadPool
+{
+ public:
+	/* The searches which have not finished, this outlives the pool as searches are deleted by ~ThreadPool */
+	std::set<LogSearch *> &searches;
+
+	LogSearchPool(Module *o, std::set<LogSearch *> &s) : ThreadPool(o->name, 0), searches(s) { }
+
+	~LogSearchPool()
+	{
+		/* Make the workers give up on their searches, so they can be joined quickly */
+		for (std::set<LogSearch *>::iterator it = searches.begin(), it_end = searches.end(); it != it_end; ++it)
+			(*it)->Cancel();
+		this->SetThreads(0);
+	}
+};
+
 class CommandOSLogSearch : public Command
 {
+	LogSearchPool &pool;
+
 	static inline Anope::string CreateLogName(const Anope::string &file, time_t t = Anope::CurTime)
 	{
 		char timestamp[32];
@@ -27,7 +342,7 @@ class CommandOSLogSearch : public Command
 	}
 
  public:
-	CommandOSLogSearch(Module *creator) : Command(creator, "operserv/logsearch", 1, 3)
+	CommandOSLogSearch(Module *creator, LogSearchPool &p) : Command(creator, "operserv/logsearch", 1, 3), pool(p)
 	{
 		this->SetDesc(_("Searches logs for a matching pattern"));
 		this->SetSyntax(_("[+\037days\037d] [+\037limit\037l] \037pattern\037"));
@@ -91,65 +406,26 @@ class CommandOSLogSearch : public Command
 
 		Log(LOG_ADMIN, source, this) << "for " << search_string;
 
-		bool wildcard = search_string.find_first_of("?*") != Anope::string::npos;
-		bool regex = search_string.empty() == false && search_string[0] == '/' && search_string[search_string.length() - 1] == '/';
-
 		const Anope::string &logfile_name = Config->GetModule(this->owner)->Get<const Anope::string>("logname");
-		std::vector<Anope::string> matches;
-		for (int d = days - 1; d >= 0; --d)
+		std::vector<Anope::string> files;
+		for (int d = 0; d < days; ++d)
 		{
-			Anope::string lf_name = CreateLogName(logfile_name, Anope::CurTime - (d * 86400));
-			Log(LOG_DEBUG) << "Searching " << lf_name;
-			std::fstream fd(lf_name.c_str(), std::ios_base::in);
-			if (!fd.is_open())
-				continue;
-
-			for (Anope::string buf, token; std::getline(fd, buf.str());)
-			{
-				bool match = false;
-
-				if (regex)
-					match = Anope::Match(buf, search_string, false, true);
-				else if (wildcard)
-					match = Anope::Match(buf, "*" + search_string + "*");
-				else
-					match = buf.find_ci(search_string) != Anope::string::npos;
-
-				if (match)
-				{
-					matches.push_back(buf);
-
-					if (matches.size() >= HARDMAX)
-						break;
-				}
-			}
-
-			fd.close();
+			files.push_back(CreateLogName(logfile_name, Anope::CurTime - (d * 86400)));
+			Log(LOG_DEBUG) << "Searching " << files.back();
 		}
 
-		unsigned int found = matches.size();
-		if (!found)
+		/* Replies to sources other than users, such as the web panel, must be sent before returning */
+		bool async = pool.GetThreads() && source.GetUser();
+		LogSearch *search = new LogSearch(pool.searches, source, async, search_string, files, std::min<unsigned>(replies, HARDMAX));
+		if (async)
 		{
-			source.Reply(_("No matches for \002%s\002 found."), search_string.c_str());
+			pool.Add(search);
 			return;
 		}
 
-		if (matches.size() >= HARDMAX)
-		{
-			source.Reply(_("Too many results for \002%s\002."), search_string.c_str());
-			return;
-		}
-
-		if (matches.size() > static_cast<unsigned int>(replies))
-		{
-			matches.erase(matches.begin(), matches.begin() + (matches.size() - static_cast<unsigned int>(replies)));
-		}
-
-		source.Reply(_("Matches for \002%s\002:"), search_string.c_str());
-		unsigned int count = 0;
-		for (std::vector<Anope::string>::iterator it = matches.begin(), it_end = matches.end(); it != it_end; ++it)
-			source.Reply("#%d: %s", ++count, it->c_str());
-		source.Reply(_("Showed %d/%d matches for \002%s\002."), matches.size(), found, search_string.c_str());
+		search->Run();
+		search->OnFinish();
+		delete search;
 	}
 
 	bool OnHelp(CommandSource &source, const Anope::string &subcommand) anope_override
@@ -173,12 +449,46 @@ class CommandOSLogSearch : public Command
 
 class OSLogSearch : public Module
 {
+	std::set<LogSearch *> searches;
+	LogSearchPool pool;
 	CommandOSLogSearch commandoslogsearch;
 
  public:
 	OSLogSearch(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, VENDOR),
-		commandoslogsearch(this)
+		pool(this, searches), commandoslogsearch(this, pool)
+	{
+	}
+
+	void OnReload(Configuration::Conf *conf) anope_override
+	{
+		pool.SetThreads(conf->GetModule(this)->Get<unsigned>("threads", "1"));
+	}
+
+	void OnModuleUnload(User *, Module *m) anope_override
+	{
+		/* Searches can not keep using a regex engine which is going away */
+		std::vector<LogSearch *> affected;
+		for (std::set<LogSearch *>::iterator it = searches.begin(), it_end = searches.end(); it != it_end; ++it)
+			if ((*it)->UsesRegexFrom(m))
+			{
+				(*it)->Cancel();
+				affected.push_back(*it);
+			}
+
+		/* Cancelled searches stop within a few thousand lines, other searches keep running */
+		for (unsigned i = 0; i < affected.size(); ++i)
+		{
+			affected[i]->WaitStopped();
+			affected[i]->DropRegex();
+		}
+	}
+
+	void OnUserQuit(User *u, const Anope::string &msg) anope_override
 	{
+		/* Searches with nobody to send their matches to are not worth finishing */
+		for (std::set<LogSearch *>::iterator it = searches.begin(), it_end = searches.end(); it != it_end; ++it)
+			if ((*it)->GetUser() == u)
+				(*it)->Cancel();
 	}
 };
 
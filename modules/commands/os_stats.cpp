@@ -196,12 +196,93 @@ class CommandOSStats : public Command
 		}
 	}
 
+	void DoStatsHooks(CommandSource &source)
+	{
+		if (!ModuleManager::ProfileHooks)
+		{
+			source.Reply(_("Hook profiling is not enabled."));
+			return;
+		}
+
+		std::vector<HookStats> stats;
+		ModuleManager::GetHookStats(stats);
+
+		ListFormatter list(source.GetAccount());
+		list.AddColumn(_("Module")).AddColumn(_("Event")).AddColumn(_("Calls")).AddColumn(_("Total")).AddColumn(_("Average")).AddColumn(_("Max"));
+
+		for (unsigned i = 0; i < stats.size() && i < 20; ++i)
+		{
+			const HookStats &hs = stats[i];
+
+			ListFormatter::ListEntry entry;
+			entry["Module"] = hs.module->name;
+			entry["Event"] = ModuleManager::GetEventName(hs.event);
+			entry["Calls"] = stringify(hs.calls);
+			entry["Total"] = stringify(hs.total) + "us";
+			entry["Average"] = stringify(hs.total / hs.calls) + "us";
+			entry["Max"] = stringify(hs.max) + "us";
+			list.AddEntry(entry);
+		}
+
+		std::vector<Anope::string> replies;
+		list.Process(replies);
+
+		source.Reply(_("Event handlers which have taken the most time:"));
+		for (unsigned i = 0; i < replies.size(); ++i)
+			source.Reply(replies[i]);
+	}
+
+	void DoStatsLoop(CommandSource &source)
+	{
+		if (!LoopStats::Iterations)
+			return;
+
+		ListFormatter list(source.GetAccount());
+		list.AddColumn(_("Phase")).AddColumn(_("Average")).AddColumn(_("Median")).AddColumn(_("99%")).AddColumn(_("Max"));
+
+		for (unsigned i = 0; i < LOOP_SIZE; ++i)
+		{
+			LoopPhase phase = static_cast<LoopPhase>(i);
+
+			ListFormatter::ListEntry entry;
+			entry["Phase"] = LoopStats::GetPhaseName(phase);
+			entry["Average"] = stringify(LoopStats::Total[i] / LoopStats::Iterations) + "us";
+			entry["Median"] = "<" + stringify(LoopStats::Percentile(phase, 50)) + "us";
+			entry["99%"] = "<" + stringify(LoopStats::Percentile(phase, 99)) + "us";
+			entry["Max"] = stringify(LoopStats::Max[i]) + "us";
+			list.AddEntry(entry);
+		}
+
+		std::vector<Anope::string> replies;
+		list.Process(replies);
+
+		source.Reply(_("Time spent in each part of the main loop over %lu iterations:"), LoopStats::Iterations);
+		for (unsigned i = 0; i < replies.size(); ++i)
+			source.Reply(replies[i]);
+	}
+
+	void DoStatsThreads(CommandSource &source)
+	{
+		if (ThreadPool::Pools.empty())
+		{
+			source.Reply(_("There are no thread pools."));
+			return;
+		}
+
+		for (std::set<ThreadPool *>::iterator it = ThreadPool::Pools.begin(), it_end = ThreadPool::Pools.end(); it != it_end; ++it)
+		{
+			ThreadPool *pool = *it;
+			source.Reply(_("%s: %u threads, %lu tasks waiting (at most %lu), %lu tasks completed"), pool->GetName().c_str(), pool->GetThreads(),
+				static_cast<unsigned long>(pool->QueueSize()), static_cast<unsigned long>(pool->PeakQueueSize()), pool->Completed());
+		}
+	}
+
  public:
 	CommandOSStats(Module *creator) : Command(creator, "operserv/stats", 0, 1),
 		akills("XLineManager", "xlinemanager/sgline"), snlines("XLineManager", "xlinemanager/snline"), sqlines("XLineManager", "xlinemanager/sqline")
 	{
 		this->SetDesc(_("Show status of Services and network"));
-		this->SetSyntax("[AKILL | HASH | UPLINK | UPTIME | ALL | RESET]");
+		this->SetSyntax("[AKILL | HASH | HOOKS | LOOP | THREADS | UPLINK | UPTIME | ALL | RESET]");
 	}
 
 	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
@@ -219,13 +300,22 @@ class CommandOSStats : public Command
 		if (extra.equals_ci("ALL") || extra.equals_ci("HASH"))
 			this->DoStatsHash(source);
 
+		if (extra.equals_ci("ALL") || extra.equals_ci("HOOKS"))
+			this->DoStatsHooks(source);
+
+		if (extra.equals_ci("ALL") || extra.equals_ci("LOOP"))
+			this->DoStatsLoop(source);
+
+		if (extra.equals_ci("ALL") || extra.equals_ci("THREADS"))
+			this->DoStatsThreads(source);
+
 		if (extra.equals_ci("ALL") || extra.equals_ci("UPLINK"))
 			this->DoStatsUplink(source);
 
 		if (extra.empty() || extra.equals_ci("ALL") || extra.equals_ci("UPTIME"))
 			this->DoStatsUptime(source);
 
-		if (!extra.empty() && !extra.equals_ci("ALL") && !extra.equals_ci("AKILL") && !extra.equals_ci("HASH") && !extra.equals_ci("UPLINK") && !extra.equals_ci("UPTIME"))
+		if (!extra.empty() && !extra.equals_ci("ALL") && !extra.equals_ci("AKILL") && !extra.equals_ci("HASH") && !extra.equals_ci("HOOKS") && !extra.equals_ci("LOOP") && !extra.equals_ci("THREADS") && !extra.equals_ci("UPLINK") && !extra.equals_ci("UPTIME"))
 			source.Reply(_("Unknown STATS option: \002%s\002"), extra.c_str());
 	}
 
@@ -248,6 +338,16 @@ class CommandOSStats : public Command
 				" \n"
 				"The \002HASH\002 option displays information about the hash maps.\n"
 				" \n"
+				"The \002HOOKS\002 option displays the event handlers of modules\n"
+				"which have taken the most time, if hook profiling is enabled.\n"
+				" \n"
+				"The \002LOOP\002 option displays how long Services spends\n"
+				"waiting for and handling network traffic, timers and modes\n"
+				"each time it runs its main loop.\n"
+				" \n"
+				"The \002THREADS\002 option displays the number of tasks waiting\n"
+				"for and completed by each pool of worker threads.\n"
+				" \n"
 				"The \002ALL\002 option displays all of the above statistics."));
 		return true;
 	}
@@ -154,11 +154,13 @@ class CommandOSSXLineBase : public Command
 		}
 		else
 		{
+			Anope::CompiledMask cmask(mask, true);
+
 			for (unsigned i = 0, end = this->xlm()->GetCount(); i < end; ++i)
 			{
 				const XLine *x = this->xlm()->GetEntry(i);
 
-				if (mask.empty() || mask.equals_ci(x->mask) || mask == x->id || Anope::Match(x->mask, mask, false, true))
+				if (mask.empty() || mask.equals_ci(x->mask) || mask == x->id || cmask.Matches(x->mask))
 				{
 					ListFormatter::ListEntry entry;
 					entry["Number"] = stringify(i + 1);
@@ -611,11 +613,13 @@ class CommandOSSQLine : public CommandOSSXLineBase
 
 			if (mask[0] == '#')
 			{
+				Anope::CompiledMask cmask(mask, true);
+
 				for (channel_map::const_iterator cit = ChannelList.begin(), cit_end = ChannelList.end(); cit != cit_end; ++cit)
 				{
 					Channel *c = cit->second;
 
-					if (!Anope::Match(c->name, mask, false, true))
+					if (!cmask.Matches(c->name))
 						continue;
 
 					std::vector<User *> users;
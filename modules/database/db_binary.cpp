@@ -0,0 +1,856 @@
+/*
+ *
+ * (C) 2003-2019 Anope Team
+ * Contact us at team@anope.org
+ *
+ * Please read COPYING and README for further details.
+ */
+
+#include "module.h"
+
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
+/* A database is this magic, which includes the format version, followed by blocks.
+ * Each block is a one byte tag, the length of its data as four bytes, the data, and
+ * the CRC-32 of the data as four bytes. Numbers within blocks are unsigned LEB128.
+ *
+ * S: The string table. The number of strings, then the length and bytes of each.
+ *    Every type name, field name and value is stored here, once.
+ * T: The objects of one type. The index of the type's name, the number of fields
+ *    and the index of each field's name, the number of objects and the ID of each
+ *    (0 for none), then a column for each field with an entry for every object:
+ *    the index of its value plus one, or 0 if the object does not have the field.
+ * E: The end of the database, so a truncated file is noticed.
+ */
+static const char binary_magic[] = "ANOPEDB1";
+static const size_t binary_magic_len = 8;
+
+static uint32_t CRC32(const char *data, size_t len)
+{
+	static uint32_t table[256];
+
+	if (!table[1])
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint32_t c = i;
+			for (int k = 0; k < 8; ++k)
+				c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+
+	uint32_t crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < len; ++i)
+		crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+	return crc ^ 0xFFFFFFFF;
+}
+
+/** A database read into memory, either from the binary format or from a
+ * flatfile database being imported. Strings point into the file's buffer.
+ */
+class BinaryDatabase
+{
+ public:
+	struct String
+	{
+		const char *data;
+		size_t len;
+	};
+
+	struct Section
+	{
+		std::vector<Anope::string> fields;
+		std::vector<uint64_t> ids;
+		/* For each field, the index of each object's value in strings plus one */
+		std::vector<std::vector<unsigned> > columns;
+		/* Field names to columns, only used while importing */
+		std::map<Anope::string, unsigned> index;
+	};
+
+ private:
+	std::vector<char> buffer;
+
+	static uint32_t GetFixed(const char *p)
+	{
+		const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+		return u[0] | (u[1] << 8) | (u[2] << 16) | (static_cast<uint32_t>(u[3]) << 24);
+	}
+
+	static bool GetNumber(const char *&p, const char *end, uint64_t &n)
+	{
+		n = 0;
+		for (unsigned shift = 0; p < end && shift < 64; shift += 7)
+		{
+			unsigned char c = *p++;
+			n |= static_cast<uint64_t>(c & 0x7F) << shift;
+			if (!(c & 0x80))
+				return true;
+		}
+		return false;
+	}
+
+	bool ReadStrings(const char *p, const char *end)
+	{
+		uint64_t num, len;
+		/* Each string takes at least a byte */
+		if (!GetNumber(p, end, num) || num > static_cast<uint64_t>(end - p))
+			return false;
+
+		this->strings.reserve(this->strings.size() + num);
+		for (uint64_t i = 0; i < num; ++i)
+		{
+			if (!GetNumber(p, end, len) || len > static_cast<uint64_t>(end - p))
+				return false;
+
+			String s;
+			s.data = p;
+			s.len = len;
+			this->strings.push_back(s);
+			p += len;
+		}
+
+		return true;
+	}
+
+	bool ReadType(const char *p, const char *end)
+	{
+		uint64_t name, num_fields, num_objects, n;
+		if (!GetNumber(p, end, name) || name >= this->strings.size())
+			return false;
+
+		Section &s = this->sections[Anope::string(this->strings[name].data, this->strings[name].data + this->strings[name].len)];
+		s = Section();
+
+		if (!GetNumber(p, end, num_fields) || num_fields > static_cast<uint64_t>(end - p))
+			return false;
+		for (uint64_t i = 0; i < num_fields; ++i)
+		{
+			if (!GetNumber(p, end, n) || n >= this->strings.size())
+				return false;
+			s.fields.push_back(Anope::string(this->strings[n].data, this->strings[n].data + this->strings[n].len));
+		}
+
+		if (!GetNumber(p, end, num_objects) || num_objects > static_cast<uint64_t>(end - p))
+			return false;
+		s.ids.resize(num_objects);
+		for (uint64_t i = 0; i < num_objects; ++i)
+			if (!GetNumber(p, end, s.ids[i]))
+				return false;
+
+		if (num_fields * num_objects > static_cast<uint64_t>(end - p))
+			return false;
+		s.columns.resize(num_fields);
+		for (uint64_t i = 0; i < num_fields; ++i)
+		{
+			std::vector<unsigned> &column = s.columns[i];
+			column.resize(num_objects);
+			for (uint64_t j = 0; j < num_objects; ++j)
+			{
+				if (!GetNumber(p, end, n) || n > this->strings.size())
+					return false;
+				column[j] = n;
+			}
+		}
+
+		this->count += num_objects;
+		return p == end;
+	}
+
+ public:
+	std::vector<String> strings;
+	std::map<Anope::string, Section> sections;
+	/* Number of objects */
+	size_t count;
+	/* Why the database could not be read */
+	Anope::string error;
+
+	BinaryDatabase() : count(0) { }
+
+	/** Read a file into memory
+	 * @param name The file name
+	 * @return false if the file can not be read
+	 */
+	bool Open(const Anope::string &name)
+	{
+		std::ifstream in(name.c_str(), std::ios_base::in | std::ios_base::binary);
+		if (!in.is_open())
+			return false;
+
+		in.seekg(0, std::ios_base::end);
+		std::streamoff size = in.tellg();
+		in.seekg(0, std::ios_base::beg);
+		if (size < 0)
+			return false;
+
+		this->buffer.resize(size);
+		if (size > 0)
+			in.read(&this->buffer[0], size);
+		return !in.fail();
+	}
+
+	/** Parse a file in the binary format
+	 * @return false if it is not a valid database, with error set to why
+	 */
+	bool ParseBinary()
+	{
+		const char *p = this->buffer.empty() ? NULL : &this->buffer[0], *end = p + this->buffer.size();
+
+		if (this->buffer.size() < binary_magic_len || memcmp(p, binary_magic, binary_magic_len))
+		{
+			this->error = "not a binary database";
+			return false;
+		}
+		p += binary_magic_len;
+
+		for (bool ended = false; !ended;)
+		{
+			size_t offset = p - &this->buffer[0];
+
+			if (end - p < 9 || GetFixed(p + 1) > static_cast<size_t>(end - p - 9))
+			{
+				this->error = "truncated at offset " + stringify(offset);
+				return false;
+			}
+
+			char tag = *p;
+			const char *data = p + 5, *data_end = data + GetFixed(p + 1);
+			p = data_end + 4;
+
+			if (GetFixed(data_end) != CRC32(data, data_end - data))
+			{
+				this->error = "checksum mismatch in block at offset " + stringify(offset);
+				return false;
+			}
+
+			bool ok = true;
+			switch (tag)
+			{
+				case 'S':
+					ok = this->ReadStrings(data, data_end);
+					break;
+				case 'T':
+					ok = this->ReadType(data, data_end);
+					break;
+				case 'E':
+					ended = true;
+					break;
+				/* Blocks from newer versions which are not understood are skipped */
+			}
+
+			if (!ok)
+			{
+				this->error = "malformed block at offset " + stringify(offset);
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	/** Parse a file in db_flatfile's format, to import it */
+	void ParseText()
+	{
+		Section *s = NULL;
+		size_t obj = 0;
+		bool in_object = false;
+
+		for (const char *p = this->buffer.empty() ? NULL : &this->buffer[0], *end = p + this->buffer.size(); p < end;)
+		{
+			const char *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+			if (eol == NULL)
+				eol = end;
+			size_t len = eol - p;
+
+			if (len > 7 && !memcmp(p, "OBJECT ", 7))
+			{
+				s = &this->sections[Anope::string(p + 7, eol)];
+				obj = s->ids.size();
+				s->ids.push_back(0);
+				for (unsigned i = 0; i < s->columns.size(); ++i)
+					s->columns[i].push_back(0);
+				in_object = true;
+				++this->count;
+			}
+			else if (!in_object)
+				;
+			else if (len > 3 && !memcmp(p, "ID ", 3))
+			{
+				uint64_t id = 0;
+				for (const char *c = p + 3; c < eol && *c >= '0' && *c <= '9'; ++c)
+					id = id * 10 + (*c - '0');
+				s->ids[obj] = id;
+			}
+			else if (len > 5 && !memcmp(p, "DATA ", 5))
+			{
+				const char *sp = static_cast<const char *>(memchr(p + 5, ' ', eol - p - 5));
+				if (sp != NULL)
+				{
+					std::map<Anope::string, unsigned>::iterator it = s->index.find(Anope::string(p + 5, sp));
+					if (it == s->index.end())
+					{
+						it = s->index.insert(std::make_pair(Anope::string(p + 5, sp), s->fields.size())).first;
+						s->fields.push_back(it->first);
+						s->columns.push_back(std::vector<unsigned>(s->ids.size()));
+					}
+
+					String str;
+					str.data = sp + 1;
+					str.len = eol - str.data;
+					this->strings.push_back(str);
+					s->columns[it->second][obj] = this->strings.size();
+				}
+			}
+			else
+				in_object = false;
+
+			p = eol + 1;
+		}
+	}
+
+	/** Get the objects of a type
+	 * @param type The type name
+	 * @return The objects, or NULL if there are none
+	 */
+	const Section *Find(const Anope::string &type) const
+	{
+		std::map<Anope::string, Section>::const_iterator it = this->sections.find(type);
+		if (it != this->sections.end())
+			return &it->second;
+		return NULL;
+	}
+};
+
+/** Unserializes objects of a BinaryDatabase, reading values straight out of it */
+class BinaryLoadData : public Serialize::Data
+{
+	/* Reads from a string of the database without copying it */
+	class ViewBuf : public std::streambuf
+	{
+	 public:
+		void Set(const char *begin, size_t len)
+		{
+			char *b = const_cast<char *>(begin);
+			this->setg(b, b, b + len);
+		}
+	} buf;
+
+	const BinaryDatabase &db;
+	std::iostream stream;
+	/* Column after the last one looked up */
+	unsigned next;
+
+	const BinaryDatabase::String *Value(unsigned field) const
+	{
+		unsigned v = this->section->columns[field][this->obj];
+		return v ? &this->db.strings[v - 1] : NULL;
+	}
+
+ public:
+	const BinaryDatabase::Section *section;
+	size_t obj;
+
+	BinaryLoadData(const BinaryDatabase &d) : db(d), stream(&buf), next(0), section(NULL), obj(0) { }
+
+	std::iostream& operator[](const Anope::string &key) anope_override
+	{
+		this->buf.Set(NULL, 0);
+
+		/* Fields are usually read in the order they were written */
+		const std::vector<Anope::string> &fields = this->section->fields;
+		for (unsigned i = 0; i < fields.size(); ++i)
+		{
+			unsigned f = (this->next + i) % fields.size();
+			if (fields[f] == key)
+			{
+				const BinaryDatabase::String *s = this->Value(f);
+				if (s)
+					this->buf.Set(s->data, s->len);
+				this->next = f + 1;
+				break;
+			}
+		}
+
+		this->stream.clear();
+		return this->stream;
+	}
+
+	std::set<Anope::string> KeySet() const anope_override
+	{
+		std::set<Anope::string> keys;
+		for (unsigned i = 0; i < this->section->fields.size(); ++i)
+			if (this->Value(i))
+				keys.insert(this->section->fields[i]);
+		return keys;
+	}
+
+	size_t Hash() const anope_override
+	{
+		size_t hash = 0;
+		for (unsigned i = 0; i < this->section->fields.size(); ++i)
+		{
+			const BinaryDatabase::String *s = this->Value(i);
+			if (s && s->len)
+				hash ^= Anope::hash_cs()(Anope::string(s->data, s->data + s->len));
+		}
+		return hash;
+	}
+};
+
+/** Collects the fields an object serializes */
+class BinarySaveData : public Serialize::Data
+{
+	Anope::string last;
+	std::stringstream ss;
+
+ public:
+	std::vector<std::pair<Anope::string, Anope::string> > values;
+
+	std::iostream& operator[](const Anope::string &key) anope_override
+	{
+		if (key != this->last)
+		{
+			this->Flush();
+			this->last = key;
+		}
+
+		return this->ss;
+	}
+
+	void Flush()
+	{
+		if (this->last.empty())
+			return;
+
+		this->values.push_back(std::make_pair(this->last, this->ss.str()));
+		this->last.clear();
+		this->ss.str("");
+		this->ss.clear();
+	}
+};
+
+/** Builds a database from objects and writes it out */
+class BinaryWriter
+{
+	struct Section
+	{
+		unsigned name;
+		/* Indexes of the field names in strings */
+		std::vector<unsigned> fields;
+		std::map<Anope::string, unsigned> index;
+		std::vector<uint64_t> ids;
+		std::vector<std::vector<unsigned> > columns;
+	};
+
+	TR1NS::unordered_map<Anope::string, unsigned, Anope::hash_cs> string_index;
+	std::vector<const Anope::string *> strings;
+	std::vector<Section> sections;
+	std::map<Serialize::Type *, unsigned> section_index;
+	BinarySaveData data;
+
+	unsigned AddString(const Anope::string &str)
+	{
+		std::pair<TR1NS::unordered_map<Anope::string, unsigned, Anope::hash_cs>::iterator, bool> it = this->string_index.insert(std::make_pair(str, this->strings.size()));
+		if (it.second)
+			this->strings.push_back(&it.first->first);
+		return it.first->second;
+	}
+
+	static void PutNumber(std::string &out, uint64_t n)
+	{
+		while (n >= 0x80)
+		{
+			out += static_cast<char>((n & 0x7F) | 0x80);
+			n >>= 7;
+		}
+		out += static_cast<char>(n);
+	}
+
+	static void PutFixed(std::ostream &out, uint32_t n)
+	{
+		char b[4] = { static_cast<char>(n & 0xFF), static_cast<char>((n >> 8) & 0xFF), static_cast<char>((n >> 16) & 0xFF), static_cast<char>((n >> 24) & 0xFF) };
+		out.write(b, sizeof(b));
+	}
+
+	static void PutBlock(std::ostream &out, char tag, const std::string &block)
+	{
+		out.put(tag);
+		PutFixed(out, block.length());
+		out.write(block.data(), block.length());
+		PutFixed(out, CRC32(block.data(), block.length()));
+	}
+
+ public:
+	/* Number of objects */
+	size_t count;
+
+	BinaryWriter() : count(0) { }
+
+	void Add(Serializable *obj)
+	{
+		Serialize::Type *s_type = obj->GetSerializableType();
+
+		std::map<Serialize::Type *, unsigned>::iterator sit = this->section_index.find(s_type);
+		if (sit == this->section_index.end())
+		{
+			sit = this->section_index.insert(std::make_pair(s_type, this->sections.size())).first;
+			this->sections.push_back(Section());
+			this->sections.back().name = this->AddString(s_type->GetName());
+		}
+		Section &s = this->sections[sit->second];
+
+		this->data.values.clear();
+		obj->Serialize(this->data);
+		this->data.Flush();
+
+		size_t o = s.ids.size();
+		s.ids.push_back(obj->id);
+		for (unsigned i = 0; i < s.columns.size(); ++i)
+			s.columns[i].push_back(0);
+
+		for (unsigned i = 0; i < this->data.values.size(); ++i)
+		{
+			const std::pair<Anope::string, Anope::string> &value = this->data.values[i];
+
+			std::map<Anope::string, unsigned>::iterator it = s.index.find(value.first);
+			if (it == s.index.end())
+			{
+				it = s.index.insert(std::make_pair(value.first, s.fields.size())).first;
+				s.fields.push_back(this->AddString(value.first));
+				s.columns.push_back(std::vector<unsigned>(s.ids.size()));
+			}
+
+			s.columns[it->second][o] = this->AddString(value.second) + 1;
+		}
+
+		++this->count;
+	}
+
+	bool WriteBinary(std::ostream &out)
+	{
+		out.write(binary_magic, binary_magic_len);
+
+		std::string block;
+		PutNumber(block, this->strings.size());
+		for (unsigned i = 0; i < this->strings.size(); ++i)
+		{
+			PutNumber(block, this->strings[i]->length());
+			block.append(this->strings[i]->str());
+		}
+		PutBlock(out, 'S', block);
+
+		for (unsigned i = 0; i < this->sections.size(); ++i)
+		{
+			const Section &s = this->sections[i];
+
+			block.clear();
+			PutNumber(block, s.name);
+			PutNumber(block, s.fields.size());
+			for (unsigned j = 0; j < s.fields.size(); ++j)
+				PutNumber(block, s.fields[j]);
+			PutNumber(block, s.ids.size());
+			for (unsigned j = 0; j < s.ids.size(); ++j)
+				PutNumber(block, s.ids[j]);
+			for (unsigned j = 0; j < s.columns.size(); ++j)
+				for (unsigned k = 0; k < s.columns[j].size(); ++k)
+					PutNumber(block, s.columns[j][k]);
+			PutBlock(out, 'T', block);
+		}
+
+		PutBlock(out, 'E', "");
+		return out.good();
+	}
+
+	/** Write the objects in db_flatfile's format, to export them */
+	bool WriteText(std::ostream &out)
+	{
+		for (unsigned i = 0; i < this->sections.size(); ++i)
+		{
+			const Section &s = this->sections[i];
+
+			for (unsigned j = 0; j < s.ids.size(); ++j)
+			{
+				out << "OBJECT " << *this->strings[s.name];
+				if (s.ids[j])
+					out << "\nID " << s.ids[j];
+				for (unsigned k = 0; k < s.fields.size(); ++k)
+					if (s.columns[k][j])
+						out << "\nDATA " << *this->strings[s.fields[k]] << " " << *this->strings[s.columns[k][j] - 1];
+				out << "\nEND\n";
+			}
+		}
+
+		return out.good();
+	}
+};
+
+class DBBinary : public Module
+{
+	/* Day the last backup was on */
+	int last_day;
+	/* Backup file names */
+	std::map<Anope::string, std::list<Anope::string> > backups;
+	bool loaded;
+
+	static long Elapsed(const timeval &from, const timeval &to)
+	{
+		return (to.tv_sec - from.tv_sec) * 1000 + (to.tv_usec - from.tv_usec) / 1000;
+	}
+
+	Anope::string GetDatabaseName(Module *owner)
+	{
+		if (owner)
+			return Anope::DataDir + "/module_" + owner->name + ".bin";
+		return Anope::DataDir + "/" + Config->GetModule(this)->Get<const Anope::string>("database", "anope.bin");
+	}
+
+	/* Name of the flatfile database to import or export, or empty if there is none */
+	Anope::string GetFlatfileName(Module *owner, const Anope::string &option)
+	{
+		const Anope::string &file = Config->GetModule(this)->Get<const Anope::string>(option);
+		if (file.empty())
+			return "";
+		if (owner)
+			return Anope::DataDir + "/module_" + owner->name + ".db";
+		return Anope::DataDir + "/" + file;
+	}
+
+	/* Reads the database of an owner, or the flatfile database it is imported from */
+	bool Read(BinaryDatabase &db, Module *owner)
+	{
+		const Anope::string &db_name = GetDatabaseName(owner);
+
+		if (!Anope::IsFile(db_name))
+		{
+			const Anope::string &import = GetFlatfileName(owner, "import");
+			if (!import.empty() && db.Open(import))
+			{
+				Log(this) << "Importing " << import;
+				db.ParseText();
+				return true;
+			}
+
+			Log(this) << "Unable to open " << db_name << " for reading!";
+			return false;
+		}
+
+		if (!db.Open(db_name))
+		{
+			Log(this) << "Unable to open " << db_name << " for reading!";
+			return false;
+		}
+
+		if (!db.ParseBinary())
+		{
+			/* Saving over it would lose everything in it */
+			Log(this) << "Unable to load " << db_name << ": " << db.error;
+			Anope::Quitting = true;
+			Anope::QuitReason = "Unable to load database " + db_name + " (" + db.error + ")";
+			return false;
+		}
+
+		return true;
+	}
+
+	void Unserialize(const BinaryDatabase &db, Serialize::Type *stype)
+	{
+		const BinaryDatabase::Section *s = db.Find(stype->GetName());
+		if (!s)
+			return;
+
+		BinaryLoadData ld(db);
+		ld.section = s;
+
+		for (ld.obj = 0; ld.obj < s->ids.size(); ++ld.obj)
+		{
+			Serializable *obj = stype->Unserialize(NULL, ld);
+			if (obj != NULL && s->ids[ld.obj])
+			{
+				obj->id = s->ids[ld.obj];
+				stype->objects[obj->id] = obj;
+			}
+		}
+	}
+
+	/* Writes a file next to the old one and renames it over it once it is complete */
+	bool Write(BinaryWriter &writer, const Anope::string &db_name, bool text)
+	{
+		const Anope::string &tmp = db_name + ".tmp";
+
+		std::ofstream fs(tmp.c_str(), std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+		if (!fs.is_open())
+		{
+			Log(this) << "Unable to open " << tmp << " for writing";
+			return false;
+		}
+
+		bool written = text ? writer.WriteText(fs) : writer.WriteBinary(fs);
+		fs.close();
+
+		if (!written || fs.fail())
+		{
+			Log(this) << "Unable to write database " << db_name;
+			unlink(tmp.c_str());
+			return false;
+		}
+
+#ifdef _WIN32
+		unlink(db_name.c_str());
+#endif
+		if (rename(tmp.c_str(), db_name.c_str()))
+		{
+			Log(this) << "Unable to rename " << tmp << " to " << db_name << ": " << Anope::LastError();
+			return false;
+		}
+
+		return true;
+	}
+
+	void BackupDatabase()
+	{
+		tm *tm = localtime(&Anope::CurTime);
+
+		if (tm->tm_mday == last_day)
+			return;
+		last_day = tm->tm_mday;
+
+		std::set<Anope::string> dbs;
+		dbs.insert(Config->GetModule(this)->Get<const Anope::string>("database", "anope.bin"));
+
+		const std::vector<Anope::string> &type_order = Serialize::Type::GetTypeOrder();
+		for (unsigned i = 0; i < type_order.size(); ++i)
+		{
+			Serialize::Type *stype = Serialize::Type::Find(type_order[i]);
+
+			if (stype && stype->GetOwner())
+				dbs.insert("module_" + stype->GetOwner()->name + ".bin");
+		}
+
+		for (std::set<Anope::string>::const_iterator it = dbs.begin(), it_end = dbs.end(); it != it_end; ++it)
+		{
+			const Anope::string &oldname = Anope::DataDir + "/" + *it;
+			Anope::string newname = Anope::DataDir + "/backups/" + *it + "-" + stringify(tm->tm_year + 1900) + Anope::printf("-%02i-", tm->tm_mon + 1) + Anope::printf("%02i", tm->tm_mday);
+
+			/* Backup already exists or no database to backup */
+			if (Anope::IsFile(newname) || !Anope::IsFile(oldname))
+				continue;
+
+			Log(LOG_DEBUG) << "db_binary: Attempting to rename " << *it << " to " << newname;
+			if (rename(oldname.c_str(), newname.c_str()))
+			{
+				Anope::string err = Anope::LastError();
+				Log(this) << "Unable to back up database " << *it << " (" << err << ")!";
+
+				if (!Config->GetModule(this)->Get<bool>("nobackupokay"))
+				{
+					Anope::Quitting = true;
+					Anope::QuitReason = "Unable to back up database " + *it + " (" + err + ")";
+				}
+
+				continue;
+			}
+
+			backups[*it].push_back(newname);
+
+			unsigned keepbackups = Config->GetModule(this)->Get<unsigned>("keepbackups");
+			if (keepbackups > 0 && backups[*it].size() > keepbackups)
+			{
+				unlink(backups[*it].front().c_str());
+				backups[*it].pop_front();
+			}
+		}
+	}
+
+ public:
+	DBBinary(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, DATABASE | VENDOR), last_day(0), loaded(false)
+	{
+	}
+
+	EventReturn OnLoadDatabase() anope_override
+	{
+		timeval start;
+		gettimeofday(&start, NULL);
+
+		BinaryDatabase db;
+		if (!this->Read(db, NULL))
+			return EVENT_STOP;
+
+		timeval parsed;
+		gettimeofday(&parsed, NULL);
+
+		const std::vector<Anope::string> &type_order = Serialize::Type::GetTypeOrder();
+		for (unsigned i = 0; i < type_order.size(); ++i)
+		{
+			Serialize::Type *stype = Serialize::Type::Find(type_order[i]);
+			if (stype && !stype->GetOwner())
+				this->Unserialize(db, stype);
+		}
+
+		timeval done;
+		gettimeofday(&done, NULL);
+
+		Log(this) << "Loaded " << db.count << " objects in " << Elapsed(start, done) << "ms (" << Elapsed(start, parsed) << "ms reading)";
+
+		loaded = true;
+		return EVENT_STOP;
+	}
+
+	void OnSaveDatabase() anope_override
+	{
+		BackupDatabase();
+
+		std::map<Module *, BinaryWriter *> databases;
+
+		/* Every registered type's database is written, so one whose objects are all gone is emptied */
+		for (std::map<Anope::string, Serialize::Type *>::const_iterator it = Serialize::Type::GetTypes().begin(), it_end = Serialize::Type::GetTypes().end(); it != it_end; ++it)
+		{
+			BinaryWriter *&writer = databases[it->second->GetOwner()];
+			if (!writer)
+				writer = new BinaryWriter();
+		}
+
+		const std::list<Serializable *> &items = Serializable::GetItems();
+		for (std::list<Serializable *>::const_iterator it = items.begin(), it_end = items.end(); it != it_end; ++it)
+		{
+			Serializable *base = *it;
+			Serialize::Type *s_type = base->GetSerializableType();
+
+			if (s_type && databases[s_type->GetOwner()])
+				databases[s_type->GetOwner()]->Add(base);
+		}
+
+		for (std::map<Module *, BinaryWriter *>::iterator it = databases.begin(), it_end = databases.end(); it != it_end; ++it)
+		{
+			BinaryWriter *writer = it->second;
+			if (!writer)
+				continue;
+
+			bool written = this->Write(*writer, GetDatabaseName(it->first), false);
+
+			const Anope::string &exported = GetFlatfileName(it->first, "export");
+			if (!exported.empty() && !this->Write(*writer, exported, true))
+				written = false;
+
+			if (!written && !Config->GetModule(this)->Get<bool>("nobackupokay"))
+			{
+				Anope::Quitting = true;
+				Anope::QuitReason = "Unable to write database " + GetDatabaseName(it->first);
+			}
+
+			delete writer;
+		}
+	}
+
+	/* Load just one type. Done if a module is reloaded during runtime */
+	void OnSerializeTypeCreate(Serialize::Type *stype) anope_override
+	{
+		if (!loaded)
+			return;
+
+		BinaryDatabase db;
+		if (this->Read(db, stype->GetOwner()))
+			this->Unserialize(db, stype);
+	}
+};
+
+MODULE_INIT(DBBinary)
@@ -13,6 +13,10 @@
 
 #ifndef _WIN32
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fcntl.h>
 #endif
 
 class SaveData : public Serialize::Data
@@ -46,33 +50,39 @@ class LoadData : public Serialize::Data
 
 	LoadData() : fs(NULL), id(0), read(false) { }
 
-	std::iostream& operator[](const Anope::string &key) anope_override
+	/* Reads the rest of the current object */
+	void Read()
 	{
-		if (!read)
+		if (read)
+			return;
+
+		for (Anope::string token; std::getline(*this->fs, token.str());)
 		{
-			for (Anope::string token; std::getline(*this->fs, token.str());)
+			if (token.find("ID ") == 0)
 			{
-				if (token.find("ID ") == 0)
+				try
 				{
-					try
-					{
-						this->id = convertTo<unsigned int>(token.substr(3));
-					}
-					catch (const ConvertException &) { }
-
-					continue;
+					this->id = convertTo<unsigned int>(token.substr(3));
 				}
-				else if (token.find("DATA ") != 0)
-					break;
+				catch (const ConvertException &) { }
 
-				size_t sp = token.find(' ', 5); // Skip DATA
-				if (sp != Anope::string::npos)
-					data[token.substr(5, sp - 5)] = token.substr(sp + 1);
+				continue;
 			}
+			else if (token.find("DATA ") != 0)
+				break;
 
-			read = true;
+			size_t sp = token.find(' ', 5); // Skip DATA
+			if (sp != Anope::string::npos)
+				data[token.substr(5, sp - 5)] = token.substr(sp + 1);
 		}
 
+		read = true;
+	}
+
+	std::iostream& operator[](const Anope::string &key) anope_override
+	{
+		this->Read();
+
 		ss.clear();
 		this->ss << this->data[key];
 		return this->ss;
@@ -103,6 +113,377 @@ class LoadData : public Serialize::Data
 	}
 };
 
+/** A database read into memory and split into objects in one pass, so
+ * loading it does not need to read each line twice or copy the data.
+ */
+class DatabaseFile
+{
+ public:
+	struct Field
+	{
+		const char *key, *value;
+		size_t key_len, value_len;
+	};
+
+	struct Object
+	{
+		unsigned int id;
+		/* The object's fields in fields */
+		size_t first, count;
+	};
+
+ private:
+	const char *data;
+	size_t length;
+#ifndef _WIN32
+	bool mapped;
+#endif
+	std::vector<char> buffer;
+	/* Objects by type, in the order they are in the file */
+	std::map<Anope::string, std::vector<Object> > objects;
+
+	void Parse()
+	{
+		std::vector<Object> *type = NULL;
+		Anope::string type_name;
+		Object *obj = NULL;
+
+		for (const char *p = this->data, *end = this->data + this->length; p < end;)
+		{
+			const char *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+			if (eol == NULL)
+				eol = end;
+			size_t len = eol - p;
+
+			if (len > 7 && !memcmp(p, "OBJECT ", 7))
+			{
+				/* Objects of the same type are usually together */
+				if (type == NULL || type_name.length() != len - 7 || memcmp(type_name.c_str(), p + 7, len - 7))
+				{
+					type_name = Anope::string(p + 7, eol);
+					type = &this->objects[type_name];
+				}
+
+				Object o;
+				o.id = 0;
+				o.first = this->fields.size();
+				o.count = 0;
+				type->push_back(o);
+				obj = &type->back();
+				++this->count;
+			}
+			else if (obj == NULL)
+				;
+			else if (len > 3 && !memcmp(p, "ID ", 3))
+			{
+				unsigned int id = 0;
+				for (const char *c = p + 3; c < eol && *c >= '0' && *c <= '9'; ++c)
+					id = id * 10 + (*c - '0');
+				obj->id = id;
+			}
+			else if (len > 5 && !memcmp(p, "DATA ", 5))
+			{
+				const char *sp = static_cast<const char *>(memchr(p + 5, ' ', eol - p - 5));
+				if (sp != NULL)
+				{
+					Field f;
+					f.key = p + 5;
+					f.key_len = sp - f.key;
+					f.value = sp + 1;
+					f.value_len = eol - f.value;
+					this->fields.push_back(f);
+					++obj->count;
+				}
+			}
+			else
+				obj = NULL;
+
+			p = eol + 1;
+		}
+	}
+
+ public:
+	/* Fields of every object */
+	std::vector<Field> fields;
+	/* Number of objects */
+	size_t count;
+
+	DatabaseFile() : data(NULL), length(0), count(0)
+	{
+#ifndef _WIN32
+		mapped = false;
+#endif
+	}
+
+	~DatabaseFile()
+	{
+#ifndef _WIN32
+		if (mapped)
+			munmap(const_cast<char *>(this->data), this->length);
+#endif
+	}
+
+	bool Open(const Anope::string &name)
+	{
+#ifndef _WIN32
+		int fd = open(name.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (map != MAP_FAILED)
+			{
+				madvise(map, st.st_size, MADV_SEQUENTIAL);
+				this->data = static_cast<const char *>(map);
+				this->length = st.st_size;
+				this->mapped = true;
+			}
+		}
+		close(fd);
+
+		if (!this->mapped)
+#endif
+		{
+			std::ifstream in(name.c_str(), std::ios_base::in | std::ios_base::binary);
+			if (!in.is_open())
+				return false;
+
+			this->buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+			this->data = this->buffer.empty() ? NULL : &this->buffer[0];
+			this->length = this->buffer.size();
+		}
+
+		this->Parse();
+		return true;
+	}
+
+	/** Get the objects of a type
+	 * @param type The type name
+	 * @return The objects, or NULL if there are none
+	 */
+	const std::vector<Object> *Find(const Anope::string &type) const
+	{
+		std::map<Anope::string, std::vector<Object> >::const_iterator it = this->objects.find(type);
+		if (it != this->objects.end())
+			return &it->second;
+		return NULL;
+	}
+};
+
+/** Unserializes objects of a DatabaseFile, reading fields straight out of it */
+class FileData : public Serialize::Data
+{
+	/* Reads from a range of the database without copying it */
+	class ViewBuf : public std::streambuf
+	{
+	 public:
+		void Set(const char *begin, size_t len)
+		{
+			char *b = const_cast<char *>(begin);
+			this->setg(b, b, b + len);
+		}
+	} buf;
+
+	const DatabaseFile &file;
+	std::iostream stream;
+
+ public:
+	const DatabaseFile::Object *obj;
+
+	FileData(const DatabaseFile &f) : file(f), stream(&buf), obj(NULL) { }
+
+	std::iostream& operator[](const Anope::string &key) anope_override
+	{
+		this->buf.Set(NULL, 0);
+
+		/* The last occurrence of a key wins */
+		for (size_t i = obj->first + obj->count; i > obj->first; --i)
+		{
+			const DatabaseFile::Field &f = file.fields[i - 1];
+			if (f.key_len == key.length() && !memcmp(f.key, key.c_str(), f.key_len))
+			{
+				this->buf.Set(f.value, f.value_len);
+				break;
+			}
+		}
+
+		this->stream.clear();
+		return this->stream;
+	}
+
+	std::set<Anope::string> KeySet() const anope_override
+	{
+		std::set<Anope::string> keys;
+		for (size_t i = obj->first; i < obj->first + obj->count; ++i)
+			keys.insert(Anope::string(file.fields[i].key, file.fields[i].key + file.fields[i].key_len));
+		return keys;
+	}
+
+	size_t Hash() const anope_override
+	{
+		std::map<Anope::string, Anope::string> data;
+		for (size_t i = obj->first; i < obj->first + obj->count; ++i)
+		{
+			const DatabaseFile::Field &f = file.fields[i];
+			data[Anope::string(f.key, f.key + f.key_len)] = Anope::string(f.value, f.value + f.value_len);
+		}
+
+		size_t hash = 0;
+		for (std::map<Anope::string, Anope::string>::const_iterator it = data.begin(), it_end = data.end(); it != it_end; ++it)
+			if (!it->second.empty())
+				hash ^= Anope::hash_cs()(it->second);
+		return hash;
+	}
+};
+
+class DBFlatFile;
+
+/** Merges journals into their databases. Only touches files, so it works from
+ * what is on disk and never from live objects.
+ */
+class CompactThread : public Thread
+{
+	DBFlatFile *module;
+
+	/* Reads the records of a database or journal. Records with an ID replace the earlier
+	 * record of the same type and ID, and DELETE lines remove it.
+	 */
+	static void ReadRecords(std::istream &is, std::vector<Anope::string> &records, std::map<Anope::string, size_t> &index)
+	{
+		Anope::string record, key;
+		bool has_id = false;
+
+		for (Anope::string buf; std::getline(is, buf.str());)
+		{
+			if (buf.find("OBJECT ") == 0)
+			{
+				record = buf;
+				key = buf.substr(7);
+				has_id = false;
+			}
+			else if (!record.empty())
+			{
+				record += "\n" + buf;
+
+				if (buf.find("ID ") == 0)
+				{
+					key += " " + buf.substr(3);
+					has_id = true;
+				}
+				else if (buf == "END")
+				{
+					std::map<Anope::string, size_t>::iterator it = has_id ? index.find(key) : index.end();
+					if (it != index.end())
+						records[it->second] = record;
+					else
+					{
+						if (has_id)
+							index[key] = records.size();
+						records.push_back(record);
+					}
+
+					record.clear();
+				}
+			}
+			else if (buf.find("DELETE ") == 0)
+			{
+				std::map<Anope::string, size_t>::iterator it = index.find(buf.substr(7));
+				if (it != index.end())
+				{
+					records[it->second].clear();
+					index.erase(it);
+				}
+			}
+		}
+	}
+
+	static bool Copy(const Anope::string &from, const Anope::string &to)
+	{
+		std::ifstream in(from.c_str(), std::ios_base::in | std::ios_base::binary);
+		std::ofstream out(to.c_str(), std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+		if (!in.is_open() || !out.is_open())
+			return false;
+
+		if (in.peek() != EOF)
+			out << in.rdbuf();
+		return out.good();
+	}
+
+	bool Compact(const Anope::string &db_name)
+	{
+		const Anope::string &journal = db_name + ".journal.compacting", &compacted = db_name + ".compact";
+
+		std::vector<Anope::string> records;
+		std::map<Anope::string, size_t> index;
+
+		std::ifstream db(db_name.c_str(), std::ios_base::in | std::ios_base::binary);
+		if (db.is_open())
+			ReadRecords(db, records, index);
+		db.close();
+
+		std::ifstream jfd(journal.c_str(), std::ios_base::in | std::ios_base::binary);
+		if (!jfd.is_open())
+		{
+			this->error = "Unable to open " + journal + " for reading";
+			return false;
+		}
+		ReadRecords(jfd, records, index);
+		jfd.close();
+
+		std::ofstream fd(compacted.c_str(), std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+		for (unsigned i = 0; i < records.size(); ++i)
+			if (!records[i].empty())
+				fd << records[i] << "\n";
+		fd.close();
+
+		if (!fd.good())
+		{
+			this->error = "Unable to write " + compacted;
+			unlink(compacted.c_str());
+			return false;
+		}
+
+#ifdef _WIN32
+		unlink(db_name.c_str());
+#endif
+		if (rename(compacted.c_str(), db_name.c_str()))
+		{
+			this->error = "Unable to rename " + compacted + " to " + db_name + ": " + Anope::LastError();
+			return false;
+		}
+
+		unlink(journal.c_str());
+		return true;
+	}
+
+ public:
+	/* Databases with a journal to merge */
+	std::vector<Anope::string> databases;
+	/* Database and backup names to copy them to once merged */
+	std::vector<std::pair<Anope::string, Anope::string> > backups;
+	/* Databases which could not be merged */
+	std::vector<Anope::string> failed;
+	Anope::string error;
+
+	CompactThread(DBFlatFile *m) : module(m) { }
+
+	void Run() anope_override
+	{
+		for (unsigned i = 0; i < this->databases.size(); ++i)
+			if (!this->Compact(this->databases[i]))
+				this->failed.push_back(this->databases[i]);
+
+		for (unsigned i = 0; i < this->backups.size(); ++i)
+			if (!Copy(this->backups[i].first, this->backups[i].second))
+				this->error = "Unable to back up database " + this->backups[i].first;
+	}
+
+	void OnNotify() anope_override;
+};
+
 class DBFlatFile : public Module, public Pipe
 {
 	/* Day the last backup was on */
@@ -113,6 +494,232 @@ class DBFlatFile : public Module, public Pipe
 
 	int child_pid;
 
+	/* Whether changes are appended to journals instead of rewriting the databases on every save */
+	bool journal;
+	/* Whether the databases on disk plus their journals hold every object, so only changes need writing */
+	bool journal_ready;
+	/* Set while objects are being created from the databases or destroyed by shutting down, so they are not journaled */
+	bool loading;
+	/* A module being unloaded, its objects are being destroyed but not deleted */
+	Module *unloading;
+	/* Objects changed since the last save */
+	std::set<Serializable *> dirty;
+	/* Type and ID of objects destroyed since the last save, by database */
+	std::map<Anope::string, std::vector<std::pair<Anope::string, uint64_t> > > deleted;
+	/* Records written to the journals since they were last merged */
+	unsigned journal_records;
+	/* Databases with a journal */
+	std::set<Anope::string> journaled;
+	/* Backups waiting to be taken by the next compaction */
+	std::vector<std::pair<Anope::string, Anope::string> > pending_backups;
+	CompactThread *compactor;
+
+	static long Elapsed(const timeval &from, const timeval &to)
+	{
+		return (to.tv_sec - from.tv_sec) * 1000 + (to.tv_usec - from.tv_usec) / 1000;
+	}
+
+	Anope::string GetDatabaseName(Module *owner)
+	{
+		if (owner)
+			return Anope::DataDir + "/module_" + owner->name + ".db";
+		return Anope::DataDir + "/" + Config->GetModule(this)->Get<const Anope::string>("database", "anope.db");
+	}
+
+	/* Applies the records of a journal to the loaded objects, optionally only those of one type */
+	void ReplayJournal(const Anope::string &journal_name, Serialize::Type *only)
+	{
+		std::fstream fd(journal_name.c_str(), std::ios_base::in | std::ios_base::binary);
+		if (!fd.is_open())
+			return;
+
+		LoadData ld;
+		ld.fs = &fd;
+
+		unsigned records = 0;
+		for (Anope::string buf; std::getline(fd, buf.str());)
+		{
+			if (buf.find("OBJECT ") == 0)
+			{
+				Serialize::Type *stype = Serialize::Type::Find(buf.substr(7));
+				if (!stype || (only && stype != only))
+					continue;
+
+				ld.Read();
+
+				std::map<uint64_t, Serializable *>::iterator it = stype->objects.find(ld.id);
+				Serializable *obj = stype->Unserialize(ld.id && it != stype->objects.end() ? it->second : NULL, ld);
+				if (obj != NULL && ld.id)
+				{
+					obj->id = ld.id;
+					stype->objects[obj->id] = obj;
+				}
+				ld.Reset();
+				++records;
+			}
+			else if (buf.find("DELETE ") == 0)
+			{
+				spacesepstream sep(buf.substr(7));
+				Anope::string type_name, id_str;
+				sep.GetToken(type_name);
+				sep.GetToken(id_str);
+
+				Serialize::Type *stype = Serialize::Type::Find(type_name);
+				if (!stype || (only && stype != only))
+					continue;
+
+				try
+				{
+					std::map<uint64_t, Serializable *>::iterator it = stype->objects.find(convertTo<uint64_t>(id_str));
+					if (it != stype->objects.end())
+						delete it->second;
+				}
+				catch (const ConvertException &) { }
+				++records;
+			}
+		}
+
+		if (records)
+			Log(LOG_DEBUG) << "db_flatfile: Replayed " << records << " records from " << journal_name;
+	}
+
+	void ReplayJournals(const Anope::string &db_name, Serialize::Type *only)
+	{
+		/* A journal left over from a compaction which did not finish is older than the current one */
+		ReplayJournal(db_name + ".journal.compacting", only);
+		ReplayJournal(db_name + ".journal", only);
+	}
+
+	/* Gives every object an ID, so the journals can say which object a record is for */
+	void AssignIDs()
+	{
+		const std::list<Serializable *> &items = Serializable::GetItems();
+		for (std::list<Serializable *>::const_iterator it = items.begin(), it_end = items.end(); it != it_end; ++it)
+			this->AssignID(*it);
+	}
+
+	void AssignID(Serializable *obj)
+	{
+		Serialize::Type *s_type = obj->GetSerializableType();
+		if (!s_type || obj->id)
+			return;
+
+		obj->id = s_type->objects.empty() ? 1 : s_type->objects.rbegin()->first + 1;
+		s_type->objects[obj->id] = obj;
+	}
+
+	void WaitForCompaction()
+	{
+		if (!compactor)
+			return;
+
+		Log(this) << "Waiting for database compaction to finish...";
+
+		CompactThread *t = compactor;
+		t->Join();
+		this->OnCompacted();
+		delete t;
+	}
+
+	/* Appends the changes since the last save to the journals, and merges them into the databases once they are large enough */
+	void SaveJournal()
+	{
+		std::map<Anope::string, std::fstream *> journals;
+		unsigned records = 0;
+
+		for (std::map<Anope::string, std::vector<std::pair<Anope::string, uint64_t> > >::iterator it = deleted.begin(), it_end = deleted.end(); it != it_end; ++it)
+		{
+			if (it->second.empty())
+				continue;
+
+			std::fstream *&fs = journals[it->first];
+			fs = new std::fstream((it->first + ".journal").c_str(), std::ios_base::out | std::ios_base::app | std::ios_base::binary);
+			for (unsigned i = 0; i < it->second.size(); ++i)
+				*fs << "DELETE " << it->second[i].first << " " << it->second[i].second << "\n";
+			records += it->second.size();
+		}
+		deleted.clear();
+
+		/* Objects are written in type order, so they are replayed after the objects they refer to */
+		std::map<Serialize::Type *, std::vector<Serializable *> > by_type;
+		for (std::set<Serializable *>::iterator it = dirty.begin(), it_end = dirty.end(); it != it_end; ++it)
+			if ((*it)->GetSerializableType())
+				by_type[(*it)->GetSerializableType()].push_back(*it);
+		dirty.clear();
+
+		SaveData data;
+		const std::vector<Anope::string> &type_order = Serialize::Type::GetTypeOrder();
+		for (unsigned i = 0; i < type_order.size(); ++i)
+		{
+			Serialize::Type *s_type = Serialize::Type::Find(type_order[i]);
+			std::map<Serialize::Type *, std::vector<Serializable *> >::iterator tit = by_type.find(s_type);
+			if (tit == by_type.end())
+				continue;
+
+			for (unsigned j = 0; j < tit->second.size(); ++j)
+			{
+				Serializable *base = tit->second[j];
+				this->AssignID(base);
+
+				const Anope::string &db_name = GetDatabaseName(s_type->GetOwner());
+				std::fstream *&fs = journals[db_name];
+				if (!fs)
+					fs = new std::fstream((db_name + ".journal").c_str(), std::ios_base::out | std::ios_base::app | std::ios_base::binary);
+
+				data.fs = fs;
+				data.last.clear();
+				*fs << "OBJECT " << s_type->GetName() << "\nID " << base->id;
+				base->Serialize(data);
+				*fs << "\nEND\n";
+				++records;
+			}
+		}
+
+		for (std::map<Anope::string, std::fstream *>::iterator it = journals.begin(), it_end = journals.end(); it != it_end; ++it)
+		{
+			std::fstream *f = it->second;
+
+			if (!f->is_open() || !f->good())
+				this->Write("Unable to write journal " + it->first + ".journal");
+
+			journaled.insert(it->first);
+			delete f;
+		}
+
+		journal_records += records;
+		if (records)
+			Log(LOG_DEBUG) << "db_flatfile: Journaled " << records << " changes, " << journal_records << " since the last compaction";
+
+		if (compactor || (journal_records < Config->GetModule(this)->Get<unsigned>("journalsize", "10000") && pending_backups.empty()))
+			return;
+
+		compactor = new CompactThread(this);
+
+		/* Journal to a new file while the old one is merged */
+		for (std::set<Anope::string>::iterator it = journaled.begin(), it_end = journaled.end(); it != it_end; ++it)
+		{
+			const Anope::string &jname = *it + ".journal";
+			if (Anope::IsFile(jname) && !rename(jname.c_str(), (jname + ".compacting").c_str()))
+				compactor->databases.push_back(*it);
+		}
+		compactor->backups = pending_backups;
+
+		journaled.clear();
+		pending_backups.clear();
+		journal_records = 0;
+
+		try
+		{
+			compactor->Start();
+			Log(LOG_DEBUG) << "db_flatfile: Compacting " << compactor->databases.size() << " databases";
+		}
+		catch (const CoreException &ex)
+		{
+			Log(this) << "Unable to compact databases: " << ex.GetReason();
+			this->OnCompacted();
+		}
+	}
+
 	void BackupDatabase()
 	{
 		tm *tm = localtime(&Anope::CurTime);
@@ -144,19 +751,25 @@ class DBFlatFile : public Module, public Pipe
 				if (Anope::IsFile(newname) || !Anope::IsFile(oldname))
 					continue;
 
-				Log(LOG_DEBUG) << "db_flatfile: Attempting to rename " << *it << " to " << newname;
-				if (rename(oldname.c_str(), newname.c_str()))
+				/* A journaled database is still needed, so it is copied once its journal has been merged into it */
+				if (journal_ready)
+					pending_backups.push_back(std::make_pair(oldname, newname));
+				else
 				{
-					Anope::string err = Anope::LastError();
-					Log(this) << "Unable to back up database " << *it << " (" << err << ")!";
-
-					if (!Config->GetModule(this)->Get<bool>("nobackupokay"))
+					Log(LOG_DEBUG) << "db_flatfile: Attempting to rename " << *it << " to " << newname;
+					if (rename(oldname.c_str(), newname.c_str()))
 					{
-						Anope::Quitting = true;
-						Anope::QuitReason = "Unable to back up database " + *it + " (" + err + ")";
-					}
+						Anope::string err = Anope::LastError();
+						Log(this) << "Unable to back up database " << *it << " (" << err << ")!";
 
-					continue;
+						if (!Config->GetModule(this)->Get<bool>("nobackupokay"))
+						{
+							Anope::Quitting = true;
+							Anope::QuitReason = "Unable to back up database " + *it + " (" + err + ")";
+						}
+
+						continue;
+					}
 				}
 
 				backups[*it].push_back(newname);
@@ -172,12 +785,108 @@ class DBFlatFile : public Module, public Pipe
 	}
 
  public:
-	DBFlatFile(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, DATABASE | VENDOR), last_day(0), loaded(false), child_pid(-1)
+	DBFlatFile(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, DATABASE | VENDOR), last_day(0), loaded(false), child_pid(-1),
+		journal(false), journal_ready(false), loading(false), unloading(NULL), journal_records(0), compactor(NULL)
 	{
 
 	}
 
-#ifndef _WIN32
+	~DBFlatFile()
+	{
+		this->WaitForCompaction();
+	}
+
+	void OnCompacted()
+	{
+		CompactThread *t = compactor;
+		compactor = NULL;
+
+		if (!t->error.empty())
+			Log(this) << "Error compacting databases: " << t->error;
+
+		/* Put the journals which were not merged back in front of the ones written since */
+		for (unsigned i = 0; i < t->failed.size(); ++i)
+		{
+			const Anope::string &jname = t->failed[i] + ".journal";
+
+			std::ifstream in(jname.c_str(), std::ios_base::in | std::ios_base::binary);
+			std::ofstream out((jname + ".compacting").c_str(), std::ios_base::out | std::ios_base::app | std::ios_base::binary);
+			if (in.is_open() && in.peek() != EOF)
+				out << in.rdbuf();
+			in.close();
+			out.close();
+
+#ifdef _WIN32
+			unlink(jname.c_str());
+#endif
+			rename((jname + ".compacting").c_str(), jname.c_str());
+			journaled.insert(t->failed[i]);
+		}
+
+		if (t->failed.empty())
+			Log(LOG_DEBUG) << "db_flatfile: Finished compacting databases";
+	}
+
+	void OnReload(Configuration::Conf *conf) anope_override
+	{
+		journal = conf->GetModule(this)->Get<bool>("journal");
+
+		if (!journal && journal_ready)
+		{
+			/* The next save writes everything, and removes the journals */
+			this->WaitForCompaction();
+			journal_ready = false;
+			dirty.clear();
+			deleted.clear();
+		}
+	}
+
+	void OnModuleLoad(User *, Module *m) anope_override
+	{
+		if (m == unloading)
+			unloading = NULL;
+	}
+
+	void OnModuleUnload(User *, Module *m) anope_override
+	{
+		unloading = m;
+	}
+
+	void OnSerializableConstruct(Serializable *obj) anope_override
+	{
+		if (journal_ready && !loading)
+			dirty.insert(obj);
+	}
+
+	void OnSerializableUpdate(Serializable *obj) anope_override
+	{
+		if (journal_ready && !loading)
+			dirty.insert(obj);
+	}
+
+	void OnSerializableDestruct(Serializable *obj) anope_override
+	{
+		Serialize::Type *s_type = obj->GetSerializableType();
+
+		if (s_type && obj->id)
+		{
+			std::map<uint64_t, Serializable *>::iterator it = s_type->objects.find(obj->id);
+			if (it != s_type->objects.end() && it->second == obj)
+				s_type->objects.erase(it);
+		}
+
+		if (!journal_ready)
+			return;
+
+		dirty.erase(obj);
+
+		/* Objects of unloaded modules and objects destroyed on shutdown still exist in the database */
+		if (loading || !s_type || !obj->id || (unloading && s_type->GetOwner() == unloading))
+			return;
+
+		deleted[GetDatabaseName(s_type->GetOwner())].push_back(std::make_pair(s_type->GetName(), obj->id));
+	}
+
 	void OnRestart() anope_override
 	{
 		OnShutdown();
@@ -185,6 +894,12 @@ class DBFlatFile : public Module, public Pipe
 
 	void OnShutdown() anope_override
 	{
+		/* Nothing is deleted from here on */
+		loading = true;
+
+		this->WaitForCompaction();
+
+#ifndef _WIN32
 		if (child_pid > -1)
 		{
 			Log(this) << "Waiting for child to exit...";
@@ -194,8 +909,8 @@ class DBFlatFile : public Module, public Pipe
 
 			Log(this) << "Done";
 		}
-	}
 #endif
+	}
 
 	void OnNotify() anope_override
 	{
@@ -226,21 +941,20 @@ class DBFlatFile : public Module, public Pipe
 
 		const Anope::string &db_name = Anope::DataDir + "/" + Config->GetModule(this)->Get<const Anope::string>("database", "anope.db");
 
-		std::fstream fd(db_name.c_str(), std::ios_base::in | std::ios_base::binary);
-		if (!fd.is_open())
+		timeval start;
+		gettimeofday(&start, NULL);
+
+		DatabaseFile file;
+		if (!file.Open(db_name))
 		{
 			Log(this) << "Unable to open " << db_name << " for reading!";
 			return EVENT_STOP;
 		}
 
-		std::map<Anope::string, std::vector<std::streampos> > positions;
-
-		for (Anope::string buf; std::getline(fd, buf.str());)
-			if (buf.find("OBJECT ") == 0)
-				positions[buf.substr(7)].push_back(fd.tellg());
+		timeval parsed;
+		gettimeofday(&parsed, NULL);
 
-		LoadData ld;
-		ld.fs = &fd;
+		FileData fd(file);
 
 		for (unsigned i = 0; i < type_order.size(); ++i)
 		{
@@ -248,21 +962,32 @@ class DBFlatFile : public Module, public Pipe
 			if (!stype || stype->GetOwner())
 				continue;
 
-			std::vector<std::streampos> &pos = positions[stype->GetName()];
+			const std::vector<DatabaseFile::Object> *objs = file.Find(stype->GetName());
+			if (!objs)
+				continue;
 
-			for (unsigned j = 0; j < pos.size(); ++j)
+			for (unsigned j = 0; j < objs->size(); ++j)
 			{
-				fd.clear();
-				fd.seekg(pos[j]);
+				fd.obj = &(*objs)[j];
 
-				Serializable *obj = stype->Unserialize(NULL, ld);
+				Serializable *obj = stype->Unserialize(NULL, fd);
 				if (obj != NULL)
-					obj->id = ld.id;
-				ld.Reset();
+				{
+					obj->id = fd.obj->id;
+					if (obj->id)
+						stype->objects[obj->id] = obj;
+				}
 			}
 		}
 
-		fd.close();
+		timeval done;
+		gettimeofday(&done, NULL);
+
+		Log(this) << "Loaded " << file.count << " objects from " << db_name << " in " << Elapsed(start, done) << "ms (" << Elapsed(start, parsed) << "ms reading)";
+
+		loading = true;
+		ReplayJournals(db_name, NULL);
+		loading = false;
 
 		loaded = true;
 		return EVENT_STOP;
@@ -279,9 +1004,20 @@ class DBFlatFile : public Module, public Pipe
 
 		BackupDatabase();
 
+		if (journal_ready)
+		{
+			this->SaveJournal();
+			return;
+		}
+
+		/* Journaling starts from a complete save, with every object given an ID */
+		if (journal)
+			this->AssignIDs();
+		bool written = true;
+
 		int i = -1;
 #ifndef _WIN32
-		if (!Anope::Quitting && Config->GetModule(this)->Get<bool>("fork"))
+		if (!Anope::Quitting && !journal && Config->GetModule(this)->Get<bool>("fork"))
 		{
 			i = fork();
 			if (i > 0)
@@ -342,11 +1078,12 @@ class DBFlatFile : public Module, public Pipe
 			for (std::map<Module *, std::fstream *>::iterator it = databases.begin(), it_end = databases.end(); it != it_end; ++it)
 			{
 				std::fstream *f = it->second;
-				const Anope::string &db_name = Anope::DataDir + "/" + (it->first ? (it->first->name + ".db") : Config->GetModule(this)->Get<const Anope::string>("database", "anope.db"));
+				const Anope::string &db_name = GetDatabaseName(it->first);
 
 				if (!f->is_open() || !f->good())
 				{
 					this->Write("Unable to write database " + db_name);
+					written = false;
 
 					f->close();
 
@@ -357,10 +1094,22 @@ class DBFlatFile : public Module, public Pipe
 				{
 					f->close();
 					unlink((db_name + ".tmp").c_str());
+
+					/* Everything in the journals is in the database now */
+					unlink((db_name + ".journal").c_str());
+					unlink((db_name + ".journal.compacting").c_str());
 				}
 
 				delete f;
 			}
+
+			if (journal && written)
+			{
+				Log(LOG_DEBUG) << "db_flatfile: Journaling changes from now on";
+				journal_ready = true;
+				journal_records = 0;
+				journaled.clear();
+			}
 		}
 		catch (...)
 		{
@@ -370,7 +1119,8 @@ class DBFlatFile : public Module, public Pipe
 
 		if (!i)
 		{
-			this->Notify();
+			/* Notify can not reach the parent process, an empty message tells it the save is done */
+			this->Write("\0", 1);
 			exit(0);
 		}
 	}
@@ -381,33 +1131,49 @@ class DBFlatFile : public Module, public Pipe
 		if (!loaded)
 			return;
 
-		Anope::string db_name;
-		if (stype->GetOwner())
-			db_name = Anope::DataDir + "/module_" + stype->GetOwner()->name + ".db";
-		else
-			db_name = Anope::DataDir + "/" + Config->GetModule(this)->Get<const Anope::string>("database", "anope.db");
+		const Anope::string &db_name = GetDatabaseName(stype->GetOwner());
 
-		std::fstream fd(db_name.c_str(), std::ios_base::in | std::ios_base::binary);
-		if (!fd.is_open())
+		/* The journal being merged is about to be removed */
+		this->WaitForCompaction();
+
+		/* Objects destroyed when the type went away are about to be loaded again */
+		std::vector<std::pair<Anope::string, uint64_t> > &dels = deleted[db_name];
+		for (unsigned i = dels.size(); i > 0; --i)
+			if (dels[i - 1].first == stype->GetName())
+				dels.erase(dels.begin() + i - 1);
+
+		DatabaseFile file;
+		if (!file.Open(db_name))
 		{
 			Log(this) << "Unable to open " << db_name << " for reading!";
 			return;
 		}
 
-		LoadData ld;
-		ld.fs = &fd;
+		FileData fd(file);
 
-		for (Anope::string buf; std::getline(fd, buf.str());)
+		loading = true;
+		const std::vector<DatabaseFile::Object> *objs = file.Find(stype->GetName());
+		for (unsigned i = 0; objs && i < objs->size(); ++i)
 		{
-			if (buf == "OBJECT " + stype->GetName())
+			fd.obj = &(*objs)[i];
+
+			Serializable *obj = stype->Unserialize(NULL, fd);
+			if (obj != NULL && fd.obj->id)
 			{
-				stype->Unserialize(NULL, ld);
-				ld.Reset();
+				obj->id = fd.obj->id;
+				stype->objects[obj->id] = obj;
 			}
 		}
 
-		fd.close();
+		ReplayJournals(db_name, stype);
+		loading = false;
 	}
 };
 
+void CompactThread::OnNotify()
+{
+	Thread::OnNotify();
+	module->OnCompacted();
+}
+
 MODULE_INIT(DBFlatFile)
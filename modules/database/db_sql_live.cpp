@@ -11,6 +11,18 @@
 
 using namespace SQL;
 
+/* Types only ask SQL for changes once they are stale, so make them stale every second */
+class StaleTimer : public Timer
+{
+ public:
+	StaleTimer(Module *creator) : Timer(creator, 1, Anope::CurTime, true) { }
+
+	void Tick(time_t) anope_override
+	{
+		Serialize::Type::MarkAllStale();
+	}
+};
+
 class DBMySQL : public Module, public Pipe
 {
  private:
@@ -20,6 +32,7 @@ class DBMySQL : public Module, public Pipe
 	bool ro;
 	bool init;
 	std::set<Serializable *> updated_items;
+	StaleTimer stale_timer;
 
 	bool CheckSQL()
 	{
@@ -72,7 +85,7 @@ class DBMySQL : public Module, public Pipe
 	}
 
  public:
-	DBMySQL(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, DATABASE | VENDOR), SQL("", "")
+	DBMySQL(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, DATABASE | VENDOR), SQL("", ""), stale_timer(this)
 	{
 		this->lastwarn = 0;
 		this->ro = false;
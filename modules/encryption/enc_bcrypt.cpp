@@ -840,9 +840,64 @@ char *_crypt_gensalt_blowfish_rn(const char *prefix, unsigned long count,
 #include "module.h"
 #include "modules/encryption.h"
 
+static Anope::string Generate(const Anope::string& data, const Anope::string& salt)
+{
+	char hash[64];
+	_crypt_blowfish_rn(data.c_str(), salt.c_str(), hash, sizeof(hash));
+	return hash;
+}
+
+static bool Compare(const Anope::string& string, const Anope::string& hash)
+{
+	Anope::string ret = Generate(string, hash);
+	if (ret.empty())
+		return false;
+
+	return (ret == hash);
+}
+
+class BCryptCheckPool : public Encryption::CheckPool
+{
+	const unsigned int &rounds;
+
+ public:
+	BCryptCheckPool(Module *o, const unsigned int &r) : Encryption::CheckPool(o), rounds(r) { }
+
+	bool Compare(const Anope::string &password, const Anope::string &hash) anope_override
+	{
+		return ::Compare(password, hash);
+	}
+
+	void OnMatch(IdentifyRequest *req, NickCore *nc) anope_override
+	{
+		/* if we are NOT the first module in the list or the number of rounds
+		 * has changed, we want to re-encrypt the pass with the new encryption
+		 */
+
+		unsigned int hashrounds = 0;
+		try
+		{
+			size_t roundspos = nc->pass.find('$', 11);
+			if (roundspos == Anope::string::npos)
+				throw ConvertException("Could not find hashrounds");
+
+			hashrounds = convertTo<unsigned int>(nc->pass.substr(11, roundspos - 11));
+		}
+		catch (const ConvertException &)
+		{
+			Log(owner) << "Could not get the round size of a hash. This is probably a bug. Hash: " << nc->pass;
+		}
+
+		if (ModuleManager::FindFirstOf(ENCRYPTION) != owner || (hashrounds && hashrounds != rounds))
+			Anope::Encrypt(req->GetPassword(), nc->pass);
+		req->Success(owner);
+	}
+};
+
 class EBCRYPT : public Module
 {
 	unsigned int rounds;
+	BCryptCheckPool checkpool;
 
 	Anope::string Salt()
 	{
@@ -856,25 +911,9 @@ class EBCRYPT : public Module
 		return salt;
 	}
 
-	Anope::string Generate(const Anope::string& data, const Anope::string& salt)
-	{
-		char hash[64];
-		_crypt_blowfish_rn(data.c_str(), salt.c_str(), hash, sizeof(hash));
-		return hash;
-	}
-
-	bool Compare(const Anope::string& string, const Anope::string& hash)
-	{
-		Anope::string ret = Generate(string, hash);
-		if (ret.empty())
-			return false;
-
-		return (ret == hash);
-	}
-
  public:
 	EBCRYPT(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, ENCRYPTION | VENDOR),
-		rounds(10)
+		rounds(10), checkpool(this, rounds)
 	{
 		// Test a pre-calculated hash
 		bool test = Compare("Test!", "$2a$10$x9AQFAQScY0v9KF2suqkEOepsHFrG.CXHbIXI.1F28SfSUb56A/7K");
@@ -907,36 +946,19 @@ class EBCRYPT : public Module
 		if (hash_method != "bcrypt")
 			return;
 
-		if (Compare(req->GetPassword(), nc->pass.substr(7)))
-		{
-			/* if we are NOT the first module in the list,
-			 * we want to re-encrypt the pass with the new encryption
-			 */
-
-			unsigned int hashrounds = 0;
-			try
-			{
-				size_t roundspos = nc->pass.find('$', 11);
-				if (roundspos == Anope::string::npos)
-					throw ConvertException("Could not find hashrounds");
-
-				hashrounds = convertTo<unsigned int>(nc->pass.substr(11, roundspos - 11));
-			}
-			catch (const ConvertException &)
-			{
-				Log(this) << "Could not get the round size of a hash. This is probably a bug. Hash: " << nc->pass;
-			}
+		checkpool.Check(req, nc, nc->pass.substr(7));
+	}
 
-			if (ModuleManager::FindFirstOf(ENCRYPTION) != this || (hashrounds && hashrounds != rounds))
-				Anope::Encrypt(req->GetPassword(), nc->pass);
-			req->Success(this);
-		}
+	void OnModuleUnload(User *, Module *m) anope_override
+	{
+		checkpool.OnModuleUnload(m);
 	}
 
 	void OnReload(Configuration::Conf *conf) anope_override
 	{
 		Configuration::Block *block = conf->GetModule(this);
 		rounds = block->Get<unsigned int>("rounds", "10");
+		checkpool.SetThreads(block->Get<unsigned int>("threads", "2"));
 
 		if (rounds == 0)
 		{
@@ -197,27 +197,44 @@ class SHA1Provider : public Encryption::Provider
 	}
 };
 
+static Anope::string Hash(const Anope::string &src)
+{
+	SHA1Context context;
+
+	context.Update(reinterpret_cast<const unsigned char *>(src.c_str()), src.length());
+	context.Finalize();
+
+	Encryption::Hash hash = context.GetFinalizedHash();
+
+	return "sha1:" + Anope::Hex(reinterpret_cast<const char *>(hash.first), hash.second);
+}
+
+class SHA1CheckPool : public Encryption::CheckPool
+{
+ public:
+	SHA1CheckPool(Module *o) : Encryption::CheckPool(o) { }
+
+	bool Compare(const Anope::string &password, const Anope::string &hash) anope_override
+	{
+		return hash.equals_cs(Hash(password));
+	}
+};
+
 class ESHA1 : public Module
 {
 	SHA1Provider sha1provider;
+	SHA1CheckPool checkpool;
 
  public:
 	ESHA1(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, ENCRYPTION | VENDOR),
-		sha1provider(this)
+		sha1provider(this), checkpool(this)
 	{
 
 	}
 
 	EventReturn OnEncrypt(const Anope::string &src, Anope::string &dest) anope_override
 	{
-		SHA1Context context;
-
-		context.Update(reinterpret_cast<const unsigned char *>(src.c_str()), src.length());
-		context.Finalize();
-
-		Encryption::Hash hash = context.GetFinalizedHash();
-
-		Anope::string buf = "sha1:" + Anope::Hex(reinterpret_cast<const char *>(hash.first), hash.second);
+		Anope::string buf = Hash(src);
 
 		Log(LOG_DEBUG_2) << "(enc_sha1) hashed password from [" << src << "] to [" << buf << "]";
 		dest = buf;
@@ -238,14 +255,17 @@ class ESHA1 : public Module
 		if (!hash_method.equals_cs("sha1"))
 			return;
 
-		Anope::string buf;
-		this->OnEncrypt(req->GetPassword(), buf);
-		if (nc->pass.equals_cs(buf))
-		{
-			if (ModuleManager::FindFirstOf(ENCRYPTION) != this)
-				Anope::Encrypt(req->GetPassword(), nc->pass);
-			req->Success(this);
-		}
+		checkpool.Check(req, nc, nc->pass);
+	}
+
+	void OnModuleUnload(User *, Module *m) anope_override
+	{
+		checkpool.OnModuleUnload(m);
+	}
+
+	void OnReload(Configuration::Conf *conf) anope_override
+	{
+		checkpool.SetThreads(conf->GetModule(this)->Get<unsigned>("threads", "0"));
 	}
 };
 
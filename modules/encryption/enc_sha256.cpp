@@ -236,12 +236,60 @@ class SHA256Provider : public Encryption::Provider
 	}
 };
 
+/* returns the IV as hex-encoded string */
+static Anope::string GetIVString(const unsigned *iv)
+{
+	char buf[33];
+	for (int i = 0; i < 8; ++i)
+		UNPACK32(iv[i], reinterpret_cast<unsigned char *>(&buf[i << 2]));
+	buf[32] = '\0';
+	return Anope::Hex(buf, 32);
+}
+
+/* splits the appended IV from the password string so it can be used for the next encryption */
+/* password format:  <hashmethod>:<password_b64>:<iv_b64> */
+static void GetIVFromPass(const Anope::string &password, unsigned *iv)
+{
+	size_t pos = password.find(':');
+	Anope::string buf = password.substr(password.find(':', pos + 1) + 1, password.length());
+	char buf2[33];
+	Anope::Unhex(buf, buf2, sizeof(buf2));
+	for (int i = 0 ; i < 8; ++i)
+		PACK32(reinterpret_cast<unsigned char *>(&buf2[i << 2]), iv[i]);
+}
+
+/* hashes src with the given IV, returning the password in the stored format */
+static Anope::string Hash(const Anope::string &src, unsigned *iv)
+{
+	Encryption::IV initilization(iv, 8);
+	SHA256Context ctx(&initilization);
+	ctx.Update(reinterpret_cast<const unsigned char *>(src.c_str()), src.length());
+	ctx.Finalize();
+
+	Encryption::Hash hash = ctx.GetFinalizedHash();
+
+	return "sha256:" + Anope::Hex(reinterpret_cast<const char *>(hash.first), hash.second) + ":" + GetIVString(iv);
+}
+
+class SHA256CheckPool : public Encryption::CheckPool
+{
+ public:
+	SHA256CheckPool(Module *o) : Encryption::CheckPool(o) { }
+
+	bool Compare(const Anope::string &password, const Anope::string &hash) anope_override
+	{
+		unsigned iv[8];
+		GetIVFromPass(hash, iv);
+		return hash.equals_cs(Hash(password, iv));
+	}
+};
+
 class ESHA256 : public Module
 {
 	SHA256Provider sha256provider;
+	SHA256CheckPool checkpool;
 
 	unsigned iv[8];
-	bool use_iv;
 
 	/* initializes the IV with a new random value */
 	void NewRandomIV()
@@ -250,55 +298,17 @@ class ESHA256 : public Module
 			iv[i] = static_cast<uint32_t>(rand());
 	}
 
-	/* returns the IV as base64-encrypted string */
-	Anope::string GetIVString()
-	{
-		char buf[33];
-		for (int i = 0; i < 8; ++i)
-			UNPACK32(iv[i], reinterpret_cast<unsigned char *>(&buf[i << 2]));
-		buf[32] = '\0';
-		return Anope::Hex(buf, 32);
-	}
-
-	/* splits the appended IV from the password string so it can be used for the next encryption */
-	/* password format:  <hashmethod>:<password_b64>:<iv_b64> */
-	void GetIVFromPass(const Anope::string &password)
-	{
-		size_t pos = password.find(':');
-		Anope::string buf = password.substr(password.find(':', pos + 1) + 1, password.length());
-		char buf2[33];
-		Anope::Unhex(buf, buf2, sizeof(buf2));
-		for (int i = 0 ; i < 8; ++i)
-			PACK32(reinterpret_cast<unsigned char *>(&buf2[i << 2]), iv[i]);
-	}
-
  public:
 	ESHA256(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, ENCRYPTION | VENDOR),
-		sha256provider(this)
+		sha256provider(this), checkpool(this)
 	{
-
-
-		use_iv = false;
 	}
 
 	EventReturn OnEncrypt(const Anope::string &src, Anope::string &dest) anope_override
 	{
-		if (!use_iv)
-			NewRandomIV();
-		else
-			use_iv = false;
-
-		Encryption::IV initilization(this->iv, 8);
-		SHA256Context ctx(&initilization);
-		ctx.Update(reinterpret_cast<const unsigned char *>(src.c_str()), src.length());
-		ctx.Finalize();
-
-		Encryption::Hash hash = ctx.GetFinalizedHash();
-
-		std::stringstream buf;
-		buf << "sha256:" << Anope::Hex(reinterpret_cast<const char *>(hash.first), hash.second) << ":" << GetIVString();
-		Log(LOG_DEBUG_2) << "(enc_sha256) hashed password from [" << src << "] to [" << buf.str() << " ]";
-		dest = buf.str();
+		NewRandomIV();
+		dest = Hash(src, this->iv);
+		Log(LOG_DEBUG_2) << "(enc_sha256) hashed password from [" << src << "] to [" << dest << " ]";
 		return EVENT_ALLOW;
 	}
 
@@ -316,19 +326,17 @@ class ESHA256 : public Module
 		if (!hash_method.equals_cs("sha256"))
 			return;
 
-		GetIVFromPass(nc->pass);
-		use_iv = true;
-		Anope::string buf;
-		this->OnEncrypt(req->GetPassword(), buf);
-		if (nc->pass.equals_cs(buf))
-		{
-			/* if we are NOT the first module in the list,
-			 * we want to re-encrypt the pass with the new encryption
-			 */
-			if (ModuleManager::FindFirstOf(ENCRYPTION) != this)
-				Anope::Encrypt(req->GetPassword(), nc->pass);
-			req->Success(this);
-		}
+		checkpool.Check(req, nc, nc->pass);
+	}
+
+	void OnModuleUnload(User *, Module *m) anope_override
+	{
+		checkpool.OnModuleUnload(m);
+	}
+
+	void OnReload(Configuration::Conf *conf) anope_override
+	{
+		checkpool.SetThreads(conf->GetModule(this)->Get<unsigned>("threads", "0"));
 	}
 };
 
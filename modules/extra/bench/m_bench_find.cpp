@@ -0,0 +1,127 @@
+/*
+ *
+ * (C) 2003-2019 Anope Team
+ * Contact us at team@anope.org
+ *
+ * Please read COPYING and README for further details.
+ */
+
+/* Benchmarks the nick and channel lookups done by User::Find and Channel::Find, in maps
+ * of the same type as UserListByNick and ChannelList, against maps using the hash and
+ * compare functors Anope::hash_map used before they stopped copying their keys. It runs
+ * when the module is loaded and logs its results, so it should only be loaded on a test
+ * network.
+ */
+
+#include "module.h"
+
+namespace
+{
+	/* A small deterministic generator, so runs are comparable and rand() is left alone */
+	unsigned random_state;
+
+	unsigned Random(unsigned n)
+	{
+		random_state = random_state * 1103515245U + 12345U;
+		return (random_state >> 16) % n;
+	}
+
+	/* Anope::hash_ci and Anope::compare as they were before */
+	struct OldHash
+	{
+		size_t operator()(const Anope::string &s) const
+		{
+			return TR1NS::hash<std::string>()(s.lower().str());
+		}
+	};
+
+	struct OldCompare
+	{
+		bool operator()(const Anope::string &s1, const Anope::string &s2) const
+		{
+			return ci::string(s1.c_str()) == s2.c_str();
+		}
+	};
+
+	typedef TR1NS::unordered_map<Anope::string, void *, OldHash, OldCompare> old_map;
+}
+
+class BenchFind : public Module
+{
+	/* How many nicks and channels are in the maps */
+	static const unsigned entries = 100000;
+	/* How many times each lookup is done */
+	static const unsigned rounds = 20;
+
+	template<typename T>
+	void Time(const Anope::string &what, const std::vector<Anope::string> &keys, const std::vector<Anope::string> &lookups)
+	{
+		T map;
+		for (unsigned i = 0; i < keys.size(); ++i)
+			map.insert(std::make_pair(keys[i], typename T::mapped_type()));
+
+		unsigned found = 0;
+		uint64_t start = Anope::MicroTime();
+		for (unsigned r = 0; r < rounds; ++r)
+			for (unsigned i = 0; i < lookups.size(); ++i)
+				found += map.count(lookups[i]);
+
+		uint64_t elapsed = Anope::MicroTime() - start;
+		double lookups_done = static_cast<double>(rounds) * lookups.size();
+		Log(this) << what << ": " << elapsed * 1000.0 / lookups_done << "ns per lookup, " << lookups_done / elapsed << "M lookups per second, " << found / rounds << " of " << lookups.size() << " found";
+	}
+
+	void Run(const Anope::string &casemap)
+	{
+		static const char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ[]{}|_";
+		std::vector<Anope::string> nicks, channels, nick_lookups, channel_lookups;
+
+		random_state = 1;
+		for (unsigned i = 0; i < entries; ++i)
+		{
+			Anope::string nick;
+			for (unsigned j = 0, len = 5 + Random(10); j < len; ++j)
+				nick += chars[Random(sizeof(chars) - 1)];
+			nicks.push_back(nick);
+			channels.push_back("#" + nick.substr(0, 3 + Random(10)) + "chan");
+		}
+
+		/* Lookups are in random case, and a quarter of the nicks looked up do not exist */
+		for (unsigned i = 0; i < entries; ++i)
+		{
+			Anope::string nick = nicks[Random(nicks.size())], channel = channels[Random(channels.size())];
+			for (unsigned j = 0; j < nick.length(); ++j)
+				if (Random(2))
+					nick[j] = Anope::toupper(nick[j]);
+			for (unsigned j = 0; j < channel.length(); ++j)
+				if (Random(2))
+					channel[j] = Anope::toupper(channel[j]);
+			nick_lookups.push_back(i % 4 ? nick : nick + "x");
+			channel_lookups.push_back(channel);
+		}
+
+		Time<old_map>(casemap + ": nicks, old functors", nicks, nick_lookups);
+		Time<user_map>(casemap + ": nicks, user_map", nicks, nick_lookups);
+		Time<old_map>(casemap + ": channels, old functors", channels, channel_lookups);
+		Time<channel_map>(casemap + ": channels, channel_map", channels, channel_lookups);
+	}
+
+ public:
+	BenchFind(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, EXTRA | VENDOR)
+	{
+		std::locale casemap = Anope::casemap;
+
+		Anope::casemap = std::locale(std::locale(), new Anope::ascii_ctype<char>());
+		Anope::CaseMapRebuild();
+		Run("ascii");
+
+		Anope::casemap = std::locale(std::locale(), new Anope::rfc1459_ctype<char>());
+		Anope::CaseMapRebuild();
+		Run("rfc1459");
+
+		Anope::casemap = casemap;
+		Anope::CaseMapRebuild();
+	}
+};
+
+MODULE_INIT(BenchFind)
@@ -0,0 +1,195 @@
+/*
+ *
+ * (C) 2003-2019 Anope Team
+ * Contact us at team@anope.org
+ *
+ * Please read COPYING and README for further details.
+ */
+
+/* Benchmarks Anope::Glob against the wildcard matcher Anope::Match used before it,
+ * under the ascii and rfc1459 casemaps, and checks that the two agree on random
+ * masks. It runs when the module is loaded and logs its results, so it should only
+ * be loaded on a test network.
+ */
+
+#include "module.h"
+
+namespace
+{
+	/* A small deterministic generator, so runs are comparable and rand() is left alone */
+	unsigned random_state;
+
+	unsigned Random(unsigned n)
+	{
+		random_state = random_state * 1103515245U + 12345U;
+		return (random_state >> 16) % n;
+	}
+
+	Anope::string RandomString(const char *chars, unsigned len)
+	{
+		Anope::string s;
+		for (unsigned i = 0, n = strlen(chars); i < len; ++i)
+			s += chars[Random(n)];
+		return s;
+	}
+
+	/* Anope::Match as it was before Anope::Glob, without regex support, and with
+	 * Anope::tolower inlined so calling it from a module does not slow it down
+	 */
+	bool OldMatch(const Anope::string &str, const Anope::string &mask, bool case_sensitive)
+	{
+		size_t s = 0, m = 0, str_len = str.length(), mask_len = mask.length();
+
+		while (s < str_len && m < mask_len && mask[m] != '*')
+		{
+			char string = str[s], wild = mask[m];
+			if (case_sensitive)
+			{
+				if (wild != string && wild != '?')
+					return false;
+			}
+			else
+			{
+				if (Anope::casemap_lower[static_cast<unsigned char>(wild)] != Anope::casemap_lower[static_cast<unsigned char>(string)] && wild != '?')
+					return false;
+			}
+
+			++m;
+			++s;
+		}
+
+		size_t sp = Anope::string::npos, mp = Anope::string::npos;
+		while (s < str_len)
+		{
+			char string = str[s], wild = mask[m];
+			if (wild == '*')
+			{
+				if (++m == mask_len)
+					return 1;
+
+				mp = m;
+				sp = s + 1;
+			}
+			else if (case_sensitive)
+			{
+				if (wild == string || wild == '?')
+				{
+					++m;
+					++s;
+				}
+				else
+				{
+					m = mp;
+					s = sp++;
+				}
+			}
+			else
+			{
+				if (Anope::casemap_lower[static_cast<unsigned char>(wild)] == Anope::casemap_lower[static_cast<unsigned char>(string)] || wild == '?')
+				{
+					++m;
+					++s;
+				}
+				else
+				{
+					m = mp;
+					s = sp++;
+				}
+			}
+		}
+
+		if (m < mask_len && mask[m] == '*')
+			++m;
+
+		return m == mask_len;
+	}
+}
+
+class BenchGlob : public Module
+{
+	/* How many random string and mask pairs are compared */
+	static const unsigned checks = 2000000;
+	/* How many times each mask is matched against every host */
+	static const unsigned rounds = 1000;
+
+	void Check(const Anope::string &casemap)
+	{
+		unsigned differences = 0;
+
+		random_state = 1;
+		for (unsigned i = 0; i < checks; ++i)
+		{
+			Anope::string str = RandomString("aAbB[{*?x", Random(8)), mask = RandomString("aAbB[{*?x", Random(7));
+			bool case_sensitive = Random(2), old_match = OldMatch(str, mask, case_sensitive), match = Anope::Glob::Match(str, mask, case_sensitive), glob = Anope::Glob(mask, case_sensitive).Matches(str);
+
+			/* The old matcher failed masks ending in several *s if the string ran out before them */
+			if (!old_match && mask.length() >= 2 && mask.substr(mask.length() - 2) == "**")
+				old_match = match;
+
+			if (old_match != match || match != glob)
+			{
+				if (++differences <= 10)
+					Log(this) << casemap << ": \"" << str << "\" against \"" << mask << "\"" << (case_sensitive ? " (case sensitive)" : "") << ": old " << old_match << ", Match " << match << ", Glob " << glob;
+			}
+		}
+
+		Log(this) << casemap << ": " << differences << " differences in " << checks << " random matches";
+	}
+
+	void Time(const Anope::string &casemap)
+	{
+		static const char *const masks[] = { "*!*@*.example.com", "*@192.168.*", "nick*!*ident@host.isp.net", "*bad*word*", "*.users.*.irc" };
+		std::vector<Anope::string> hosts;
+
+		random_state = 1;
+		for (unsigned i = 0; i < 1000; ++i)
+			hosts.push_back(RandomString("abcdefghijklmnop", 6) + "!~" + RandomString("abcdefg", 8) + "@" + RandomString("abcdefghij.", 20) + (i % 10 ? ".example.net" : ".example.com"));
+
+		for (unsigned k = 0; k < sizeof(masks) / sizeof(*masks); ++k)
+		{
+			const Anope::string mask = masks[k];
+			const Anope::Glob glob(mask);
+			unsigned old_matches = 0, matches = 0, glob_matches = 0;
+
+			uint64_t start = Anope::MicroTime();
+			for (unsigned r = 0; r < rounds; ++r)
+				for (unsigned i = 0; i < hosts.size(); ++i)
+					old_matches += OldMatch(hosts[i], mask, false);
+
+			uint64_t old_end = Anope::MicroTime();
+			for (unsigned r = 0; r < rounds; ++r)
+				for (unsigned i = 0; i < hosts.size(); ++i)
+					matches += Anope::Glob::Match(hosts[i], mask, false);
+
+			uint64_t match_end = Anope::MicroTime();
+			for (unsigned r = 0; r < rounds; ++r)
+				for (unsigned i = 0; i < hosts.size(); ++i)
+					glob_matches += glob.Matches(hosts[i]);
+
+			uint64_t glob_end = Anope::MicroTime();
+			double per_match = 1000.0 / (rounds * hosts.size());
+			Log(this) << casemap << ": " << mask << ": old " << (old_end - start) * per_match << "ns, Match " << (match_end - old_end) * per_match << "ns, Glob " << (glob_end - match_end) * per_match << "ns per match" << (old_matches != matches || matches != glob_matches ? " (match counts differ!)" : "");
+		}
+	}
+
+ public:
+	BenchGlob(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, EXTRA | VENDOR)
+	{
+		std::locale casemap = Anope::casemap;
+
+		Anope::casemap = std::locale(std::locale(), new Anope::ascii_ctype<char>());
+		Anope::CaseMapRebuild();
+		Check("ascii");
+		Time("ascii");
+
+		Anope::casemap = std::locale(std::locale(), new Anope::rfc1459_ctype<char>());
+		Anope::CaseMapRebuild();
+		Check("rfc1459");
+		Time("rfc1459");
+
+		Anope::casemap = casemap;
+		Anope::CaseMapRebuild();
+	}
+};
+
+MODULE_INIT(BenchGlob)
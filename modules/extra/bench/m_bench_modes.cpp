@@ -0,0 +1,63 @@
+/*
+ *
+ * (C) 2003-2019 Anope Team
+ * Contact us at team@anope.org
+ *
+ * Please read COPYING and README for further details.
+ */
+
+/* Benchmarks the mode stacker with the changes mode lock enforcement makes after a burst:
+ * 50000 channels are created +nti, then each is set +s+l 100+k key and -i, and the time
+ * spent stacking the changes and sending them with ModeManager::ProcessModes is logged.
+ * It runs when the module is loaded. Loaded at startup only the stacker is measured, as
+ * there is no uplink to write to; loaded with MODLOAD the MODE lines are written to the
+ * uplink, so it should only be loaded on a test network. It only uses functions which
+ * predate the current stacker, so it can be built against older trees to compare them.
+ */
+
+#include "module.h"
+
+class BenchModes : public Module
+{
+	/* How many channels are created */
+	static const unsigned channels = 50000;
+
+ public:
+	BenchModes(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, EXTRA | VENDOR)
+	{
+		if (!IRCD)
+			throw ModuleException("The protocol module must be loaded before " + modname);
+
+		std::vector<Channel *> chans;
+		MessageSource source(Me);
+
+		for (unsigned i = 0; i < channels; ++i)
+		{
+			bool is_new;
+			Channel *c = Channel::FindOrCreate("#bench" + stringify(i), is_new);
+			c->SetModesInternal(source, "+nti");
+			chans.push_back(c);
+		}
+
+		uint64_t start = Anope::MicroTime();
+		for (unsigned i = 0; i < chans.size(); ++i)
+		{
+			Channel *c = chans[i];
+			c->SetMode(NULL, "SECRET", "", false);
+			c->SetMode(NULL, "LIMIT", "100", false);
+			c->SetMode(NULL, "KEY", "key" + stringify(i), false);
+			c->RemoveMode(NULL, "INVITE", "", false);
+		}
+
+		uint64_t stacked = Anope::MicroTime();
+		ModeManager::ProcessModes();
+		uint64_t sent = Anope::MicroTime();
+
+		Log(this) << "Stacked the modes of " << chans.size() << " channels in " << (stacked - start) / 1000.0 << "ms and sent them in " << (sent - stacked) / 1000.0 << "ms";
+
+		for (unsigned i = 0; i < chans.size(); ++i)
+			chans[i]->QueueForDeletion();
+	}
+};
+
+MODULE_INIT(BenchModes)
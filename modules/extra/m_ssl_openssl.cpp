@@ -57,6 +57,14 @@ class SSLSocketIO : public SocketIO
 	 */
 	int Send(Socket *s, const char *buf, size_t sz) anope_override;
 
+	/** Write the front of a buffer to the socket. TLS records are written
+	 * one segment at a time.
+	 * @param s The socket
+	 * @param buf The buffer to write from
+	 * @return Number of bytes written
+	 */
+	int Send(Socket *s, const SocketBuffer &buf) anope_override;
+
 	/** Accept a connection from a socket
 	 * @param s The socket
 	 * @return The new socket
@@ -251,6 +259,16 @@ int SSLSocketIO::Send(Socket *s, const char *buf, size_t sz)
 	return i;
 }
 
+int SSLSocketIO::Send(Socket *s, const SocketBuffer &buf)
+{
+	if (buf.Empty())
+		return 0;
+
+	size_t sz;
+	const char *data = buf.Segment(0, sz);
+	return this->Send(s, data, sz);
+}
+
 ClientSocket *SSLSocketIO::Accept(ListenSocket *s)
 {
 	if (s->io == &NormalSocketIO)
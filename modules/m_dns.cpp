@@ -500,6 +500,11 @@ class TCPSocket : public ListenSocket
 			Log(LOG_DEBUG_2) << "Resolver: Reading from DNS TCP socket";
 
 			int i = recv(this->GetFD(), reinterpret_cast<char *>(packet_buffer) + length, sizeof(packet_buffer) - length, 0);
+			if (i < 0 && SocketEngine::WouldBlock())
+			{
+				this->flags[SF_READ_BLOCKED] = true;
+				return true;
+			}
 			if (i <= 0)
 				return false;
 
@@ -582,6 +587,11 @@ class UDPSocket : public ReplySocket
 		sockaddrs from_server;
 		socklen_t x = sizeof(from_server);
 		int length = recvfrom(this->GetFD(), reinterpret_cast<char *>(&packet_buffer), sizeof(packet_buffer), 0, &from_server.sa, &x);
+		if (length < 0 && SocketEngine::WouldBlock())
+		{
+			this->flags[SF_READ_BLOCKED] = true;
+			return true;
+		}
 		return this->manager->HandlePacket(this, packet_buffer, length, &from_server);
 	}
 
@@ -107,7 +107,7 @@ class MyHTTPClient : public HTTPClient
 	/* Close connection once all data is written */
 	bool ProcessWrite() anope_override
 	{
-		return !BinarySocket::ProcessWrite() || this->write_buffer.empty() ? false : true;
+		return !BinarySocket::ProcessWrite() || this->write_buffer.Empty() ? false : true;
 	}
 
 	const Anope::string GetIP() anope_override
@@ -37,7 +37,7 @@ class ProxyCallbackListener : public ListenSocket
 
 		bool ProcessWrite() anope_override
 		{
-			return !BufferedSocket::ProcessWrite() || this->write_buffer.empty() ? false : true;
+			return !BufferedSocket::ProcessWrite() || this->write_buffer.Empty() ? false : true;
 		}
 	};
 
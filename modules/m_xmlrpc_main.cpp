@@ -69,6 +69,10 @@ class MyXMLRPCEvent : public XMLRPCEvent
 			this->DoOperType(iface, client, request);
 		else if (request.name == "notice")
 			this->DoNotice(iface, client, request);
+		else if (request.name == "hooks")
+			this->DoHooks(iface, client, request);
+		else if (request.name == "loop")
+			this->DoLoop(iface, client, request);
 
 		return true;
 	}
@@ -261,6 +265,40 @@ class MyXMLRPCEvent : public XMLRPCEvent
 		}
 	}
 
+	void DoHooks(XMLRPCServiceInterface *iface, HTTPClient *client, XMLRPCRequest &request)
+	{
+		if (!ModuleManager::ProfileHooks)
+		{
+			request.reply("error", "Hook profiling is not enabled");
+			return;
+		}
+
+		std::vector<HookStats> stats;
+		ModuleManager::GetHookStats(stats);
+
+		for (unsigned i = 0; i < stats.size(); ++i)
+		{
+			const HookStats &hs = stats[i];
+			request.reply(hs.module->name + "." + ModuleManager::GetEventName(hs.event), stringify(hs.calls) + " " + stringify(hs.total) + " " + stringify(hs.max));
+		}
+	}
+
+	void DoLoop(XMLRPCServiceInterface *iface, HTTPClient *client, XMLRPCRequest &request)
+	{
+		request.reply("iterations", stringify(LoopStats::Iterations));
+
+		for (unsigned i = 0; i < LOOP_SIZE; ++i)
+		{
+			LoopPhase phase = static_cast<LoopPhase>(i);
+
+			Anope::string histogram;
+			for (unsigned j = 0; j < LoopStats::BUCKETS; ++j)
+				histogram += (j ? " " : "") + stringify(LoopStats::Histogram[i][j]);
+
+			request.reply(LoopStats::GetPhaseName(phase), stringify(LoopStats::Total[i]) + " " + stringify(LoopStats::Max[i]) + " " + histogram);
+		}
+	}
+
 	void DoNotice(XMLRPCServiceInterface *iface, HTTPClient *client, XMLRPCRequest &request)
 	{
 		Anope::string from = request.data.size() > 0 ? request.data[0] : "";
@@ -61,6 +61,11 @@ class SGLineManager : public XLineManager
 
 		return false;
 	}
+
+	bool IndexByHost() const anope_override
+	{
+		return true;
+	}
 };
 
 class SQLineManager : public XLineManager
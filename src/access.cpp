@@ -148,7 +148,10 @@ ChanAccess::~ChanAccess()
 	{
 		std::vector<ChanAccess *>::iterator it = std::find(this->ci->access->begin(), this->ci->access->end(), this);
 		if (it != this->ci->access->end())
+		{
 			this->ci->access->erase(it);
+			this->ci->InvalidateAccessIndex();
+		}
 
 		if (*nc != NULL)
 			nc->RemoveChannelReference(this->ci);
@@ -163,6 +166,10 @@ ChanAccess::~ChanAccess()
 
 void ChanAccess::SetMask(const Anope::string &m, ChannelInfo *c)
 {
+	/* The entry may already be indexed under its old mask */
+	if (this->ci)
+		this->ci->InvalidateAccessIndex();
+
 	if (*nc != NULL)
 		nc->RemoveChannelReference(this->ci);
 	else if (!this->mask.empty())
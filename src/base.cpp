@@ -12,6 +12,7 @@
 
 std::map<Anope::string, std::map<Anope::string, Service *> > Service::Services;
 std::map<Anope::string, std::map<Anope::string, Anope::string> > Service::Aliases;
+unsigned long Service::Generation = 0;
 
 Base::Base() : references(NULL)
 {
@@ -27,6 +27,7 @@
 
 channel_map ChannelList;
 std::vector<Channel *> Channel::deleting;
+std::vector<Channel *> Channel::joins_pending;
 
 Channel::Channel(const Anope::string &nname, time_t ts)
 {
@@ -58,6 +59,10 @@ Channel::~Channel()
 
 	ModeManager::StackerDel(this);
 
+	std::vector<Channel *>::iterator pending = std::find(joins_pending.begin(), joins_pending.end(), this);
+	if (pending != joins_pending.end())
+		joins_pending.erase(pending);
+
 	if (Me && Me->IsSynced())
 		Log(NULL, this, "destroy");
 
@@ -99,6 +104,8 @@ void Channel::Reset()
 
 void Channel::Sync()
 {
+	this->CheckPendingJoins();
+
 	syncing = false;
 	FOREACH_MOD(OnChannelSync, (this));
 	CheckModes();
@@ -168,6 +175,10 @@ void Channel::DeleteUser(User *user)
 		Log(LOG_DEBUG) << "Channel::DeleteUser() tried to delete nonexistent channel " << this->name << " from " << user->nick << "'s channel list";
 	delete cu;
 
+	std::vector<User *>::iterator it = std::find(this->pending_joins.begin(), this->pending_joins.end(), user);
+	if (it != this->pending_joins.end())
+		this->pending_joins.erase(it);
+
 	QueueForDeletion();
 }
 
@@ -284,7 +295,7 @@ void Channel::SetModeInternal(MessageSource &setter, ChannelMode *ocm, const Ano
 			return;
 		}
 
-		Log(LOG_DEBUG) << "Setting +" << cm->mchar << " on " << this->name << " for " << u->nick;
+		LOG_IF_ENABLED(LOG_DEBUG) << "Setting +" << cm->mchar << " on " << this->name << " for " << u->nick;
 
 		/* Set the status on the user */
 		ChanUserContainer *cc = u->FindChannel(this);
@@ -355,7 +366,7 @@ void Channel::RemoveModeInternal(MessageSource &setter, ChannelMode *ocm, const
 			return;
 		}
 
-		Log(LOG_DEBUG) << "Setting -" << cm->mchar << " on " << this->name << " for " << u->nick;
+		LOG_IF_ENABLED(LOG_DEBUG) << "Setting -" << cm->mchar << " on " << this->name << " for " << u->nick;
 
 		/* Remove the status on the user */
 		ChanUserContainer *cc = u->FindChannel(this);
@@ -717,7 +728,7 @@ void Channel::SetModesInternal(MessageSource &source, const Anope::string &mode,
 	if (setter)
 		Log(setter, this, "mode") << modestring << paramstring;
 	else
-		Log(LOG_DEBUG) << source.GetName() << " is setting " << this->name << " to " << modestring << paramstring;
+		LOG_IF_ENABLED(LOG_DEBUG) << source.GetName() << " is setting " << this->name << " to " << modestring << paramstring;
 
 	if (enforce_mlock)
 		this->CheckModes();
@@ -801,7 +812,7 @@ void Channel::ChangeTopicInternal(User *u, const Anope::string &user, const Anop
 	this->topic_ts = ts;
 	this->topic_time = Anope::CurTime;
 
-	Log(LOG_DEBUG) << "Topic of " << this->name << " changed by " << this->topic_setter << " to " << newtopic;
+	LOG_IF_ENABLED(LOG_DEBUG) << "Topic of " << this->name << " changed by " << this->topic_setter << " to " << newtopic;
 
 	FOREACH_MOD(OnTopicUpdated, (u, this, user, this->topic));
 }
@@ -828,7 +839,7 @@ void Channel::SetCorrectModes(User *user, bool give_modes)
 	if (!this->ci)
 		return;
 
-	Log(LOG_DEBUG) << "Setting correct user modes for " << user->nick << " on " << this->name << " (" << (give_modes ? "" : "not ") << "giving modes)";
+	LOG_IF_ENABLED(LOG_DEBUG) << "Setting correct user modes for " << user->nick << " on " << this->name << " (" << (give_modes ? "" : "not ") << "giving modes)";
 
 	AccessGroup u_access = ci->AccessFor(user);
 
@@ -924,6 +935,67 @@ bool Channel::CheckKick(User *user)
 	return true;
 }
 
+void Channel::CheckJoin(User *u)
+{
+	if (Me && !Me->IsSynced())
+	{
+		if (this->pending_joins.empty())
+			joins_pending.push_back(this);
+		this->pending_joins.push_back(u);
+		return;
+	}
+
+	this->EnforceJoin(u);
+}
+
+void Channel::EnforceJoin(User *u)
+{
+	/* Check if the user is allowed to join */
+	if (this->CheckKick(u))
+		return;
+
+	/* Set whatever modes the user should have, and remove any that
+	 * they aren't allowed to have (secureops etc).
+	 */
+	this->SetCorrectModes(u, true);
+
+	FOREACH_MOD(OnJoinChannel, (u, this));
+}
+
+void Channel::CheckPendingJoins()
+{
+	if (this->pending_joins.empty())
+		return;
+
+	std::vector<User *> joined;
+	joined.swap(this->pending_joins);
+
+	std::vector<Channel *>::iterator it = std::find(joins_pending.begin(), joins_pending.end(), this);
+	if (it != joins_pending.end())
+		joins_pending.erase(it);
+
+	for (unsigned i = 0; i < joined.size(); ++i)
+		/* Checking one user can kick another */
+		if (this->FindUser(joined[i]))
+			this->EnforceJoin(joined[i]);
+}
+
+unsigned Channel::CheckAllPendingJoins()
+{
+	unsigned count = 0;
+
+	std::vector<Channel *> channels;
+	channels.swap(joins_pending);
+
+	for (unsigned i = 0; i < channels.size(); ++i)
+	{
+		count += channels[i]->pending_joins.size();
+		channels[i]->CheckPendingJoins();
+	}
+
+	return count;
+}
+
 Channel* Channel::Find(const Anope::string &name)
 {
 	channel_map::const_iterator it = ChannelList.find(name);
@@ -16,6 +16,7 @@
 #include "opertype.h"
 #include "channels.h"
 #include "hashcomp.h"
+#include "regexpr.h"
 
 using namespace Configuration;
 
@@ -113,6 +114,9 @@ template<typename T> static void ValidateNotZero(const Anope::string &block, con
 Conf::Conf() : Block("")
 {
 	ReadTimeout = 0;
+	LogTypes = 0;
+	LogBufferSize = 0;
+	LogFlushInterval = 0;
 	UsePrivmsg = DefPrivmsg = false;
 
 	this->LoadConf(ServicesConf);
@@ -186,6 +190,8 @@ Conf::Conf() : Block("")
 	}
 
 	this->ReadTimeout = options->Get<time_t>("readtimeout");
+	this->LogBufferSize = options->Get<unsigned>("logbuffer", "4096") * 1024;
+	this->LogFlushInterval = options->Get<time_t>("logflushinterval", "1s");
 	this->UsePrivmsg = options->Get<bool>("useprivmsg");
 	this->UseStrictPrivmsg = options->Get<bool>("usestrictprivmsg");
 	this->StrictPrivmsg = !UseStrictPrivmsg ? "/msg " : "/";
@@ -195,8 +201,8 @@ Conf::Conf() : Block("")
 		this->DefPrivmsg = std::find(defaults.begin(), defaults.end(), "msg") != defaults.end();
 	}
 	this->DefLanguage = options->Get<const Anope::string>("defaultlanguage");
-	this->TimeoutCheck = options->Get<time_t>("timeoutcheck");
 	this->NickChars = networkinfo->Get<Anope::string>("nick_chars");
+	this->RegexEngine = options->Get<const Anope::string>("regexengine");
 
 	for (int i = 0; i < this->CountBlock("uplink"); ++i)
 	{
@@ -414,6 +420,7 @@ Conf::Conf() : Block("")
 		spacesepstream(log->Get<const Anope::string>("users")).GetTokens(l.users);
 		spacesepstream(log->Get<const Anope::string>("other")).GetTokens(l.normal);
 
+		this->LogTypes |= l.GetTypes();
 		this->LogInfos.push_back(l);
 	}
 
@@ -538,6 +545,12 @@ Conf::Conf() : Block("")
 	}
 	Anope::CaseMapRebuild();
 
+	/* Start measuring event handlers afresh whenever profiling is turned on */
+	bool profile_hooks = options->Get<bool>("hookprofile");
+	if (profile_hooks && !ModuleManager::ProfileHooks)
+		ModuleManager::ResetHookStats();
+	ModuleManager::ProfileHooks = profile_hooks;
+
 	/* Check the user keys */
 	if (!options->Get<unsigned>("seed"))
 		Log() << "Configuration option options:seed should be set. It's for YOUR safety! Remember that!";
@@ -553,6 +566,15 @@ Conf::~Conf()
 
 void Conf::Post(Conf *old)
 {
+	/* The regex engine may have changed */
+	RegexCache::Flush();
+
+	/* Log targets may have been removed */
+	LogWriter::CloseUnused();
+
+	/* The hook profile may be logged at a different interval, or no longer logged */
+	ModuleManager::SetHookProfileLog(this->GetBlock("options")->Get<time_t>("hookprofilelog"));
+
 	/* Apply module changes */
 	for (unsigned i = 0; i < old->ModulesAutoLoad.size(); ++i)
 		if (std::find(this->ModulesAutoLoad.begin(), this->ModulesAutoLoad.end(), old->ModulesAutoLoad[i]) == this->ModulesAutoLoad.end())
@@ -14,6 +14,10 @@
 std::locale Anope::casemap = std::locale(std::locale(), new Anope::ascii_ctype<char>());
 /* Cache of the above case map, forced upper */
 static unsigned char case_map_upper[256], case_map_lower[256];
+const unsigned char *const Anope::casemap_lower = case_map_lower;
+unsigned long Anope::casemap_generation = 0;
+/* The number of characters the case map folds to each character, up to 3, and the first two of them */
+static unsigned char case_map_folded_count[256], case_map_folded_from[256][2];
 
 /* called whenever Anope::casemap is modified to rebuild the casemap cache */
 void Anope::CaseMapRebuild()
@@ -25,6 +29,19 @@ void Anope::CaseMapRebuild()
 		case_map_upper[i] = ct.toupper(i);
 		case_map_lower[i] = ct.tolower(i);
 	}
+
+	/* Built here rather than when first needed, as it is read by threads such as os_logsearch's */
+	memset(case_map_folded_count, 0, sizeof(case_map_folded_count));
+	for (unsigned i = 0; i < sizeof(case_map_lower); ++i)
+	{
+		unsigned char l = case_map_lower[i];
+		if (case_map_folded_count[l] < 2)
+			case_map_folded_from[l][case_map_folded_count[l]] = i;
+		if (case_map_folded_count[l] < 3)
+			++case_map_folded_count[l];
+	}
+
+	++casemap_generation;
 }
 
 unsigned char Anope::tolower(unsigned char c)
@@ -37,6 +54,15 @@ unsigned char Anope::toupper(unsigned char c)
 	return case_map_upper[c];
 }
 
+unsigned Anope::FoldedFrom(unsigned char c, unsigned char search[2])
+{
+	if (case_map_folded_count[c] > 2)
+		return 0;
+	search[0] = case_map_folded_from[c][0];
+	search[1] = case_map_folded_from[c][1];
+	return case_map_folded_count[c];
+}
+
 /*
  *
  * This is an implementation of a special string class, ci::string,
@@ -260,11 +260,7 @@ static void setuidgid()
 		LogInfo& li = Config->LogInfos[i];
 
 		for (unsigned j = 0; j < li.logfiles.size(); ++j)
-		{
-			LogFile* lf = li.logfiles[j];
-
-			chown(lf->filename.c_str(), uid, gid);
-		}
+			chown(li.logfiles[j].second.c_str(), uid, gid);
 	}
 
 	if (static_cast<int>(gid) != -1)
@@ -480,6 +476,9 @@ void Anope::Init(int ac, char **av)
 	/* Initialize the socket engine. Note that some engines can not survive a fork(), so this must be here. */
 	SocketEngine::Init();
 
+	/* Threads do not survive a fork() either, so start writing log files from a separate thread now */
+	LogWriter::Start();
+
 	/* Read configuration file; exit if there are problems. */
 	try
 	{
@@ -20,11 +20,13 @@
 #include "servers.h"
 #include "uplink.h"
 #include "protocol.h"
+#include "threadengine.h"
 
 #ifndef _WIN32
 #include <sys/time.h>
 #include <unistd.h>
 #endif
+#include <sys/stat.h>
 
 static Anope::string GetTimeStamp()
 {
@@ -51,6 +53,12 @@ static Anope::string GetTimeStamp()
 	return tbuf;
 }
 
+/* Whether a log target is a file, rather than a channel, globops or something handled by a module */
+static inline bool IsFileTarget(const Anope::string &target)
+{
+	return !target.empty() && target[0] != '#' && target != "globops" && target.find(":") == Anope::string::npos;
+}
+
 static inline Anope::string CreateLogName(const Anope::string &file, time_t t = Anope::CurTime)
 {
 	char timestamp[32];
@@ -60,13 +68,64 @@ static inline Anope::string CreateLogName(const Anope::string &file, time_t t =
 	return Anope::LogDir + "/" + file + "." + timestamp;
 }
 
+LogIndexBlock::LogIndexBlock(uint64_t off) : offset(off), length(0), reserved(0)
+{
+	memset(this->trigrams, 0, sizeof(this->trigrams));
+}
+
+void LogIndexBlock::Add(const char *text, size_t len)
+{
+	if (len < 3)
+		return;
+
+	const unsigned char *p = reinterpret_cast<const unsigned char *>(text);
+	uint32_t tri = (Anope::casemap_lower[p[0]] << 8) | Anope::casemap_lower[p[1]];
+	for (size_t i = 2; i < len; ++i)
+	{
+		tri = ((tri << 8) | Anope::casemap_lower[p[i]]) & 0xFFFFFF;
+		uint32_t bit = (tri * 2654435761U) >> 20;
+		this->trigrams[bit >> 3] |= 1 << (bit & 7);
+	}
+}
+
+bool LogIndexBlock::Contains(const LogIndexBlock &other) const
+{
+	for (unsigned i = 0; i < sizeof(this->trigrams); ++i)
+		if ((this->trigrams[i] & other.trigrams[i]) != other.trigrams[i])
+			return false;
+	return true;
+}
+
+bool LogIndexBlock::Empty() const
+{
+	for (unsigned i = 0; i < sizeof(this->trigrams); ++i)
+		if (this->trigrams[i])
+			return false;
+	return true;
+}
+
+Anope::string LogIndexBlock::GetIndexName(const Anope::string &logfile)
+{
+	return logfile + ".idx";
+}
+
 LogFile::LogFile(const Anope::string &name) : filename(name), stream(name.c_str(), std::ios_base::out | std::ios_base::app)
 {
+	if (!this->stream.is_open())
+		return;
+
+	/* Lines already in the file are not indexed, new blocks start after them */
+	struct stat st;
+	if (stat(name.c_str(), &st) == 0)
+		this->block.offset = st.st_size;
+
+	this->index.open(LogIndexBlock::GetIndexName(name).c_str(), std::ios_base::out | std::ios_base::app | std::ios_base::binary);
 }
 
 LogFile::~LogFile()
 {
 	this->stream.close();
+	this->index.close();
 }
 
 const Anope::string &LogFile::GetName() const
@@ -74,6 +133,332 @@ const Anope::string &LogFile::GetName() const
 	return this->filename;
 }
 
+void LogFile::Write(const Anope::string &line)
+{
+	this->stream << line << "\n";
+
+	if (!this->index.is_open())
+		return;
+
+	this->block.Add(line.c_str(), line.length());
+	this->block.length += line.length() + 1;
+
+	if (this->block.length >= LogIndexBlock::Size)
+	{
+		/* The file may have been truncated or written to by something else, in which case the block
+		 * would point at the wrong lines. Then it is left out, as the lines can still be found by a full scan.
+		 */
+		std::streamoff pos = this->stream.tellp();
+		if (pos >= 0 && static_cast<uint64_t>(pos) == this->block.offset + this->block.length)
+			this->index.write(reinterpret_cast<const char *>(&this->block), sizeof(this->block));
+		this->block = LogIndexBlock(pos >= 0 ? pos : 0);
+	}
+}
+
+/* A message waiting for the log writer */
+struct LogRecord
+{
+	/* The log target the file is for */
+	Anope::string target;
+	/* The name of the file, which changes each day */
+	Anope::string filename;
+	/* The line to write, or empty if the file should be removed instead, or closed if filename is also empty */
+	Anope::string line;
+
+	LogRecord(const Anope::string &t, const Anope::string &f, const Anope::string &l) : target(t), filename(f), line(l) { }
+};
+
+class LogWriterThread;
+/* The writer thread, NULL if messages are written directly */
+static LogWriterThread *writer = NULL;
+/* Protects everything below */
+static Condition writer_lock;
+/* Messages waiting for the writer thread */
+static std::vector<LogRecord> queued_records;
+/* The size of the lines in queued_records */
+static size_t queued_size = 0;
+/* options:logflushinterval, copied here as the writer can not read the configuration */
+static time_t flush_interval = 1;
+/* Messages dropped because the queue was full, in total and by file since it was last said so in the file */
+static unsigned long dropped = 0;
+static std::map<Anope::string, unsigned long> dropped_files;
+/* Errors from the writer thread, to be logged by the main thread */
+static std::vector<Anope::string> writer_errors;
+/* Whether the writer thread should exit once the queue is empty */
+static bool writer_stopping = false;
+
+/* The open log files by target, used only by the writer thread or, without one, the main thread.
+ * This is a pointer so a forked child can abandon the parent's files, see ForkChild.
+ */
+static std::map<Anope::string, LogFile *> *open_files = new std::map<Anope::string, LogFile *>();
+
+/* The targets messages have been queued for, used only by the main thread to close the files of removed targets */
+static std::set<Anope::string> queued_targets;
+
+static void WriteRecords(const std::vector<LogRecord> &records, std::vector<Anope::string> &errors)
+{
+	for (unsigned i = 0; i < records.size(); ++i)
+	{
+		const LogRecord &r = records[i];
+
+		if (r.filename.empty())
+		{
+			std::map<Anope::string, LogFile *>::iterator it = open_files->find(r.target);
+			if (it != open_files->end())
+			{
+				delete it->second;
+				open_files->erase(it);
+			}
+			continue;
+		}
+
+		if (r.line.empty())
+		{
+			unlink(r.filename.c_str());
+			unlink(LogIndexBlock::GetIndexName(r.filename).c_str());
+			continue;
+		}
+
+		LogFile *&lf = (*open_files)[r.target];
+		if (lf && lf->GetName() != r.filename)
+		{
+			/* The day has changed, rotate to the new file */
+			delete lf;
+			lf = NULL;
+		}
+		if (!lf)
+		{
+			/* A file which can not be opened is kept, so this is only reported once a day */
+			lf = new LogFile(r.filename);
+			if (!lf->stream.is_open())
+				errors.push_back("Unable to open logfile " + r.filename);
+		}
+
+		if (lf->stream.is_open())
+			lf->Write(r.line);
+	}
+}
+
+static void FlushFiles()
+{
+	for (std::map<Anope::string, LogFile *>::iterator it = open_files->begin(), it_end = open_files->end(); it != it_end; ++it)
+		if (it->second->stream.is_open())
+		{
+			/* The lines first, so the index does not cover lines which are not there */
+			it->second->stream.flush();
+			it->second->index.flush();
+		}
+}
+
+class LogWriterThread : public Thread
+{
+ public:
+	void Run() anope_override
+	{
+		std::vector<LogRecord> batch;
+		std::vector<Anope::string> errors;
+		time_t last_flush = time(NULL);
+
+		writer_lock.Lock();
+		for (;;)
+		{
+			if (queued_records.empty())
+			{
+				if (writer_stopping)
+					break;
+				writer_lock.Wait();
+				continue;
+			}
+
+			/* Take everything queued so far, the main thread keeps queueing into the other buffer */
+			batch.swap(queued_records);
+			queued_size = 0;
+			time_t interval = flush_interval;
+			writer_lock.Unlock();
+
+			WriteRecords(batch, errors);
+			batch.clear();
+
+			/* Flush once caught up, or at least every interval while messages keep coming */
+			time_t now = time(NULL);
+			bool flush = now - last_flush >= interval;
+
+			writer_lock.Lock();
+			if (queued_records.empty() || flush)
+			{
+				writer_lock.Unlock();
+				FlushFiles();
+				last_flush = now;
+				writer_lock.Lock();
+			}
+
+			if (!errors.empty())
+			{
+				writer_errors.insert(writer_errors.end(), errors.begin(), errors.end());
+				errors.clear();
+				this->Notify();
+			}
+		}
+		writer_lock.Unlock();
+
+		FlushFiles();
+	}
+
+	void OnNotify() anope_override
+	{
+		/* The writer is joined by LogWriter::Stop */
+		writer_lock.Lock();
+		std::vector<Anope::string> errors;
+		errors.swap(writer_errors);
+		writer_lock.Unlock();
+
+		for (unsigned i = 0; i < errors.size(); ++i)
+			Log() << errors[i];
+	}
+};
+
+#ifndef _WIN32
+static void ForkChild()
+{
+	/* The writer thread does not exist in the child, so it writes directly */
+	writer = NULL;
+
+	/* The writer may have been part way through updating the open files when the parent forked, and their
+	 * buffers hold lines the parent has yet to write. So leave them alone, without flushing them, and open
+	 * the files again as needed.
+	 */
+	open_files = new std::map<Anope::string, LogFile *>();
+}
+#endif
+
+static void QueueRecord(const Anope::string &target, const Anope::string &filename, const Anope::string &line)
+{
+	if (!filename.empty())
+		queued_targets.insert(target);
+
+	if (!writer)
+	{
+		std::vector<LogRecord> records;
+		std::vector<Anope::string> errors;
+		records.push_back(LogRecord(target, filename, line));
+		WriteRecords(records, errors);
+		FlushFiles();
+		for (unsigned i = 0; i < errors.size(); ++i)
+			Log() << errors[i];
+		return;
+	}
+
+	size_t limit = Config ? Config->LogBufferSize : 0;
+
+	writer_lock.Lock();
+
+	if (Config)
+		flush_interval = Config->LogFlushInterval;
+
+	if (limit && !line.empty() && queued_size + line.length() > limit)
+	{
+		++dropped;
+		++dropped_files[filename];
+		writer_lock.Unlock();
+		return;
+	}
+
+	std::map<Anope::string, unsigned long>::iterator it = dropped_files.find(filename);
+	if (it != dropped_files.end() && !line.empty())
+	{
+		Anope::string notice = GetTimeStamp() + " Dropped " + stringify(it->second) + " log messages as the log buffer was full";
+		queued_records.push_back(LogRecord(target, filename, notice));
+		queued_size += notice.length();
+		dropped_files.erase(it);
+	}
+
+	if (queued_records.empty())
+		writer_lock.Wakeup();
+	queued_records.push_back(LogRecord(target, filename, line));
+	queued_size += line.length();
+
+	writer_lock.Unlock();
+}
+
+void LogWriter::Start()
+{
+	if (writer)
+		return;
+
+	writer_stopping = false;
+	writer = new LogWriterThread();
+	try
+	{
+		writer->Start();
+	}
+	catch (const CoreException &ex)
+	{
+		delete writer;
+		writer = NULL;
+		Log() << "Unable to start the log writer, writing log files directly: " << ex.GetReason();
+		return;
+	}
+
+#ifndef _WIN32
+	static bool atfork = false;
+	if (!atfork)
+	{
+		pthread_atfork(NULL, NULL, ForkChild);
+		atfork = true;
+	}
+#endif
+}
+
+void LogWriter::Stop()
+{
+	if (!writer)
+		return;
+
+	writer_lock.Lock();
+	writer_stopping = true;
+	writer_lock.Wakeup();
+	writer_lock.Unlock();
+
+	writer->Join();
+	delete writer;
+	writer = NULL;
+
+	/* Report any errors the writer had left */
+	for (unsigned i = 0; i < writer_errors.size(); ++i)
+		Log() << writer_errors[i];
+	writer_errors.clear();
+}
+
+void LogWriter::CloseUnused()
+{
+	std::set<Anope::string> targets;
+	for (unsigned i = 0; Config && i < Config->LogInfos.size(); ++i)
+	{
+		const std::vector<Anope::string> &t = Config->LogInfos[i].targets;
+		for (unsigned j = 0; j < t.size(); ++j)
+			if (IsFileTarget(t[j]))
+				targets.insert(t[j]);
+	}
+
+	for (std::set<Anope::string>::iterator it = queued_targets.begin(); it != queued_targets.end();)
+	{
+		const Anope::string target = *it++;
+		if (targets.count(target))
+			continue;
+
+		queued_targets.erase(target);
+		QueueRecord(target, "", "");
+	}
+}
+
+unsigned long LogWriter::Dropped()
+{
+	writer_lock.Lock();
+	unsigned long d = dropped;
+	writer_lock.Unlock();
+	return d;
+}
+
 Log::Log(LogType t, const Anope::string &cat, BotInfo *b) : bi(b), u(NULL), nc(NULL), c(NULL), source(NULL), chan(NULL), ci(NULL), s(NULL), m(NULL), type(t), category(cat)
 {
 }
@@ -130,12 +515,26 @@ Log::~Log()
 
 	FOREACH_MOD(OnLog, (this));
 
-	if (Config)
+	/* Nothing to search for if no log block can have this type */
+	bool debug_type = Anope::Debug && (this->type == LOG_RAWIO || this->type == LOG_DEBUG);
+	if (Config && (debug_type || (Config->LogTypes & (1 << this->type))))
 		for (unsigned i = 0; i < Config->LogInfos.size(); ++i)
 			if (Config->LogInfos[i].HasType(this->type, this->category))
 				Config->LogInfos[i].ProcessMessage(this);
 }
 
+bool Log::IsEnabled(LogType type)
+{
+	if (type < LOG_RAWIO)
+		return true;
+
+	/* Written to the terminal and accepted by every log block in debug mode */
+	if (Anope::Debug && type <= LOG_DEBUG + Anope::Debug - 1)
+		return true;
+
+	return !Config || (Config->LogTypes & (1 << type));
+}
+
 Anope::string Log::FormatSource() const
 {
 	if (u)
@@ -233,9 +632,6 @@ LogInfo::LogInfo(int la, bool rio, bool ldebug) : bot(NULL), last_day(0), log_ag
 
 LogInfo::~LogInfo()
 {
-	for (unsigned i = 0; i < this->logfiles.size(); ++i)
-		delete this->logfiles[i];
-	this->logfiles.clear();
 }
 
 bool LogInfo::HasType(LogType ltype, const Anope::string &type) const
@@ -299,27 +695,43 @@ bool LogInfo::HasType(LogType ltype, const Anope::string &type) const
 	return false;
 }
 
+unsigned LogInfo::GetTypes() const
+{
+	unsigned types = 1 << LOG_TERMINAL;
+
+	const std::vector<Anope::string> *lists[] = { &this->admin, &this->override, &this->commands, &this->servers, &this->channels, &this->users, &this->normal };
+	const LogType list_types[] = { LOG_ADMIN, LOG_OVERRIDE, LOG_COMMAND, LOG_SERVER, LOG_CHANNEL, LOG_USER, LOG_NORMAL };
+	for (unsigned i = 0; i < sizeof(lists) / sizeof(*lists); ++i)
+		for (unsigned j = 0; j < lists[i]->size(); ++j)
+			/* A list of only inverted categories can never match */
+			if (lists[i]->at(j)[0] != '~')
+			{
+				types |= 1 << list_types[i];
+				if (list_types[i] == LOG_NORMAL)
+					types |= 1 << LOG_MODULE;
+				break;
+			}
+
+	if (this->raw_io || this->debug)
+		types |= 1 << LOG_RAWIO;
+	if (this->debug)
+		types |= 1 << LOG_DEBUG;
+
+	return types;
+}
+
 void LogInfo::OpenLogFiles()
 {
-	for (unsigned i = 0; i < this->logfiles.size(); ++i)
-		delete this->logfiles[i];
 	this->logfiles.clear();
 
 	for (unsigned i = 0; i < this->targets.size(); ++i)
 	{
 		const Anope::string &target = this->targets[i];
 
-		if (target.empty() || target[0] == '#' || target == "globops" || target.find(":") != Anope::string::npos)
+		if (!IsFileTarget(target))
 			continue;
 
-		LogFile *lf = new LogFile(CreateLogName(target));
-		if (!lf->stream.is_open())
-		{
-			Log() << "Unable to open logfile " << lf->GetName();
-			delete lf;
-		}
-		else
-			this->logfiles.push_back(lf);
+		this->logfiles.push_back(std::make_pair(target, CreateLogName(target)));
 	}
 }
 
@@ -389,26 +801,19 @@ void LogInfo::ProcessMessage(const Log *l)
 		this->last_day = tm->tm_mday;
 		this->OpenLogFiles();
 
+		/* The writer opens the new files, and removes the old ones, in order with the messages */
 		if (this->log_age)
-			for (unsigned i = 0; i < this->targets.size(); ++i)
+			for (unsigned i = 0; i < this->logfiles.size(); ++i)
 			{
-				const Anope::string &target = this->targets[i];
-
-				if (target.empty() || target[0] == '#' || target == "globops" || target.find(":") != Anope::string::npos)
-					continue;
-
-				Anope::string oldlog = CreateLogName(target, Anope::CurTime - 86400 * this->log_age);
-				if (IsFile(oldlog))
-				{
-					unlink(oldlog.c_str());
-					Log(LOG_DEBUG) << "Deleted old logfile " << oldlog;
-				}
+				const Anope::string &target = this->logfiles[i].first;
+				QueueRecord(target, CreateLogName(target, Anope::CurTime - 86400 * this->log_age), "");
 			}
 	}
 
-	for (unsigned i = 0; i < this->logfiles.size(); ++i)
+	if (!this->logfiles.empty())
 	{
-		LogFile *lf = this->logfiles[i];
-		lf->stream << GetTimeStamp() << " " << buffer << std::endl;
+		const Anope::string &line = GetTimeStamp() + " " + buffer;
+		for (unsigned i = 0; i < this->logfiles.size(); ++i)
+			QueueRecord(this->logfiles[i].first, this->logfiles[i].second, line);
 	}
 }
@@ -18,6 +18,7 @@
 
 #ifndef _WIN32
 #include <limits.h>
+#include <time.h>
 #else
 #include <process.h>
 #endif
@@ -38,6 +39,18 @@ static Anope::string BinaryDir;       /* Full path to services bin directory */
 
 time_t Anope::StartTime = time(NULL);
 time_t Anope::CurTime = time(NULL);
+uint64_t Anope::CurTimeMS = Anope::MicroTime() / 1000;
+
+unsigned long LoopStats::Histogram[LOOP_SIZE][LoopStats::BUCKETS];
+uint64_t LoopStats::Max[LOOP_SIZE];
+uint64_t LoopStats::Total[LOOP_SIZE];
+unsigned long LoopStats::Iterations = 0;
+
+/* The phase of the main loop we are in, when it was entered, and the time spent in each phase this iteration */
+static LoopPhase loop_phase = LOOP_WAIT;
+static uint64_t loop_phase_start = 0, loop_phase_time[LOOP_SIZE];
+
+static const char *const LoopPhaseNames[] = { "wait", "sockets", "timers", "modes", "busy" };
 
 int Anope::CurrentUplink = -1;
 
@@ -142,6 +155,7 @@ int main(int ac, char **av, char **envp)
 	catch (const CoreException &ex)
 	{
 		Log() << ex.GetReason();
+		LogWriter::Stop();
 		return -1;
 	}
 
@@ -155,29 +169,34 @@ int main(int ac, char **av, char **envp)
 	}
 
 	/* Set up timers */
-	time_t last_check = Anope::CurTime;
 	UpdateTimer updateTimer(Config->GetBlock("options")->Get<time_t>("updatetimeout", "5m"));
 	ExpireTimer expireTimer(Config->GetBlock("options")->Get<time_t>("expiretimeout", "30m"));
+	ModuleManager::SetHookProfileLog(Config->GetBlock("options")->Get<time_t>("hookprofilelog"));
 
 	/*** Main loop. ***/
 	while (!Anope::Quitting)
 	{
-		Log(LOG_DEBUG_2) << "Top of main loop";
+		LOG_IF_ENABLED(LOG_DEBUG_2) << "Top of main loop";
 
 		/* Process timers */
-		if (Anope::CurTime - last_check >= Config->TimeoutCheck)
-		{
-			TimerManager::TickTimers(Anope::CurTime);
-			last_check = Anope::CurTime;
-		}
+		LoopStats::Enter(LOOP_TIMERS);
+		TimerManager::TickTimers(Anope::CurTime);
 
-		/* Process the socket engine */
+		/* Process the socket engine, this waits until the next timer is due at most */
+		LoopStats::Enter(LOOP_WAIT);
 		SocketEngine::Process();
 
+		/* Run the work queued during this iteration, such as sending stacked modes */
+		DeferredTask::RunQueued();
+
 		if (Anope::Signal)
 			Anope::HandleSignal();
+
+		LoopStats::EndIteration();
 	}
 
+	ModuleManager::SetHookProfileLog(0);
+
 	if (Anope::Restarting)
 	{
 		FOREACH_MOD(OnRestart, ());
@@ -194,6 +213,8 @@ int main(int ac, char **av, char **envp)
 	delete UplinkSock;
 
 	ModuleManager::UnloadAll();
+	/* The writer thread is a socket, so stop it first. Anything logged from here on is written directly */
+	LogWriter::Stop();
 	SocketEngine::Shutdown();
 	for (Module *m; (m = ModuleManager::FindFirstOf(PROTOCOL)) != NULL;)
 		ModuleManager::UnloadModule(m, NULL);
@@ -216,3 +237,81 @@ int main(int ac, char **av, char **envp)
 
 	return Anope::ReturnValue;
 }
+
+void Anope::UpdateTime()
+{
+	Anope::CurTime = time(NULL);
+	Anope::CurTimeMS = Anope::MicroTime() / 1000;
+}
+
+uint64_t Anope::MicroTime()
+{
+#ifdef _WIN32
+	static LARGE_INTEGER frequency;
+	if (!frequency.QuadPart)
+		QueryPerformanceFrequency(&frequency);
+
+	LARGE_INTEGER count;
+	QueryPerformanceCounter(&count);
+	return count.QuadPart / frequency.QuadPart * 1000000 + count.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart;
+#else
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+LoopPhase LoopStats::Enter(LoopPhase phase)
+{
+	uint64_t now = Anope::MicroTime();
+	if (loop_phase_start)
+		loop_phase_time[loop_phase] += now - loop_phase_start;
+	loop_phase_start = now;
+
+	LoopPhase old = loop_phase;
+	loop_phase = phase;
+	return old;
+}
+
+void LoopStats::EndIteration()
+{
+	Enter(loop_phase);
+	loop_phase_time[LOOP_BUSY] = loop_phase_time[LOOP_SOCKETS] + loop_phase_time[LOOP_TIMERS] + loop_phase_time[LOOP_MODES];
+
+	for (unsigned i = 0; i < LOOP_SIZE; ++i)
+	{
+		uint64_t t = loop_phase_time[i];
+
+		unsigned bucket = 0;
+		while (bucket < BUCKETS - 1 && t >> bucket)
+			++bucket;
+
+		++Histogram[i][bucket];
+		Total[i] += t;
+		if (t > Max[i])
+			Max[i] = t;
+
+		loop_phase_time[i] = 0;
+	}
+
+	++Iterations;
+}
+
+uint64_t LoopStats::Percentile(LoopPhase phase, unsigned percent)
+{
+	unsigned long wanted = Iterations * percent / 100, seen = 0;
+
+	for (unsigned i = 0; i < BUCKETS - 1; ++i)
+	{
+		seen += Histogram[phase][i];
+		if (seen > wanted)
+			return static_cast<uint64_t>(1) << i;
+	}
+
+	return Max[phase];
+}
+
+const char *LoopStats::GetPhaseName(LoopPhase phase)
+{
+	return LoopPhaseNames[phase];
+}
@@ -139,16 +139,8 @@ void Join::SJoin(MessageSource &source, const Anope::string &chan, time_t ts, co
 		/* Add the user to the channel */
 		c->JoinUser(u, keep_their_modes ? &status : NULL);
 
-		/* Check if the user is allowed to join */
-		if (c->CheckKick(u))
-			continue;
-
-		/* Set whatever modes the user should have, and remove any that
-		 * they aren't allowed to have (secureops etc).
-		 */
-		c->SetCorrectModes(u, true);
-
-		FOREACH_MOD(OnJoinChannel, (u, c));
+		/* Kick them if they aren't allowed in and set their modes, this is deferred if we are bursting */
+		c->CheckJoin(u);
 	}
 
 	/* Channel is done syncing */
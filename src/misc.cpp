@@ -405,106 +405,440 @@ Anope::string Anope::Expires(time_t expires, const NickCore *nc)
 
 bool Anope::Match(const Anope::string &str, const Anope::string &mask, bool case_sensitive, bool use_regex)
 {
-	size_t s = 0, m = 0, str_len = str.length(), mask_len = mask.length();
+	size_t mask_len = mask.length();
 
 	if (use_regex && mask_len >= 2 && mask[0] == '/' && mask[mask.length() - 1] == '/')
 	{
-		Anope::string stripped_mask = mask.substr(1, mask_len - 2);
-		// This is often called with the same mask multiple times in a row, so cache it
-		static Regex *r = NULL;
+		// This is often called with the same masks over and over, so they are cached
+		Regex *r = RegexCache::Get(Config->RegexEngine, mask.substr(1, mask_len - 2));
+		if (r != NULL && r->Matches(str))
+			return true;
+
+		// Fall through to non regex match
+	}
+
+	return Glob::Match(str, mask, case_sensitive);
+}
+
+namespace
+{
+	/* Picks the character of a segment to search for, preferring one which can be found with
+	 * a single memchr. lower is the casemap, or NULL if the match is case sensitive.
+	 */
+	size_t ChooseAnchor(const char *seg, size_t len, const unsigned char *lower, unsigned char search[2], unsigned &nsearch)
+	{
+		size_t anchor = Anope::string::npos;
+		nsearch = 0;
 
-		if (r == NULL || r->GetExpression() != stripped_mask)
+		for (size_t i = 0; i < len; ++i)
 		{
-			ServiceReference<RegexProvider> provider("Regex", Config->GetBlock("options")->Get<const Anope::string>("regexengine"));
-			if (provider)
+			if (seg[i] == '?')
+				continue;
+
+			unsigned char c = seg[i], cand[2] = { c, c };
+			unsigned n = 1;
+			if (lower != NULL)
+				n = Anope::FoldedFrom(lower[c], cand);
+
+			if (anchor == Anope::string::npos || (n && (!nsearch || n < nsearch)))
 			{
-				try
-				{
-					delete r;
-					r = NULL;
-					// This may throw
-					r = provider->Compile(stripped_mask);
-				}
-				catch (const RegexException &ex)
+				anchor = i;
+				nsearch = n;
+				search[0] = cand[0];
+				search[1] = cand[1];
+				if (n == 1)
+					break;
+			}
+		}
+
+		return anchor;
+	}
+
+	/* Checks whether a segment matches the start of str. folded is the segment case folded, or NULL to
+	 * fold it here.
+	 */
+	inline bool SegmentAt(const char *str, const char *seg, const char *folded, size_t len, const unsigned char *lower)
+	{
+		for (size_t i = 0; i < len; ++i)
+		{
+			if (seg[i] == '?')
+				continue;
+
+			unsigned char c = str[i];
+			if (lower == NULL)
+			{
+				if (static_cast<unsigned char>(seg[i]) != c)
+					return false;
+			}
+			else
+			{
+				unsigned char f = folded ? folded[i] : lower[static_cast<unsigned char>(seg[i])];
+				if (lower[c] != f)
+					return false;
+			}
+		}
+
+		return true;
+	}
+
+	/* Finds the leftmost position in str[begin, end) at which a segment matches. The anchor character
+	 * is searched for with memchr if it can only be one or two characters, else one at a time.
+	 */
+	size_t SegmentFind(const char *str, size_t begin, size_t end, const char *seg, const char *folded, size_t len, size_t anchor, const unsigned char search[2], unsigned nsearch, const unsigned char *lower)
+	{
+		if (end - begin < len)
+			return Anope::string::npos;
+		else if (anchor == Anope::string::npos)
+			return begin;
+
+		const char *base = str + anchor, *next[2] = { NULL, NULL };
+		size_t last = end - len;
+
+		for (size_t p = begin; p <= last; ++p)
+		{
+			if (nsearch)
+			{
+				/* Each character's next position is only searched for again once it is passed */
+				const char *hit = NULL;
+				for (unsigned i = 0; i < nsearch; ++i)
 				{
-					Log(LOG_DEBUG) << ex.GetReason();
+					if (next[i] != NULL && next[i] < base + p)
+						next[i] = NULL;
+					if (next[i] == NULL)
+					{
+						next[i] = static_cast<const char *>(memchr(base + p, search[i], last - p + 1));
+						if (next[i] == NULL)
+							next[i] = base + last + 1;
+					}
+					if (hit == NULL || next[i] < hit)
+						hit = next[i];
 				}
+
+				if (hit > base + last)
+					return Anope::string::npos;
+				p = hit - base;
 			}
 			else
 			{
-				delete r;
-				r = NULL;
+				unsigned char c = base[p], want = folded ? folded[anchor] : lower[static_cast<unsigned char>(seg[anchor])];
+				if (lower[c] != want)
+					continue;
 			}
+
+			if (SegmentAt(str + p, seg, folded, len, lower))
+				return p;
 		}
 
-		if (r != NULL && r->Matches(str))
-			return true;
+		return Anope::string::npos;
+	}
+}
 
-		// Fall through to non regex match
+Anope::Glob::Glob(const Anope::string &m, bool cs) : mask(m), case_sensitive(cs), wildcard(false), generation(Anope::casemap_generation)
+{
+	size_t first = mask.find('*');
+	if (first == Anope::string::npos)
+	{
+		prefix.raw = mask;
+		this->Fold(prefix);
+		return;
 	}
 
-	while (s < str_len && m < mask_len && mask[m] != '*')
+	size_t last = mask.rfind('*');
+	wildcard = true;
+
+	prefix.raw = mask.substr(0, first);
+	this->Fold(prefix);
+	suffix.raw = mask.substr(last + 1);
+	this->Fold(suffix);
+
+	for (size_t i = first + 1; i < last;)
 	{
-		char string = str[s], wild = mask[m];
-		if (case_sensitive)
+		size_t j = mask.find('*', i);
+		if (j > i)
 		{
-			if (wild != string && wild != '?')
-				return false;
+			Segment seg;
+			seg.raw = mask.substr(i, j - i);
+			this->Fold(seg);
+			middle.push_back(seg);
 		}
-		else
+		i = j + 1;
+	}
+}
+
+void Anope::Glob::Fold(Segment &seg) const
+{
+	const unsigned char *lower = case_sensitive ? NULL : Anope::casemap_lower;
+
+	seg.folded = seg.raw;
+	if (lower != NULL)
+		for (size_t i = 0; i < seg.folded.length(); ++i)
+			seg.folded[i] = lower[static_cast<unsigned char>(seg.folded[i])];
+
+	seg.anchor = ChooseAnchor(seg.raw.c_str(), seg.raw.length(), lower, seg.search, seg.nsearch);
+}
+
+const Anope::string &Anope::Glob::GetMask() const
+{
+	return this->mask;
+}
+
+bool Anope::Glob::Matches(const Anope::string &str) const
+{
+	const unsigned char *lower = NULL;
+	if (!case_sensitive)
+	{
+		lower = Anope::casemap_lower;
+
+		if (generation != Anope::casemap_generation)
 		{
-			if (Anope::tolower(wild) != Anope::tolower(string) && wild != '?')
-				return false;
+			this->Fold(prefix);
+			this->Fold(suffix);
+			for (unsigned i = 0; i < middle.size(); ++i)
+				this->Fold(middle[i]);
+			generation = Anope::casemap_generation;
 		}
+	}
+
+	const char *s = str.c_str();
+	size_t len = str.length(), plen = prefix.raw.length(), slen = suffix.raw.length();
 
-		++m;
-		++s;
+	if (!wildcard)
+		return len == plen && SegmentAt(s, prefix.raw.c_str(), prefix.folded.c_str(), len, lower);
+
+	if (len < plen + slen)
+		return false;
+
+	size_t begin = plen, end = len - slen;
+	if (!SegmentAt(s, prefix.raw.c_str(), prefix.folded.c_str(), plen, lower) || !SegmentAt(s + end, suffix.raw.c_str(), suffix.folded.c_str(), slen, lower))
+		return false;
+
+	for (unsigned i = 0; i < middle.size(); ++i)
+	{
+		const Segment &seg = middle[i];
+		size_t p = SegmentFind(s, begin, end, seg.raw.c_str(), seg.folded.c_str(), seg.raw.length(), seg.anchor, seg.search, seg.nsearch, lower);
+		if (p == Anope::string::npos)
+			return false;
+		begin = p + seg.raw.length();
 	}
 
-	size_t sp = Anope::string::npos, mp = Anope::string::npos;
-	while (s < str_len)
+	return true;
+}
+
+bool Anope::Glob::Match(const Anope::string &str, const Anope::string &mask, bool case_sensitive)
+{
+	const unsigned char *lower = case_sensitive ? NULL : Anope::casemap_lower;
+	const char *s = str.c_str(), *m = mask.c_str();
+	size_t len = str.length(), mlen = mask.length();
+
+	/* Compare the text before the first * while looking for it, most strings fail here */
+	size_t first = 0;
+	for (; first < mlen && m[first] != '*'; ++first)
+		if (first >= len || !SegmentAt(s + first, m + first, NULL, 1, lower))
+			return false;
+
+	if (first == mlen)
+		return len == mlen;
+
+	size_t last = mask.rfind('*'), slen = mlen - last - 1;
+	if (len < first + slen)
+		return false;
+
+	size_t begin = first, end = len - slen;
+	if (!SegmentAt(s + end, m + last + 1, NULL, slen, lower))
+		return false;
+
+	for (size_t i = first + 1; i < last;)
 	{
-		char string = str[s], wild = mask[m];
-		if (wild == '*')
+		size_t j = mask.find('*', i);
+		if (j > i)
 		{
-			if (++m == mask_len)
-				return 1;
-
-			mp = m;
-			sp = s + 1;
+			unsigned char search[2];
+			unsigned nsearch;
+			size_t anchor = ChooseAnchor(m + i, j - i, lower, search, nsearch);
+			size_t p = SegmentFind(s, begin, end, m + i, NULL, j - i, anchor, search, nsearch, lower);
+			if (p == Anope::string::npos)
+				return false;
+			begin = p + j - i;
 		}
-		else if (case_sensitive)
+		i = j + 1;
+	}
+
+	return true;
+}
+
+/* The most regexes kept in the regex cache */
+static const unsigned REGEX_CACHE_SIZE = 256;
+
+namespace
+{
+	struct CachedRegex
+	{
+		Anope::string key;
+		Anope::string engine;
+		Regex *regex;
+	};
+
+	typedef std::list<CachedRegex> regex_lru;
+	/* Most recently used first */
+	regex_lru RegexLRU;
+	TR1NS::unordered_map<Anope::string, regex_lru::iterator, Anope::hash_cs> RegexCacheMap;
+}
+
+std::set<Anope::CompiledMask *> RegexCache::Masks;
+
+Regex *RegexCache::Get(const Anope::string &engine, const Anope::string &expression)
+{
+	if (engine.empty())
+		return NULL;
+
+	Anope::string key = engine + " " + expression;
+
+	TR1NS::unordered_map<Anope::string, regex_lru::iterator, Anope::hash_cs>::iterator it = RegexCacheMap.find(key);
+	if (it != RegexCacheMap.end())
+	{
+		RegexLRU.splice(RegexLRU.begin(), RegexLRU, it->second);
+		return it->second->regex;
+	}
+
+	ServiceReference<RegexProvider> provider("Regex", engine);
+	if (!provider)
+		return NULL;
+
+	Regex *r = NULL;
+	try
+	{
+		r = provider->Compile(expression);
+	}
+	catch (const RegexException &ex)
+	{
+		Log(LOG_DEBUG) << ex.GetReason();
+	}
+
+	/* Failures are cached too, so they are not recompiled every time */
+	CachedRegex cr;
+	cr.key = key;
+	cr.engine = engine;
+	cr.regex = r;
+	RegexLRU.push_front(cr);
+	RegexCacheMap[key] = RegexLRU.begin();
+
+	if (RegexLRU.size() > REGEX_CACHE_SIZE)
+	{
+		CachedRegex &old = RegexLRU.back();
+		RegexCacheMap.erase(old.key);
+		delete old.regex;
+		RegexLRU.pop_back();
+	}
+
+	return r;
+}
+
+void RegexCache::Flush()
+{
+	for (regex_lru::iterator it = RegexLRU.begin(); it != RegexLRU.end(); ++it)
+		delete it->regex;
+	RegexLRU.clear();
+	RegexCacheMap.clear();
+
+	for (std::set<Anope::CompiledMask *>::iterator it = Masks.begin(); it != Masks.end(); ++it)
+		(*it)->Reset();
+}
+
+void RegexCache::Flush(const Anope::string &engine)
+{
+	for (regex_lru::iterator it = RegexLRU.begin(); it != RegexLRU.end();)
+	{
+		if (it->engine != engine)
 		{
-			if (wild == string || wild == '?')
-			{
-				++m;
-				++s;
-			}
-			else
-			{
-				m = mp;
-				s = sp++;
-			}
+			++it;
+			continue;
 		}
-		else
+
+		RegexCacheMap.erase(it->key);
+		delete it->regex;
+		it = RegexLRU.erase(it);
+	}
+
+	for (std::set<Anope::CompiledMask *>::iterator it = Masks.begin(); it != Masks.end(); ++it)
+		if ((*it)->engine == engine)
+			(*it)->Reset();
+}
+
+RegexProvider::~RegexProvider()
+{
+	RegexCache::Flush(this->name);
+}
+
+Anope::CompiledMask::CompiledMask(const Anope::string &m, bool r) : mask(m), use_regex(r && m.length() >= 2 && m[0] == '/' && m[m.length() - 1] == '/'), glob(m), regex(NULL), compiled(false)
+{
+	RegexCache::Masks.insert(this);
+}
+
+Anope::CompiledMask::CompiledMask(const CompiledMask &other) : mask(other.mask), use_regex(other.use_regex), glob(other.glob), regex(NULL), compiled(false)
+{
+	RegexCache::Masks.insert(this);
+}
+
+Anope::CompiledMask::~CompiledMask()
+{
+	delete this->regex;
+	RegexCache::Masks.erase(this);
+}
+
+Anope::CompiledMask &Anope::CompiledMask::operator=(const CompiledMask &other)
+{
+	if (this != &other)
+	{
+		this->Reset();
+		this->mask = other.mask;
+		this->use_regex = other.use_regex;
+		this->glob = other.glob;
+	}
+	return *this;
+}
+
+void Anope::CompiledMask::Reset() const
+{
+	delete this->regex;
+	this->regex = NULL;
+	this->engine.clear();
+	this->compiled = false;
+}
+
+const Anope::string &Anope::CompiledMask::GetMask() const
+{
+	return this->mask;
+}
+
+bool Anope::CompiledMask::Matches(const Anope::string &str, bool case_sensitive) const
+{
+	if (this->use_regex)
+	{
+		if (!this->compiled)
 		{
-			if (Anope::tolower(wild) == Anope::tolower(string) || wild == '?')
-			{
-				++m;
-				++s;
-			}
-			else
+			ServiceReference<RegexProvider> provider("Regex", Config->RegexEngine);
+			if (provider)
 			{
-				m = mp;
-				s = sp++;
+				this->engine = Config->RegexEngine;
+				this->compiled = true;
+				try
+				{
+					this->regex = provider->Compile(this->mask.substr(1, this->mask.length() - 2));
+				}
+				catch (const RegexException &ex)
+				{
+					Log(LOG_DEBUG) << ex.GetReason();
+				}
 			}
 		}
-	}
 
-	if (m < mask_len && mask[m] == '*')
-		++m;
+		if (this->regex != NULL && this->regex->Matches(str))
+			return true;
+	}
 
-	return m == mask_len;
+	if (case_sensitive)
+		return Glob::Match(str, this->mask, true);
+	return this->glob.Matches(str);
 }
 
 void Anope::Encrypt(const Anope::string &src, Anope::string &dest)
@@ -13,12 +13,7 @@
 #include "protocol.h"
 #include "channels.h"
 #include "uplink.h"
-
-struct StackerInfo;
-
-/* List of pairs of user/channels and their stacker info */
-static std::map<User *, StackerInfo *> UserStackerObjects;
-static std::map<Channel *, StackerInfo *> ChannelStackerObjects;
+#include "servers.h"
 
 /* Array of all modes Anope knows about.*/
 static std::vector<ChannelMode *> ChannelModes;
@@ -41,10 +36,12 @@ unsigned ModeManager::GenericChannelModes = 0, ModeManager::GenericUserModes = 0
 
 struct StackerInfo
 {
+	typedef std::vector<std::pair<Mode *, Anope::string> > ModeList;
+
 	/* Modes to be added */
-	std::list<std::pair<Mode *, Anope::string> > AddModes;
+	ModeList AddModes;
 	/* Modes to be deleted */
-	std::list<std::pair<Mode *, Anope::string> > DelModes;
+	ModeList DelModes;
 	/* Bot this is sent from */
 	BotInfo *bi;
 
@@ -56,8 +53,96 @@ struct StackerInfo
 	 * @param param The param for the mode
 	 */
 	void AddMode(Mode *mode, bool set, const Anope::string &param);
+
+	/** Remove every stacked change of a mode
+	 * @param mode The mode
+	 */
+	void DelMode(Mode *mode);
+
+	/** Forget the stacked modes, keeping the memory used for them
+	 */
+	void Clear()
+	{
+		AddModes.clear();
+		DelModes.clear();
+		bi = NULL;
+	}
 };
 
+/* The users or channels which have modes stacked, in the order they were first
+ * stacked. Their stacker info is pooled, and cleared rather than freed once the
+ * modes have been sent so it can be reused without allocating.
+ */
+template<typename T>
+struct Stacker
+{
+	/* Position of each object in objects */
+	TR1NS::unordered_map<T *, unsigned> positions;
+	/* Objects with modes stacked, NULL if the object has been removed */
+	std::vector<T *> objects;
+	/* Stacker info for each object, followed by unused info */
+	std::vector<StackerInfo *> infos;
+
+	~Stacker()
+	{
+		for (unsigned i = 0; i < infos.size(); ++i)
+			delete infos[i];
+	}
+
+	/** Get the stacker info for an object, if one doesn't exist it is created
+	 * @param o The user or channel
+	 * @return The stacker info
+	 */
+	StackerInfo *Get(T *o)
+	{
+		std::pair<typename TR1NS::unordered_map<T *, unsigned>::iterator, bool> it = positions.insert(std::make_pair(o, objects.size()));
+		if (!it.second)
+			return infos[it.first->second];
+
+		objects.push_back(o);
+		if (infos.size() < objects.size())
+			infos.push_back(new StackerInfo());
+		return infos[objects.size() - 1];
+	}
+
+	/** Find the stacker info for an object
+	 * @param o The user or channel
+	 * @return The stacker info, or NULL if the object has no modes stacked
+	 */
+	StackerInfo *Find(T *o) const
+	{
+		typename TR1NS::unordered_map<T *, unsigned>::const_iterator it = positions.find(o);
+		return it != positions.end() ? infos[it->second] : NULL;
+	}
+
+	/** Remove an object, whose modes have been sent
+	 * @param o The user or channel
+	 */
+	void Remove(T *o)
+	{
+		typename TR1NS::unordered_map<T *, unsigned>::iterator it = positions.find(o);
+		if (it == positions.end())
+			return;
+
+		objects[it->second] = NULL;
+		infos[it->second]->Clear();
+		positions.erase(it);
+	}
+
+	/** Remove every object, whose modes have been sent
+	 */
+	void Clear()
+	{
+		for (unsigned i = 0; i < objects.size(); ++i)
+			infos[i]->Clear();
+		objects.clear();
+		positions.clear();
+	}
+};
+
+static Stacker<User> UserStacker;
+static Stacker<Channel> ChannelStacker;
+
 ChannelStatus::ChannelStatus()
 {
 }
@@ -263,7 +348,7 @@ void StackerInfo::AddMode(Mode *mode, bool set, const Anope::string &param)
 {
 	bool is_param = mode->type == MODE_PARAM;
 
-	std::list<std::pair<Mode *, Anope::string> > *list, *otherlist;
+	ModeList *list, *otherlist;
 	if (set)
 	{
 		list = &AddModes;
@@ -276,7 +361,7 @@ void StackerInfo::AddMode(Mode *mode, bool set, const Anope::string &param)
 	}
 
 	/* Loop through the list and find if this mode is already on here */
-	std::list<std::pair<Mode *, Anope::string > >::iterator it, it_end;
+	ModeList::iterator it, it_end;
 	for (it = list->begin(), it_end = list->end(); it != it_end; ++it)
 	{
 		/* The param must match too (can have multiple status or list modes), but
@@ -310,85 +395,132 @@ void StackerInfo::AddMode(Mode *mode, bool set, const Anope::string &param)
 	list->push_back(std::make_pair(mode, param));
 }
 
-static class ModePipe : public Pipe
+/** Erase the entries of a list which change a mode
+ * @param list The list
+ * @param mode The mode
+ */
+static void EraseMode(StackerInfo::ModeList &list, Mode *mode)
+{
+	unsigned j = 0;
+	for (unsigned i = 0; i < list.size(); ++i)
+		if (list[i].first != mode)
+		{
+			if (i != j)
+				list[j] = list[i];
+			++j;
+		}
+	list.resize(j);
+}
+
+void StackerInfo::DelMode(Mode *mode)
+{
+	EraseMode(AddModes, mode);
+	EraseMode(DelModes, mode);
+}
+
+static class ModeTask : public DeferredTask
 {
  public:
-	void OnNotify()
+	void Run() anope_override
 	{
+		LoopPhase phase = LoopStats::Enter(LOOP_MODES);
 		ModeManager::ProcessModes();
+		LoopStats::Enter(phase);
 	}
-} *modePipe;
+} *modeTask;
 
-/** Get the stacker info for an item, if one doesn't exist it is created
- * @param Item The user/channel etc
- * @return The stacker info
+/** Get how long the modes and params of one line of modes for a target can be
+ * @param bi The bot sending the modes, or NULL if they are sent from services' server
+ * @param target The name or UID of the target, whichever is longer
+ * @return The room for the modes and their params
  */
-template<typename List, typename Object>
-static StackerInfo *GetInfo(List &l, Object *o)
+static size_t GetModeRoom(BotInfo *bi, size_t target)
 {
-	typename List::const_iterator it = l.find(o);
-	if (it != l.end())
-		return it->second;
+	/* The line is ":source COMMAND target timestamp modes\r\n", where the command and
+	 * timestamp depend on the protocol. The longest command is plexus' "ENCAP * SVSMODE"
+	 * for user modes, longer than unreal's "SVS2MODE" and the "SVSMODE", "FMODE" and
+	 * "MODE" of the others, and the timestamp is at most 20 digits.
+	 */
+	static const size_t command = sizeof("ENCAP * SVSMODE") - 1;
+	size_t source = bi ? std::max(bi->nick.length(), bi->GetUID().length()) : std::max(Me->GetName().length(), Me->GetSID().length());
+	size_t overhead = 1 + source + 1 + command + 1 + target + 1 + 20 + 1 + 2;
 
-	StackerInfo *s = new StackerInfo();
-	l[o] = s;
-	return s;
+	return IRCD->MaxLine > overhead ? IRCD->MaxLine - overhead : 0;
 }
 
-/** Build a list of mode strings to send to the IRCd from the mode stacker
- * @param info The stacker info for a channel or user
- * @return a list of strings
+/* The modes of the line being built, and their params */
+static Anope::string mode_buf, param_buf;
+
+/** Send the line being built and start a new one
+ * @param bi The bot sending the modes
+ * @param target The channel or user
  */
-static std::list<Anope::string> BuildModeStrings(StackerInfo *info)
+template<typename T>
+static void SendModeLine(BotInfo *bi, T *target)
 {
-	std::list<Anope::string> ret;
-	std::list<std::pair<Mode *, Anope::string> >::iterator it, it_end;
-	Anope::string buf = "+", parambuf;
-	unsigned NModes = 0;
-
-	for (it = info->AddModes.begin(), it_end = info->AddModes.end(); it != it_end; ++it)
-	{
-		if (++NModes > IRCD->MaxModes || (buf.length() + parambuf.length() > IRCD->MaxLine - 100)) // Leave room for command, channel, etc
-		{
-			ret.push_back(buf + parambuf);
-			buf = "+";
-			parambuf.clear();
-			NModes = 1;
-		}
-
-		buf += it->first->mchar;
+	mode_buf += param_buf;
+	IRCD->SendModeInternal(bi, target, mode_buf);
+	mode_buf.clear();
+	param_buf.clear();
+}
 
-		if (!it->second.empty())
-			parambuf += " " + it->second;
-	}
+/** Send the modes stacked for a channel or user, in as few lines as the IRCd allows
+ * @param info The stacker info for the channel or user
+ * @param target The channel or user
+ * @param target_len The length of the target's name or UID, whichever is longer
+ */
+template<typename T>
+static void SendModeStrings(const StackerInfo *info, T *target, size_t target_len)
+{
+	size_t room = GetModeRoom(info->bi, target_len);
+	char sign_used = 0;
+	unsigned nmodes = 0;
 
-	if (buf[buf.length() - 1] == '+')
-		buf.erase(buf.length() - 1);
+	mode_buf.clear();
+	param_buf.clear();
 
-	buf += "-";
-	for (it = info->DelModes.begin(), it_end = info->DelModes.end(); it != it_end; ++it)
+	for (int set = 1; set >= 0; --set)
 	{
-		if (++NModes > IRCD->MaxModes || (buf.length() + parambuf.length() > IRCD->MaxLine - 100)) // Leave room for command, channel, etc
+		const StackerInfo::ModeList &list = set ? info->AddModes : info->DelModes;
+		char sign = set ? '+' : '-';
+
+		for (unsigned i = 0; i < list.size(); ++i)
 		{
-			ret.push_back(buf + parambuf);
-			buf = "-";
-			parambuf.clear();
-			NModes = 1;
-		}
+			const Anope::string &param = list[i].second;
+			size_t len = 1 + (sign_used != sign ? 1 : 0) + (param.empty() ? 0 : 1 + param.length());
+
+			if (nmodes && (nmodes >= IRCD->MaxModes || mode_buf.length() + param_buf.length() + len > room))
+			{
+				SendModeLine(info->bi, target);
+				sign_used = 0;
+				nmodes = 0;
+			}
 
-		buf += it->first->mchar;
+			if (sign_used != sign)
+			{
+				mode_buf += sign;
+				sign_used = sign;
+			}
 
-		if (!it->second.empty())
-			parambuf += " " + it->second;
+			mode_buf += list[i].first->mchar;
+			if (!param.empty())
+				param_buf.append(" ").append(param);
+			++nmodes;
+		}
 	}
 
-	if (buf[buf.length() - 1] == '-')
-		buf.erase(buf.length() - 1);
+	if (nmodes)
+		SendModeLine(info->bi, target);
+}
 
-	if (!buf.empty())
-		ret.push_back(buf + parambuf);
+static void SendStackedModes(StackerInfo *info, User *u)
+{
+	SendModeStrings(info, u, std::max(u->nick.length(), u->GetUID().length()));
+}
 
-	return ret;
+static void SendStackedModes(StackerInfo *info, Channel *c)
+{
+	SendModeStrings<const Channel>(info, c, c->name.length());
 }
 
 bool ModeManager::AddUserMode(UserMode *um)
@@ -612,134 +744,73 @@ void ModeManager::RebuildStatusModes()
 
 void ModeManager::StackerAdd(BotInfo *bi, Channel *c, ChannelMode *cm, bool Set, const Anope::string &Param)
 {
-	StackerInfo *s = GetInfo(ChannelStackerObjects, c);
+	StackerInfo *s = ChannelStacker.Get(c);
 	s->AddMode(cm, Set, Param);
 	if (bi)
 		s->bi = bi;
 	else
 		s->bi = c->ci->WhoSends();
 
-	if (!modePipe)
-		modePipe = new ModePipe();
-	modePipe->Notify();
+	if (!modeTask)
+		modeTask = new ModeTask();
+	modeTask->Queue();
 }
 
 void ModeManager::StackerAdd(BotInfo *bi, User *u, UserMode *um, bool Set, const Anope::string &Param)
 {
-	StackerInfo *s = GetInfo(UserStackerObjects, u);
+	StackerInfo *s = UserStacker.Get(u);
 	s->AddMode(um, Set, Param);
 	if (bi)
 		s->bi = bi;
 
-	if (!modePipe)
-		modePipe = new ModePipe();
-	modePipe->Notify();
+	if (!modeTask)
+		modeTask = new ModeTask();
+	modeTask->Queue();
 }
 
-void ModeManager::ProcessModes()
+template<typename T>
+static void ProcessModes(Stacker<T> &stacker)
 {
-	if (!UserStackerObjects.empty())
-	{
-		for (std::map<User *, StackerInfo *>::const_iterator it = UserStackerObjects.begin(), it_end = UserStackerObjects.end(); it != it_end; ++it)
-		{
-			User *u = it->first;
-			StackerInfo *s = it->second;
-
-			std::list<Anope::string> ModeStrings = BuildModeStrings(s);
-			for (std::list<Anope::string>::iterator lit = ModeStrings.begin(), lit_end = ModeStrings.end(); lit != lit_end; ++lit)
-				IRCD->SendMode(s->bi, u, "%s", lit->c_str());
-			delete it->second;
-		}
-		UserStackerObjects.clear();
-	}
-
-	if (!ChannelStackerObjects.empty())
-	{
-		for (std::map<Channel *, StackerInfo *>::const_iterator it = ChannelStackerObjects.begin(), it_end = ChannelStackerObjects.end(); it != it_end; ++it)
-		{
-			Channel *c = it->first;
-			StackerInfo *s = it->second;
+	for (unsigned i = 0; i < stacker.objects.size(); ++i)
+		if (stacker.objects[i])
+			SendStackedModes(stacker.infos[i], stacker.objects[i]);
+	stacker.Clear();
+}
 
-			std::list<Anope::string> ModeStrings = BuildModeStrings(s);
-			for (std::list<Anope::string>::iterator lit = ModeStrings.begin(), lit_end = ModeStrings.end(); lit != lit_end; ++lit)
-				IRCD->SendMode(s->bi, c, "%s", lit->c_str());
-			delete it->second;
-		}
-		ChannelStackerObjects.clear();
-	}
+void ModeManager::ProcessModes()
+{
+	::ProcessModes(UserStacker);
+	::ProcessModes(ChannelStacker);
 }
 
 template<typename T>
-static void StackerDel(std::map<T *, StackerInfo *> &map, T *obj)
+static void StackerDel(Stacker<T> &stacker, T *obj)
 {
-	typename std::map<T *, StackerInfo *>::iterator it = map.find(obj);
-	if (it != map.end())
+	StackerInfo *si = stacker.Find(obj);
+	if (si)
 	{
-		StackerInfo *si = it->second;
-		std::list<Anope::string> ModeStrings = BuildModeStrings(si);
-		for (std::list<Anope::string>::iterator lit = ModeStrings.begin(), lit_end = ModeStrings.end(); lit != lit_end; ++lit)
-			IRCD->SendMode(si->bi, obj, "%s", lit->c_str());
-
-		delete si;
-		map.erase(it);
+		SendStackedModes(si, obj);
+		stacker.Remove(obj);
 	}
 }
 
 void ModeManager::StackerDel(User *u)
 {
-	::StackerDel(UserStackerObjects, u);
+	::StackerDel(UserStacker, u);
 }
 
 void ModeManager::StackerDel(Channel *c)
 {
-	::StackerDel(ChannelStackerObjects, c);
+	::StackerDel(ChannelStacker, c);
 }
 
 void ModeManager::StackerDel(Mode *m)
 {
-	for (std::map<User *, StackerInfo *>::const_iterator it = UserStackerObjects.begin(), it_end = UserStackerObjects.end(); it != it_end;)
-	{
-		StackerInfo *si = it->second;
-		++it;
-
-		for (std::list<std::pair<Mode *, Anope::string> >::iterator it2 = si->AddModes.begin(), it2_end = si->AddModes.end(); it2 != it2_end;)
-		{
-			if (it2->first == m)
-				it2 = si->AddModes.erase(it2);
-			else
-				++it2;
-		}
-
-		for (std::list<std::pair<Mode *, Anope::string> >::iterator it2 = si->DelModes.begin(), it2_end = si->DelModes.end(); it2 != it2_end;)
-		{
-			if (it2->first == m)
-				it2 = si->DelModes.erase(it2);
-			else
-				++it2;
-		}
-	}
-
-	for (std::map<Channel *, StackerInfo *>::const_iterator it = ChannelStackerObjects.begin(), it_end = ChannelStackerObjects.end(); it != it_end;)
-	{
-		StackerInfo *si = it->second;
-		++it;
+	for (unsigned i = 0; i < UserStacker.objects.size(); ++i)
+		UserStacker.infos[i]->DelMode(m);
 
-		for (std::list<std::pair<Mode *, Anope::string> >::iterator it2 = si->AddModes.begin(), it2_end = si->AddModes.end(); it2 != it2_end;)
-		{
-			if (it2->first == m)
-				it2 = si->AddModes.erase(it2);
-			else
-				++it2;
-		}
-
-		for (std::list<std::pair<Mode *, Anope::string> >::iterator it2 = si->DelModes.begin(), it2_end = si->DelModes.end(); it2 != it2_end;)
-		{
-			if (it2->first == m)
-				it2 = si->DelModes.erase(it2);
-			else
-				++it2;
-		}
-	}
+	for (unsigned i = 0; i < ChannelStacker.objects.size(); ++i)
+		ChannelStacker.infos[i]->DelMode(m);
 }
 
 Entry::Entry(const Anope::string &m, const Anope::string &fh) : name(m), mask(fh), cidr_len(0), family(0)
@@ -819,7 +890,7 @@ Entry::Entry(const Anope::string &m, const Anope::string &fh) : name(m), mask(fh
 		this->real.clear();
 }
 
-const Anope::string Entry::GetMask() const
+const Anope::string &Entry::GetMask() const
 {
 	return this->mask;
 }
@@ -22,6 +22,36 @@
 
 std::list<Module *> ModuleManager::Modules;
 std::vector<Module *> ModuleManager::EventHandlers[I_SIZE];
+bool ModuleManager::ProfileHooks = false;
+std::map<Module *, std::vector<HookStats> > ModuleManager::HookProfile;
+
+/* In the same order as Implementation */
+static const char *const EventNames[] = {
+	"OnPostInit", "OnPreUserKicked", "OnUserKicked", "OnReload", "OnPreBotAssign", "OnBotAssign", "OnBotUnAssign",
+	"OnUserConnect", "OnNewServer", "OnUserNickChange", "OnPreHelp", "OnPostHelp", "OnPreCommand", "OnPostCommand",
+	"OnSaveDatabase", "OnLoadDatabase", "OnEncrypt", "OnDecrypt", "OnBotFantasy", "OnBotNoFantasyAccess", "OnBotBan",
+	"OnBadWordAdd", "OnBadWordDel", "OnCreateBot", "OnDelBot", "OnBotKick", "OnPrePartChannel", "OnPartChannel",
+	"OnLeaveChannel", "OnJoinChannel", "OnTopicUpdated", "OnPreChanExpire", "OnChanExpire", "OnPreServerConnect",
+	"OnServerConnect", "OnPreUplinkSync", "OnServerDisconnect", "OnRestart", "OnShutdown", "OnPreNickExpire",
+	"OnNickExpire", "OnDefconLevel", "OnExceptionAdd", "OnExceptionDel", "OnAddXLine", "OnDelXLine", "IsServicesOper",
+	"OnServerQuit", "OnUserQuit", "OnPreUserLogoff", "OnPostUserLogoff", "OnBotCreate", "OnBotChange", "OnBotDelete",
+	"OnAccessDel", "OnAccessAdd", "OnAccessClear", "OnLevelChange", "OnChanDrop", "OnChanRegistered", "OnChanSuspend",
+	"OnChanUnsuspend", "OnCreateChan", "OnDelChan", "OnChannelCreate", "OnChannelDelete", "OnAkickAdd", "OnAkickDel",
+	"OnCheckKick", "OnChanInfo", "OnCheckPriv", "OnGroupCheckPriv", "OnNickDrop", "OnNickGroup", "OnNickIdentify",
+	"OnUserLogin", "OnNickLogout", "OnNickRegister", "OnNickConfirm", "OnNickSuspend", "OnNickUnsuspended",
+	"OnDelNick", "OnNickCoreCreate", "OnDelCore", "OnChangeCoreDisplay", "OnNickClearAccess", "OnNickAddAccess",
+	"OnNickEraseAccess", "OnNickClearCert", "OnNickAddCert", "OnNickEraseCert", "OnNickInfo", "OnBotInfo",
+	"OnCheckAuthentication", "OnNickUpdate", "OnFingerprint", "OnUserAway", "OnInvite", "OnDeleteVhost", "OnSetVhost",
+	"OnSetDisplayedHost", "OnMemoSend", "OnMemoDel", "OnChannelModeSet", "OnChannelModeUnset", "OnUserModeSet",
+	"OnUserModeUnset", "OnChannelModeAdd", "OnUserModeAdd", "OnMLock", "OnUnMLock", "OnModuleLoad", "OnModuleUnload",
+	"OnServerSync", "OnUplinkSync", "OnBotPrivmsg", "OnBotNotice", "OnPrivmsg", "OnLog", "OnLogMessage",
+	"OnDnsRequest", "OnCheckModes", "OnChannelSync", "OnSetCorrectModes", "OnSerializeCheck",
+	"OnSerializableConstruct", "OnSerializableDestruct", "OnSerializableUpdate", "OnSerializeTypeCreate",
+	"OnSetChannelOption", "OnSetNickOption", "OnMessage", "OnCanSet", "OnCheckDelete", "OnExpireTick",
+	"OnNickValidate"
+};
+/* Fails to compile if an event is added to Implementation without a name here */
+typedef char EventNamesSizeCheck[sizeof(EventNames) / sizeof(*EventNames) == I_SIZE ? 1 : -1];
 
 #ifdef _WIN32
 void ModuleManager::CleanupRuntimeDirectory()
@@ -217,6 +247,18 @@ ModuleReturn ModuleManager::LoadModule(const Anope::string &modname, User *u)
 		return MOD_ERR_NOLOAD;
 	}
 
+	dlerror();
+	void (*events)(bool *) = function_cast<void (*)(bool *)>(dlsym(handle, "AnopeEvents"));
+	err = dlerror();
+	if (!events)
+	{
+		Log() << "No event function found, not an Anope module";
+		if (err && *err)
+			Log(LOG_DEBUG) << err;
+		dlclose(handle);
+		return MOD_ERR_NOLOAD;
+	}
+
 	/* Create module. */
 	Anope::string nick;
 	if (u)
@@ -272,9 +314,12 @@ ModuleReturn ModuleManager::LoadModule(const Anope::string &modname, User *u)
 
 	Log(LOG_DEBUG) << "Module " << modname << " loaded.";
 
-	/* Attach module to all events */
+	/* Attach module to the events it implements */
+	bool implements[I_SIZE];
+	events(implements);
 	for (unsigned i = 0; i < I_SIZE; ++i)
-		EventHandlers[i].push_back(m);
+		if (implements[i])
+			EventHandlers[i].push_back(m);
 
 	m->Prioritize();
 
@@ -395,6 +440,8 @@ ModuleReturn ModuleManager::DeleteModule(Module *m)
 
 void ModuleManager::DetachAll(Module *mod)
 {
+	HookProfile.erase(mod);
+
 	for (unsigned i = 0; i < I_SIZE; ++i)
 	{
 		std::vector<Module *> &mods = EventHandlers[i];
@@ -524,3 +571,94 @@ void ModuleManager::UnloadAll()
 			UnloadModule(m, NULL);
 	}
 }
+
+const char *ModuleManager::GetEventName(Implementation i)
+{
+	if (i < 0 || i >= I_SIZE)
+		return "";
+	return EventNames[i];
+}
+
+static bool HookStatsGreater(const HookStats &a, const HookStats &b)
+{
+	return a.total > b.total;
+}
+
+void ModuleManager::GetHookStats(std::vector<HookStats> &stats)
+{
+	stats.clear();
+	for (std::map<Module *, std::vector<HookStats> >::const_iterator it = HookProfile.begin(), it_end = HookProfile.end(); it != it_end; ++it)
+		for (unsigned i = 0; i < it->second.size(); ++i)
+			if (it->second[i].calls)
+				stats.push_back(it->second[i]);
+	std::sort(stats.begin(), stats.end(), HookStatsGreater);
+}
+
+void ModuleManager::ResetHookStats()
+{
+	HookProfile.clear();
+}
+
+class HookProfileTimer : public Timer
+{
+ public:
+	HookProfileTimer(time_t timeout) : Timer(timeout, Anope::CurTime, true) { }
+
+	void Tick(time_t) anope_override
+	{
+		if (!ModuleManager::ProfileHooks)
+			return;
+
+		std::vector<HookStats> stats;
+		ModuleManager::GetHookStats(stats);
+
+		for (unsigned i = 0; i < stats.size() && i < 10; ++i)
+		{
+			const HookStats &hs = stats[i];
+			Log() << "Hook profile: " << hs.module->name << " " << ModuleManager::GetEventName(hs.event) << ": " << hs.calls << " calls, "
+				<< hs.total << "us total, " << hs.total / hs.calls << "us average, " << hs.max << "us max";
+		}
+	}
+};
+
+static HookProfileTimer *hook_profile_timer = NULL;
+
+void ModuleManager::SetHookProfileLog(time_t interval)
+{
+	if (interval <= 0)
+	{
+		delete hook_profile_timer;
+		hook_profile_timer = NULL;
+	}
+	else if (!hook_profile_timer)
+		hook_profile_timer = new HookProfileTimer(interval);
+	else if (hook_profile_timer->GetSecs() != interval)
+		hook_profile_timer->SetSecs(interval);
+}
+
+void HookTimer::Start()
+{
+	std::vector<HookStats> &stats = ModuleManager::HookProfile[this->mod];
+	if (stats.empty())
+		stats.resize(I_SIZE);
+
+	this->start = Anope::MicroTime();
+}
+
+void HookTimer::Record()
+{
+	uint64_t elapsed = Anope::MicroTime() - this->start;
+
+	/* The module may have been unloaded by its own handler */
+	std::map<Module *, std::vector<HookStats> >::iterator it = ModuleManager::HookProfile.find(this->mod);
+	if (it == ModuleManager::HookProfile.end())
+		return;
+
+	HookStats &hs = it->second[this->event];
+	hs.module = this->mod;
+	hs.event = this->event;
+	++hs.calls;
+	hs.total += elapsed;
+	if (elapsed > hs.max)
+		hs.max = elapsed;
+}
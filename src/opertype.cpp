@@ -57,13 +57,17 @@ OperType::OperType(const Anope::string &nname) : name(nname)
 
 bool OperType::HasCommand(const Anope::string &cmdstr) const
 {
-	for (std::list<Anope::string>::const_iterator it = this->commands.begin(), it_end = this->commands.end(); it != it_end; ++it)
+	std::list<Anope::Glob>::const_iterator git = this->command_globs.begin();
+	for (std::list<Anope::string>::const_iterator it = this->commands.begin(), it_end = this->commands.end(); it != it_end; ++it, ++git)
 	{
 		const Anope::string &s = *it;
 
-		if (!s.find('~') && Anope::Match(cmdstr, s.substr(1)))
-			return false;
-		else if (Anope::Match(cmdstr, s))
+		if (!s.find('~'))
+		{
+			if (git->Matches(cmdstr))
+				return false;
+		}
+		else if (git->Matches(cmdstr))
 			return true;
 	}
 	for (std::set<OperType *>::const_iterator iit = this->inheritances.begin(), iit_end = this->inheritances.end(); iit != iit_end; ++iit)
@@ -79,13 +83,17 @@ bool OperType::HasCommand(const Anope::string &cmdstr) const
 
 bool OperType::HasPriv(const Anope::string &privstr) const
 {
-	for (std::list<Anope::string>::const_iterator it = this->privs.begin(), it_end = this->privs.end(); it != it_end; ++it)
+	std::list<Anope::Glob>::const_iterator git = this->priv_globs.begin();
+	for (std::list<Anope::string>::const_iterator it = this->privs.begin(), it_end = this->privs.end(); it != it_end; ++it, ++git)
 	{
 		const Anope::string &s = *it;
 
-		if (!s.find('~') && Anope::Match(privstr, s.substr(1)))
-			return false;
-		else if (Anope::Match(privstr, s))
+		if (!s.find('~'))
+		{
+			if (git->Matches(privstr))
+				return false;
+		}
+		else if (git->Matches(privstr))
 			return true;
 	}
 	for (std::set<OperType *>::const_iterator iit = this->inheritances.begin(), iit_end = this->inheritances.end(); iit != iit_end; ++iit)
@@ -102,11 +110,13 @@ bool OperType::HasPriv(const Anope::string &privstr) const
 void OperType::AddCommand(const Anope::string &cmdstr)
 {
 	this->commands.push_back(cmdstr);
+	this->command_globs.push_back(Anope::Glob(!cmdstr.find('~') ? cmdstr.substr(1) : cmdstr));
 }
 
 void OperType::AddPriv(const Anope::string &privstr)
 {
 	this->privs.push_back(privstr);
+	this->priv_globs.push_back(Anope::Glob(!privstr.find('~') ? privstr.substr(1) : privstr));
 }
 
 const Anope::string &OperType::GetName() const
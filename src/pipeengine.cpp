@@ -12,12 +12,144 @@
 #include "services.h"
 #include "sockets.h"
 #include "socketengine.h"
+#include "threadengine.h"
 
 #ifndef _WIN32
 #include <fcntl.h>
 #endif
+#ifdef HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
+
+/* Guards the queue and whether the main loop has been woken for it */
+static Mutex queue_lock;
+/* Tasks waiting for the end of the loop iteration */
+static std::vector<DeferredTask *> queued_tasks;
+/* Tasks being run by the main thread, an entry is cleared if its task is deleted by an earlier one */
+static std::vector<DeferredTask *> running_tasks;
+/* Whether the main loop has been woken since the queue was last run */
+static bool woken = false;
+
+/* Wakes the main loop when a task is queued, so it does not wait in the socket engine
+ * with tasks to run. It is woken at most once an iteration, however many tasks are queued.
+ */
+#ifdef HAVE_EVENTFD
+class DeferredWake : public Socket
+{
+	static int CreateFD()
+	{
+		int fd = eventfd(0, EFD_NONBLOCK);
+		if (fd < 0)
+			throw CoreException("Could not create eventfd: " + Anope::LastError());
+		return fd;
+	}
+
+ public:
+	DeferredWake() : Socket(CreateFD()) { }
+
+	bool ProcessRead() anope_override
+	{
+		/* Reading the counter resets it, so the eventfd is not readable again until the next Wake */
+		eventfd_t value;
+		eventfd_read(this->GetFD(), &value);
+		this->flags[SF_READ_BLOCKED] = true;
+		return true;
+	}
+
+	void Wake()
+	{
+		eventfd_write(this->GetFD(), 1);
+	}
+
+	~DeferredWake();
+} *wake;
+#else
+class DeferredWake : public Pipe
+{
+ public:
+	void OnNotify() anope_override { }
+
+	void Wake()
+	{
+		this->Write("\0", 1);
+	}
+
+	~DeferredWake();
+} *wake;
+#endif
+
+DeferredWake::~DeferredWake()
+{
+	/* The socket engine deletes it on shutdown */
+	queue_lock.Lock();
+	wake = NULL;
+	queue_lock.Unlock();
+}
+
+DeferredTask::DeferredTask() : queued(false)
+{
+}
+
+DeferredTask::~DeferredTask()
+{
+	queue_lock.Lock();
+	if (this->queued)
+	{
+		std::vector<DeferredTask *>::iterator it = std::find(queued_tasks.begin(), queued_tasks.end(), this);
+		if (it != queued_tasks.end())
+			queued_tasks.erase(it);
+	}
+	std::replace(running_tasks.begin(), running_tasks.end(), this, static_cast<DeferredTask *>(NULL));
+	queue_lock.Unlock();
+}
+
+void DeferredTask::Queue()
+{
+	queue_lock.Lock();
+	if (!this->queued)
+	{
+		this->queued = true;
+		queued_tasks.push_back(this);
+
+		if (!woken && wake)
+		{
+			woken = true;
+			wake->Wake();
+		}
+	}
+	queue_lock.Unlock();
+}
+
+void DeferredTask::RunQueued()
+{
+	if (!wake)
+		wake = new DeferredWake();
+
+	queue_lock.Lock();
+	running_tasks.swap(queued_tasks);
+	for (unsigned i = 0; i < running_tasks.size(); ++i)
+		running_tasks[i]->queued = false;
+	woken = false;
+	queue_lock.Unlock();
+
+	/* Tasks are only deleted from the main thread, so this does not need the lock */
+	for (unsigned i = 0; i < running_tasks.size(); ++i)
+		if (running_tasks[i])
+			running_tasks[i]->Run();
+
+	running_tasks.clear();
+}
+
+void Pipe::NotifyTask::Run()
+{
+	this->pipe->OnNotify();
+
+	/* As the socket engine would after ProcessRead */
+	if (this->pipe->flags[SF_DEAD])
+		delete this->pipe;
+}
 
-Pipe::Pipe() : Socket(-1), write_pipe(-1)
+Pipe::Pipe() : Socket(-1), notify_task(this), write_pipe(-1)
 {
 	int fds[2];
 	if (pipe(fds))
@@ -51,7 +183,8 @@ bool Pipe::ProcessRead()
 	this->OnNotify();
 
 	char dummy[512];
-	while (read(this->GetFD(), dummy, 512) == 512);
+	while (read(this->GetFD(), dummy, 512) > 0);
+	this->flags[SF_READ_BLOCKED] = SocketEngine::WouldBlock();
 	return true;
 }
 
@@ -76,5 +209,5 @@ bool Pipe::SetWriteBlocking(bool state)
 
 void Pipe::Notify()
 {
-	this->Write("\0", 1);
+	this->notify_task.Queue();
 }
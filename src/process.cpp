@@ -16,16 +16,58 @@
 #include "users.h"
 #include "regchannel.h"
 
+/* A parsed line. Lines are parsed into the same one every time so the strings
+ * and the parameter vector keep their memory, unless Process is called recursively.
+ */
+struct ParsedLine
+{
+	Anope::string source, command;
+	std::vector<Anope::string> params;
+};
+
+static ParsedLine last_line;
+static unsigned process_depth = 0;
+
+/* Message handlers found for each command, cleared whenever a service is added or removed */
+static Anope::hash_map<IRCDMessage *> handlers;
+static unsigned long handlers_generation = 0;
+
+static IRCDMessage *FindHandler(const Anope::string &proto_name, const Anope::string &command)
+{
+	if (handlers_generation != Service::Generation || handlers.size() > 1024)
+	{
+		handlers.clear();
+		handlers_generation = Service::Generation;
+	}
+
+	Anope::hash_map<IRCDMessage *>::iterator it = handlers.find(command);
+	if (it != handlers.end())
+		return it->second;
+
+	/* See ServiceReference for why this is a static_cast. Unknown commands are cached too */
+	IRCDMessage *m = static_cast<IRCDMessage *>(Service::FindService("IRCDMessage", proto_name + "/" + command.lower()));
+	handlers[command] = m;
+	return m;
+}
+
 void Anope::Process(const Anope::string &buffer)
 {
 	/* If debugging, log the buffer */
-	Log(LOG_RAWIO) << "Received: " << buffer;
+	LOG_IF_ENABLED(LOG_RAWIO) << "Received: " << buffer;
 
 	if (buffer.empty())
 		return;
 
-	Anope::string source, command;
-	std::vector<Anope::string> params;
+	struct DepthGuard
+	{
+		DepthGuard() { ++process_depth; }
+		~DepthGuard() { --process_depth; }
+	} guard;
+
+	ParsedLine nested;
+	ParsedLine &line = process_depth == 1 ? last_line : nested;
+	Anope::string &source = line.source, &command = line.command;
+	std::vector<Anope::string> &params = line.params;
 
 	IRCD->Parse(buffer, source, command, params);
 
@@ -56,7 +98,7 @@ void Anope::Process(const Anope::string &buffer)
 	if (MOD_RESULT == EVENT_STOP)
 		return;
 
-	ServiceReference<IRCDMessage> m("IRCDMessage", proto_name + "/" + command.lower());
+	IRCDMessage *m = FindHandler(proto_name, command);
 	if (!m)
 	{
 		Log(LOG_DEBUG) << "unknown message from server (" << buffer << ")";
@@ -73,31 +115,58 @@ void Anope::Process(const Anope::string &buffer)
 		m->Run(src, params);
 }
 
+/* Find the next space separated token, skipping any spaces before it
+ * @param p The position to search from, set to the end of the token
+ * @param end The end of the buffer
+ * @param tok Set to the start of the token
+ * @return false if there are no more tokens
+ */
+static bool NextToken(const char *&p, const char *end, const char *&tok)
+{
+	while (p != end && *p == ' ')
+		++p;
+	if (p == end)
+		return false;
+
+	tok = p;
+	while (p != end && *p != ' ')
+		++p;
+	return true;
+}
+
 void IRCDProto::Parse(const Anope::string &buffer, Anope::string &source, Anope::string &command, std::vector<Anope::string> &params)
 {
-	spacesepstream sep(buffer);
+	/* The buffer is scanned in place and each token is copied once, into the
+	 * strings given, which keep their memory if they are reused.
+	 */
+	const char *p = buffer.c_str(), *end = p + buffer.length(), *tok;
 
-	if (buffer[0] == ':')
-	{
-		sep.GetToken(source);
-		source.erase(0, 1);
-	}
+	source.clear();
+	if (p != end && *p == ':' && NextToken(p, end, tok))
+		source.str().assign(tok + 1, p - tok - 1);
 
-	sep.GetToken(command);
+	if (NextToken(p, end, tok))
+		command.str().assign(tok, p - tok);
+	else
+		command.clear();
 
-	for (Anope::string token; sep.GetToken(token);)
+	unsigned count = 0;
+	while (NextToken(p, end, tok))
 	{
-		if (token[0] == ':')
+		if (count == params.size())
+			params.push_back("");
+		Anope::string &param = params[count++];
+
+		if (*tok == ':')
 		{
-			if (!sep.StreamEnd())
-				params.push_back(token.substr(1) + " " + sep.GetRemaining());
-			else
-				params.push_back(token.substr(1));
+			/* The last parameter is the rest of the line, as is */
+			param.str().assign(tok + 1, end - tok - 1);
 			break;
 		}
-		else
-			params.push_back(token);
+
+		param.str().assign(tok, p - tok);
 	}
+	params.resize(count);
 }
 
 Anope::string IRCDProto::Format(const Anope::string &source, const Anope::string &message)
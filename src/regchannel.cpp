@@ -18,20 +18,195 @@
 #include "config.h"
 #include "bots.h"
 #include "servers.h"
+#include "protocol.h"
 
 Serialize::Checker<registered_channel_map> RegisteredChannelList("ChannelInfo");
 
-AutoKick::AutoKick() : Serializable("AutoKick")
+template<typename Map, typename Key, typename Bucket>
+static void AppendBucket(const Map &map, const Key &key, Bucket &out)
+{
+	typename Map::const_iterator it = map.find(key);
+	if (it != map.end())
+		out.insert(out.end(), it->second.begin(), it->second.end());
+}
+
+/* An index of a channel's access list, so finding the entries which match a user
+ * does not need to match every entry. Each entry is in one bucket, along with
+ * its position in the access list.
+ */
+struct ChanAccessIndex
+{
+	typedef std::vector<std::pair<unsigned, ChanAccess *> > Bucket;
+
+	/* Entries for an account */
+	TR1NS::unordered_map<const NickCore *, Bucket> accounts;
+	/* Entries for a nick with no wildcards, which match the aliases of an account */
+	Anope::hash_map<Bucket> nicks;
+	/* Entries for a mask whose host has no wildcards, eg *!*@host, which can only match a user with that host */
+	Anope::hash_map<Bucket> hosts;
+	/* Everything else, including links to other channels, which is always checked */
+	Bucket others;
+	/* Position of the next entry added */
+	unsigned count;
+
+	ChanAccessIndex() : count(0) { }
+
+	void Add(ChanAccess *a)
+	{
+		std::pair<unsigned, ChanAccess *> entry(count++, a);
+
+		const NickCore *nc = a->GetAccount();
+		if (nc != NULL)
+		{
+			accounts[nc].push_back(entry);
+			return;
+		}
+
+		const Anope::string &mask = a->Mask();
+		if (mask.find_first_of("!@?*") == Anope::string::npos)
+		{
+			/* A channel name links the access list of that channel */
+			if (IRCD == NULL || IRCD->IsChannelValid(mask))
+				others.push_back(entry);
+			else
+				nicks[mask].push_back(entry);
+			return;
+		}
+
+		size_t at = mask.rfind('@');
+		if (at != Anope::string::npos && at + 1 < mask.length() && mask.find_first_of("?*", at + 1) == Anope::string::npos)
+			hosts[mask.substr(at + 1)].push_back(entry);
+		else
+			others.push_back(entry);
+	}
+};
+
+/* An index of a channel's akick list, like ChanAccessIndex */
+struct AutoKickIndex
+{
+	typedef std::vector<std::pair<unsigned, AutoKick *> > Bucket;
+
+	/* A binary trie of the bits of an address, each node holds the akicks for the range it represents */
+	struct CIDRNode
+	{
+		CIDRNode *child[2];
+		Bucket akicks;
+
+		CIDRNode() { child[0] = child[1] = NULL; }
+		~CIDRNode() { delete child[0]; delete child[1]; }
+	};
+
+	/* Akicks for an account */
+	TR1NS::unordered_map<const NickCore *, Bucket> accounts;
+	/* Akicks whose host has no wildcards, which can only match a user with that host or IP */
+	Anope::hash_map<Bucket> hosts;
+	/* CIDR akicks, for IPv4 and IPv6 */
+	CIDRNode ipv4, ipv6;
+	/* Everything else, which is always checked */
+	Bucket others;
+	/* Position of the next akick added */
+	unsigned count;
+
+	AutoKickIndex() : count(0) { }
+
+	static const uint8_t *GetBits(const sockaddrs &addr, unsigned &bits)
+	{
+		switch (addr.family())
+		{
+			case AF_INET:
+				bits = 32;
+				return reinterpret_cast<const uint8_t *>(&addr.sa4.sin_addr);
+			case AF_INET6:
+				bits = 128;
+				return reinterpret_cast<const uint8_t *>(&addr.sa6.sin6_addr);
+			default:
+				return NULL;
+		}
+	}
+
+	void Add(AutoKick *ak)
+	{
+		std::pair<unsigned, AutoKick *> entry(count++, ak);
+
+		if (ak->nc)
+		{
+			accounts[ak->nc].push_back(entry);
+			return;
+		}
+
+		if (IRCD == NULL || IRCD->IsChannelValid(ak->mask) || IRCD->IsExtbanValid(ak->mask))
+		{
+			others.push_back(entry);
+			return;
+		}
+
+		const Entry &e = ak->GetEntry();
+		if (e.cidr_len)
+		{
+			sockaddrs addr(e.host);
+			unsigned bits;
+			const uint8_t *ip = GetBits(addr, bits);
+			if (ip == NULL)
+			{
+				others.push_back(entry);
+				return;
+			}
+
+			/* See cidr::match, which is given the length as an unsigned char */
+			unsigned len = std::min<unsigned>(static_cast<unsigned char>(e.cidr_len), bits);
+			CIDRNode *node = addr.family() == AF_INET ? &ipv4 : &ipv6;
+			for (unsigned i = 0; i < len; ++i)
+			{
+				unsigned bit = (ip[i / 8] >> (7 - i % 8)) & 1;
+				if (node->child[bit] == NULL)
+					node->child[bit] = new CIDRNode();
+				node = node->child[bit];
+			}
+			node->akicks.push_back(entry);
+
+			/* If the user's host is not their real host the range is matched against their host as text */
+			hosts[e.host].push_back(entry);
+		}
+		else if (!e.host.empty() && e.host.find_first_of("?*") == Anope::string::npos)
+			hosts[e.host].push_back(entry);
+		else
+			others.push_back(entry);
+	}
+
+	void FindCIDR(const sockaddrs &addr, Bucket &out) const
+	{
+		unsigned bits;
+		const uint8_t *ip = GetBits(addr, bits);
+		if (ip == NULL)
+			return;
+
+		const CIDRNode *node = addr.family() == AF_INET ? &ipv4 : &ipv6;
+		for (unsigned i = 0; node != NULL; ++i)
+		{
+			out.insert(out.end(), node->akicks.begin(), node->akicks.end());
+			if (i == bits)
+				break;
+			node = node->child[(ip[i / 8] >> (7 - i % 8)) & 1];
+		}
+	}
+};
+
+AutoKick::AutoKick() : Serializable("AutoKick"), entry(NULL)
 {
 }
 
 AutoKick::~AutoKick()
 {
+	delete this->entry;
+
 	if (this->ci)
 	{
 		std::vector<AutoKick *>::iterator it = std::find(this->ci->akick->begin(), this->ci->akick->end(), this);
 		if (it != this->ci->akick->end())
+		{
 			this->ci->akick->erase(it);
+			this->ci->InvalidateAkickIndex();
+		}
 
 		if (nc)
 			nc->RemoveChannelReference(this->ci);
@@ -73,6 +248,7 @@ Serializable* AutoKick::Unserialize(Serializable *obj, Serialize::Data &data)
 		data["mask"] >> ak->mask;
 		data["addtime"] >> ak->addtime;
 		data["last_used"] >> ak->last_used;
+		ci->InvalidateAkickIndex();
 	}
 	else
 	{
@@ -95,8 +271,19 @@ Serializable* AutoKick::Unserialize(Serializable *obj, Serialize::Data &data)
 	return ak;
 }
 
+const Entry &AutoKick::GetEntry() const
+{
+	if (this->entry == NULL || this->entry->GetMask() != this->mask)
+	{
+		delete this->entry;
+		this->entry = new Entry("BAN", this->mask);
+	}
+
+	return *this->entry;
+}
+
 ChannelInfo::ChannelInfo(const Anope::string &chname) : Serializable("ChannelInfo"),
-	access("ChanAccess"), akick("AutoKick")
+	access("ChanAccess"), akick("AutoKick"), access_index(NULL), akick_index(NULL)
 {
 	if (chname.empty())
 		throw CoreException("Empty channel passed to ChannelInfo constructor");
@@ -128,6 +315,8 @@ ChannelInfo::ChannelInfo(const ChannelInfo &ci) : Serializable("ChannelInfo"),
 	access("ChanAccess"), akick("AutoKick")
 {
 	*this = ci;
+	this->access_index = NULL;
+	this->akick_index = NULL;
 
 	if (this->founder)
 		++this->founder->channelcount;
@@ -169,6 +358,8 @@ ChannelInfo::~ChannelInfo()
 
 	this->ClearAccess();
 	this->ClearAkick();
+	this->InvalidateAccessIndex();
+	this->InvalidateAkickIndex();
 
 	if (!this->memos.memos->empty())
 	{
@@ -371,6 +562,8 @@ BotInfo *ChannelInfo::WhoSends() const
 void ChannelInfo::AddAccess(ChanAccess *taccess)
 {
 	this->access->push_back(taccess);
+	if (this->access_index)
+		this->access_index->Add(taccess);
 }
 
 ChanAccess *ChannelInfo::GetAccess(unsigned index) const
@@ -388,11 +581,16 @@ static void FindMatchesRecurse(ChannelInfo *ci, const User *u, const NickCore *a
 	if (depth > ChanAccess::MAX_DEPTH)
 		return;
 
-	for (unsigned int i = 0; i < ci->GetAccessCount(); ++i)
+	std::vector<ChanAccess *> entries;
+	ci->FindAccessCandidates(u, account, entries);
+
+	for (unsigned int i = 0; i < entries.size(); ++i)
 	{
-		ChanAccess *a = ci->GetAccess(i);
+		ChanAccess *a = entries[i];
 		ChannelInfo *next = NULL;
 
+		a->QueueUpdate();
+
 		if (a->Matches(u, account, next))
 		{
 			ChanAccess::Path next_path = path;
@@ -474,6 +672,41 @@ AccessGroup ChannelInfo::AccessFor(const NickCore *nc, bool updateLastUsed)
 	return group;
 }
 
+void ChannelInfo::FindAccessCandidates(const User *u, const NickCore *account, std::vector<ChanAccess *> &entries)
+{
+	if (this->access_index == NULL)
+	{
+		this->access_index = new ChanAccessIndex();
+		for (unsigned i = 0; i < this->access->size(); ++i)
+			this->access_index->Add(this->access->at(i));
+	}
+
+	const ChanAccessIndex *index = this->access_index;
+	ChanAccessIndex::Bucket found(index->others);
+
+	if (account != NULL)
+	{
+		AppendBucket(index->accounts, account, found);
+		for (unsigned i = 0; i < account->aliases->size(); ++i)
+			AppendBucket(index->nicks, account->aliases->at(i)->nick, found);
+	}
+
+	if (u != NULL)
+		AppendBucket(index->hosts, u->GetDisplayedHost(), found);
+
+	std::sort(found.begin(), found.end());
+
+	entries.reserve(found.size());
+	for (unsigned i = 0; i < found.size(); ++i)
+		entries.push_back(found[i].second);
+}
+
+void ChannelInfo::InvalidateAccessIndex()
+{
+	delete this->access_index;
+	this->access_index = NULL;
+}
+
 unsigned ChannelInfo::GetAccessCount() const
 {
 	return this->access->size();
@@ -516,6 +749,7 @@ ChanAccess *ChannelInfo::EraseAccess(unsigned index)
 
 	ChanAccess *ca = this->access->at(index);
 	this->access->erase(this->access->begin() + index);
+	this->InvalidateAccessIndex();
 	return ca;
 }
 
@@ -536,6 +770,8 @@ AutoKick *ChannelInfo::AddAkick(const Anope::string &user, NickCore *akicknc, co
 	autokick->last_used = lu;
 
 	this->akick->push_back(autokick);
+	if (this->akick_index)
+		this->akick_index->Add(autokick);
 
 	akicknc->AddChannelReference(this);
 
@@ -554,6 +790,8 @@ AutoKick *ChannelInfo::AddAkick(const Anope::string &user, const Anope::string &
 	autokick->last_used = lu;
 
 	this->akick->push_back(autokick);
+	if (this->akick_index)
+		this->akick_index->Add(autokick);
 
 	return autokick;
 }
@@ -573,6 +811,47 @@ unsigned ChannelInfo::GetAkickCount() const
 	return this->akick->size();
 }
 
+void ChannelInfo::FindAkickCandidates(User *u, std::vector<AutoKick *> &akicks)
+{
+	if (this->akick_index == NULL)
+	{
+		this->akick_index = new AutoKickIndex();
+		for (unsigned i = 0; i < this->akick->size(); ++i)
+			this->akick_index->Add(this->akick->at(i));
+	}
+
+	const AutoKickIndex *index = this->akick_index;
+	AutoKickIndex::Bucket found(index->others);
+
+	if (u->Account())
+		AppendBucket(index->accounts, u->Account(), found);
+
+	/* See Entry::Matches for the hosts a ban is matched against */
+	AppendBucket(index->hosts, u->GetDisplayedHost(), found);
+	if (!u->GetCloakedHost().empty())
+		AppendBucket(index->hosts, u->GetCloakedHost(), found);
+	AppendBucket(index->hosts, u->host, found);
+	if (u->ip.valid())
+	{
+		AppendBucket(index->hosts, u->ip.addr(), found);
+		index->FindCIDR(u->ip, found);
+	}
+
+	/* An akick can be found under more than one of the user's hosts */
+	std::sort(found.begin(), found.end());
+	found.erase(std::unique(found.begin(), found.end()), found.end());
+
+	akicks.reserve(found.size());
+	for (unsigned i = 0; i < found.size(); ++i)
+		akicks.push_back(found[i].second);
+}
+
+void ChannelInfo::InvalidateAkickIndex()
+{
+	delete this->akick_index;
+	this->akick_index = NULL;
+}
+
 void ChannelInfo::EraseAkick(unsigned index)
 {
 	if (this->akick->empty() || index >= this->akick->size())
@@ -23,6 +23,7 @@ using namespace Serialize;
 
 std::vector<Anope::string> Type::TypeOrder;
 std::map<Anope::string, Type *> Serialize::Type::Types;
+unsigned long Serialize::Type::generation = 1;
 std::list<Serializable *> *Serializable::SerializableItems;
 
 void Serialize::RegisterTypes()
@@ -112,7 +113,7 @@ const std::list<Serializable *> &Serializable::GetItems()
 	return *SerializableItems;
 }
 
-Type::Type(const Anope::string &n, unserialize_func f, Module *o)  : name(n), unserialize(f), owner(o), timestamp(0)
+Type::Type(const Anope::string &n, unserialize_func f, Module *o)  : name(n), unserialize(f), owner(o), timestamp(0), checked(0)
 {
 	TypeOrder.push_back(this->name);
 	Types[this->name] = this;
@@ -143,11 +144,18 @@ Serializable *Type::Unserialize(Serializable *obj, Serialize::Data &data)
 	return this->unserialize(obj, data);
 }
 
-void Type::Check()
+void Type::Refresh()
 {
 	FOREACH_MOD(OnSerializeCheck, (this));
 }
 
+void Type::MarkAllStale()
+{
+	/* Skip 0, which marks a single type stale */
+	if (!++generation)
+		++generation;
+}
+
 time_t Type::GetTimestamp() const
 {
 	return this->timestamp;
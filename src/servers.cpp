@@ -27,12 +27,18 @@ Anope::map<Server *> Servers::ByID;
 
 std::set<Anope::string> Servers::Capab;
 
+/* When our uplink was introduced, used to time its burst */
+static uint64_t uplink_introduced = 0;
+
 Server::Server(Server *up, const Anope::string &sname, unsigned shops, const Anope::string &desc, const Anope::string &ssid, bool jupe) : name(sname), hops(shops), description(desc), sid(ssid), uplink(up), users(0)
 {
 	syncing = true;
 	juped = jupe;
 	quitting = false;
 
+	if (up && up == Me && !jupe)
+		uplink_introduced = Anope::MicroTime();
+
 	Servers::ByName[sname] = this;
 	if (!ssid.empty())
 		Servers::ByID[ssid] = this;
@@ -251,6 +257,13 @@ void Server::Sync(bool sync_links)
 	if (this->IsSynced())
 		return;
 
+	/* Joins during the burst are checked before any server is marked as synced,
+	 * so they are checked the same way they would have been as they happened
+	 */
+	uint64_t check_start = Anope::MicroTime();
+	unsigned checked = Channel::CheckAllPendingJoins();
+	uint64_t check_time = Anope::MicroTime() - check_start;
+
 	syncing = false;
 
 	Log(this, "sync") << "is done syncing";
@@ -286,6 +299,8 @@ void Server::Sync(bool sync_links)
 
 		FOREACH_MOD(OnUplinkSync, (this));
 
+		Log() << "Processed the burst from " << this->GetName() << " in " << (Anope::MicroTime() - uplink_introduced) / 1000 << "ms, checking " << checked << " joins took " << check_time / 1000 << "ms";
+
 		if (!Anope::NoFork)
 		{
 			Log(LOG_TERMINAL) << "Successfully linked, launching into background...";
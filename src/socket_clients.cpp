@@ -28,7 +28,13 @@ bool ConnectionSocket::Process()
 		if (this->flags[SF_CONNECTED])
 			return true;
 		else if (this->flags[SF_CONNECTING])
-			this->flags[this->io->FinishConnect(this)] = true;
+		{
+			SocketFlag f = this->io->FinishConnect(this);
+			this->flags[f] = true;
+			/* Still waiting on the other end */
+			if (f == SF_CONNECTING)
+				this->flags[SF_READ_BLOCKED] = this->flags[SF_WRITE_BLOCKED] = true;
+		}
 		else
 			this->flags[SF_DEAD] = true;
 	}
@@ -68,7 +74,13 @@ bool ClientSocket::Process()
 		if (this->flags[SF_ACCEPTED])
 			return true;
 		else if (this->flags[SF_ACCEPTING])
-			this->flags[this->io->FinishAccept(this)] = true;
+		{
+			SocketFlag f = this->io->FinishAccept(this);
+			this->flags[f] = true;
+			/* Still waiting on the other end */
+			if (f == SF_ACCEPTING)
+				this->flags[SF_READ_BLOCKED] = this->flags[SF_WRITE_BLOCKED] = true;
+		}
 		else
 			this->flags[SF_DEAD] = true;
 	}
@@ -13,6 +13,144 @@
 #include "sockets.h"
 #include "socketengine.h"
 
+SocketBuffer::SocketBuffer() : len(0)
+{
+}
+
+SocketBuffer::~SocketBuffer()
+{
+	this->Clear();
+	for (unsigned i = 0; i < this->spare.size(); ++i)
+		delete this->spare[i];
+}
+
+SocketBuffer::Chunk *SocketBuffer::NewChunk()
+{
+	Chunk *c;
+	if (!this->spare.empty())
+	{
+		c = this->spare.back();
+		this->spare.pop_back();
+	}
+	else
+		c = new Chunk();
+	c->start = c->end = 0;
+	return c;
+}
+
+void SocketBuffer::FreeChunk(Chunk *c)
+{
+	/* Keeping a couple of chunks around is enough to avoid allocating on every write of a busy socket */
+	if (this->spare.size() < 2)
+		this->spare.push_back(c);
+	else
+		delete c;
+}
+
+void SocketBuffer::Append(const char *data, size_t sz)
+{
+	this->len += sz;
+
+	while (sz > 0)
+	{
+		if (this->chunks.empty() || this->chunks.back()->end == CHUNK_SIZE)
+			this->chunks.push_back(this->NewChunk());
+
+		Chunk *c = this->chunks.back();
+		size_t n = std::min(sz, CHUNK_SIZE - c->end);
+		memcpy(c->data + c->end, data, n);
+		c->end += n;
+		data += n;
+		sz -= n;
+	}
+}
+
+void SocketBuffer::Consume(size_t sz)
+{
+	sz = std::min(sz, this->len);
+	this->len -= sz;
+
+	while (sz > 0)
+	{
+		Chunk *c = this->chunks.front();
+		size_t n = std::min(sz, c->end - c->start);
+		c->start += n;
+		sz -= n;
+
+		if (c->start == c->end)
+		{
+			this->chunks.pop_front();
+			this->FreeChunk(c);
+		}
+	}
+}
+
+void SocketBuffer::Clear()
+{
+	for (unsigned i = 0; i < this->chunks.size(); ++i)
+		this->FreeChunk(this->chunks[i]);
+	this->chunks.clear();
+	this->len = 0;
+}
+
+const char *SocketBuffer::Segment(size_t i, size_t &sz) const
+{
+	const Chunk *c = this->chunks[i];
+	sz = c->end - c->start;
+	return c->data + c->start;
+}
+
+bool SocketBuffer::GetLine(Anope::string &line)
+{
+	/* Find the newline without copying anything */
+	size_t linelen = 0;
+	bool found = false;
+	for (unsigned i = 0; !found && i < this->chunks.size(); ++i)
+	{
+		const Chunk *c = this->chunks[i];
+		const char *p = static_cast<const char *>(memchr(c->data + c->start, '\n', c->end - c->start));
+		if (p)
+		{
+			linelen += p - (c->data + c->start);
+			found = true;
+		}
+		else
+			linelen += c->end - c->start;
+	}
+
+	if (!found)
+		return false;
+
+	line.clear();
+	line.str().reserve(linelen);
+	for (size_t remaining = linelen; remaining > 0;)
+	{
+		const Chunk *c = this->chunks.front();
+		size_t n = std::min(remaining, c->end - c->start);
+		line.append(c->data + c->start, n);
+		this->Consume(n);
+		remaining -= n;
+	}
+	/* The newline itself */
+	this->Consume(1);
+
+	return true;
+}
+
+void SocketBuffer::LTrim(const char *what)
+{
+	while (!this->chunks.empty())
+	{
+		const Chunk *c = this->chunks.front();
+		size_t n = 0;
+		while (c->start + n < c->end && strchr(what, c->data[c->start + n]))
+			++n;
+		if (n == 0)
+			break;
+		this->Consume(n);
+	}
+}
+
 BufferedSocket::BufferedSocket()
 {
 }
@@ -27,14 +165,16 @@ bool BufferedSocket::ProcessRead()
 
 	this->recv_len = 0;
 
-	int len = this->io->Recv(this, tbuffer, sizeof(tbuffer) - 1);
+	int len = this->io->Recv(this, tbuffer, sizeof(tbuffer));
 	if (len == 0)
 		return false;
 	if (len < 0)
+	{
+		this->flags[SF_READ_BLOCKED] = SocketEngine::WouldBlock();
 		return SocketEngine::IgnoreErrno();
+	}
 
-	tbuffer[len] = 0;
-	this->read_buffer.append(tbuffer);
+	this->read_buffer.Append(tbuffer, len);
 	this->recv_len = len;
 
 	return true;
@@ -46,10 +186,13 @@ bool BufferedSocket::ProcessWrite()
 	if (count == 0)
 		return false;
 	if (count < 0)
+	{
+		this->flags[SF_WRITE_BLOCKED] = SocketEngine::WouldBlock();
 		return SocketEngine::IgnoreErrno();
+	}
 
-	this->write_buffer = this->write_buffer.substr(count);
-	if (this->write_buffer.empty())
+	this->write_buffer.Consume(count);
+	if (this->write_buffer.Empty())
 		SocketEngine::Change(this, false, SF_WRITABLE);
 
 	return true;
@@ -57,18 +200,25 @@ bool BufferedSocket::ProcessWrite()
 
 const Anope::string BufferedSocket::GetLine()
 {
-	size_t s = this->read_buffer.find('\n');
-	if (s == Anope::string::npos)
+	Anope::string str;
+	if (!this->GetLine(str))
 		return "";
-	Anope::string str = this->read_buffer.substr(0, s + 1);
-	this->read_buffer.erase(0, s + 1);
-	this->read_buffer.ltrim("\r\n");
-	return str.trim("\r\n");
+	return str;
+}
+
+bool BufferedSocket::GetLine(Anope::string &line)
+{
+	if (!this->read_buffer.GetLine(line))
+		return false;
+	this->read_buffer.LTrim("\r\n");
+	line.trim("\r\n");
+	return true;
 }
 
 void BufferedSocket::Write(const char *buffer, size_t l)
 {
-	this->write_buffer += buffer + Anope::string("\r\n");
+	this->write_buffer.Append(buffer, strlen(buffer));
+	this->write_buffer.Append("\r\n", 2);
 	SocketEngine::Change(this, true, SF_WRITABLE);
 }
 
@@ -99,21 +249,9 @@ int BufferedSocket::ReadBufferLen() const
 
 int BufferedSocket::WriteBufferLen() const
 {
-	return this->write_buffer.length();
-}
-
-
-BinarySocket::DataBlock::DataBlock(const char *b, size_t l)
-{
-	this->orig = this->buf = new char[l];
-	memcpy(this->buf, b, l);
-	this->len = l;
+	return this->write_buffer.Length();
 }
 
-BinarySocket::DataBlock::~DataBlock()
-{
-	delete [] this->orig;
-}
 
 BinarySocket::BinarySocket()
 {
@@ -128,37 +266,34 @@ bool BinarySocket::ProcessRead()
 	char tbuffer[NET_BUFSIZE];
 
 	int len = this->io->Recv(this, tbuffer, sizeof(tbuffer));
-	if (len <= 0)
+	if (len == 0)
 		return false;
+	if (len < 0)
+	{
+		this->flags[SF_READ_BLOCKED] = SocketEngine::WouldBlock();
+		return SocketEngine::IgnoreErrno();
+	}
 
 	return this->Read(tbuffer, len);
 }
 
 bool BinarySocket::ProcessWrite()
 {
-	if (this->write_buffer.empty())
+	if (this->write_buffer.Empty())
 	{
 		SocketEngine::Change(this, false, SF_WRITABLE);
 		return true;
 	}
 
-	DataBlock *d = this->write_buffer.front();
-
-	int len = this->io->Send(this, d->buf, d->len);
-	if (len <= -1)
-		return false;
-	else if (static_cast<size_t>(len) == d->len)
-	{
-		delete d;
-		this->write_buffer.pop_front();
-	}
-	else
+	int len = this->io->Send(this, this->write_buffer);
+	if (len < 0)
 	{
-		d->buf += len;
-		d->len -= len;
+		this->flags[SF_WRITE_BLOCKED] = SocketEngine::WouldBlock();
+		return SocketEngine::IgnoreErrno();
 	}
+	this->write_buffer.Consume(len);
 
-	if (this->write_buffer.empty())
+	if (this->write_buffer.Empty())
 		SocketEngine::Change(this, false, SF_WRITABLE);
 
 	return true;
@@ -168,7 +303,7 @@ void BinarySocket::Write(const char *buffer, size_t l)
 {
 	if (l == 0)
 		return;
-	this->write_buffer.push_back(new DataBlock(buffer, l));
+	this->write_buffer.Append(buffer, l);
 	SocketEngine::Change(this, true, SF_WRITABLE);
 }
 
@@ -13,6 +13,7 @@
 #include "anope.h"
 #include "sockets.h"
 #include "socketengine.h"
+#include "timers.h"
 #include "config.h"
 
 #include <sys/epoll.h>
@@ -22,6 +23,99 @@
 static int EngineHandle;
 static std::vector<epoll_event> events;
 
+/* What the engine knows about each file descriptor, indexed by fd */
+struct EpollState
+{
+	/* The events registered with the kernel, 0 if not registered */
+	uint32_t registered;
+	/* Whether the fd is in the changed list */
+	bool changed;
+	/* In edge triggered mode, whether the fd is in the ready list, and whether it was
+	 * last known to be readable and writable
+	 */
+	bool ready, readable, writable;
+
+	EpollState() : registered(0), changed(false), ready(false), readable(false), writable(false) { }
+};
+static std::vector<EpollState> states;
+
+/* Sockets whose flags have changed since they were last registered with the kernel */
+static std::vector<int> changed;
+/* In edge triggered mode, sockets which can be read from or written to without waiting */
+static std::vector<int> ready;
+
+/* Whether edge triggered mode is in use, -1 until the config is first checked */
+static int edge_triggered = -1;
+
+/* Iterations since the event array was last more than a quarter full */
+static unsigned idle_iterations = 0;
+
+static EpollState &GetState(int fd)
+{
+	if (static_cast<unsigned>(fd) >= states.size())
+		states.resize(fd + 1);
+	return states[fd];
+}
+
+/* Queue a socket in edge triggered mode to be processed without waiting, if it wants to do something it can */
+static void CheckReady(Socket *s)
+{
+	EpollState &state = GetState(s->GetFD());
+	if (state.ready)
+		return;
+
+	if ((s->flags[SF_READABLE] && state.readable) || (s->flags[SF_WRITABLE] && state.writable))
+	{
+		state.ready = true;
+		ready.push_back(s->GetFD());
+	}
+}
+
+/* Register the sockets in the changed list with the kernel */
+static void FlushChanges()
+{
+	if (edge_triggered == -1)
+		edge_triggered = Config->GetBlock("options")->Get<bool>("edgetriggered");
+
+	for (unsigned i = 0; i < changed.size(); ++i)
+	{
+		int fd = changed[i];
+		EpollState &state = GetState(fd);
+		state.changed = false;
+
+		std::map<int, Socket *>::iterator it = SocketEngine::Sockets.find(fd);
+		if (it == SocketEngine::Sockets.end())
+			continue;
+		Socket *s = it->second;
+
+		uint32_t want;
+		if (edge_triggered)
+			want = EPOLLIN | EPOLLOUT | EPOLLET;
+		else
+			want = (s->flags[SF_READABLE] ? EPOLLIN : 0) | (s->flags[SF_WRITABLE] ? EPOLLOUT : 0);
+
+		if (want == state.registered)
+			continue;
+
+		epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = want;
+		ev.data.fd = fd;
+
+		if (epoll_ctl(EngineHandle, state.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) == -1)
+		{
+			Log() << "Unable to epoll_ctl() fd " << fd << " to epoll: " << Anope::LastError();
+			s->ProcessError();
+			delete s;
+			continue;
+		}
+
+		state.registered = want;
+	}
+
+	changed.clear();
+}
+
 void SocketEngine::Init()
 {
 	EngineHandle = epoll_create(4);
@@ -43,40 +137,105 @@ void SocketEngine::Change(Socket *s, bool set, SocketFlag flag)
 	if (set == s->flags[flag])
 		return;
 
-	bool before_registered = s->flags[SF_READABLE] || s->flags[SF_WRITABLE];
-
 	s->flags[flag] = set;
 
-	bool now_registered = s->flags[SF_READABLE] || s->flags[SF_WRITABLE];
+	EpollState &state = GetState(s->GetFD());
 
-	epoll_event ev;
-
-	memset(&ev, 0, sizeof(ev));
+	if (!s->flags[SF_READABLE] && !s->flags[SF_WRITABLE])
+	{
+		/* Unregister right away, the fd is usually about to be closed and reused */
+		if (state.registered)
+		{
+			epoll_event ev;
+			memset(&ev, 0, sizeof(ev));
+			if (epoll_ctl(EngineHandle, EPOLL_CTL_DEL, s->GetFD(), &ev) == -1)
+				throw SocketException("Unable to epoll_ctl() fd " + stringify(s->GetFD()) + " to epoll: " + Anope::LastError());
+		}
 
-	ev.events = (s->flags[SF_READABLE] ? EPOLLIN : 0) | (s->flags[SF_WRITABLE] ? EPOLLOUT : 0);
-	ev.data.fd = s->GetFD();
+		state.registered = 0;
+		state.readable = state.writable = false;
+		return;
+	}
 
-	int mod;
-	if (!before_registered && now_registered)
-		mod = EPOLL_CTL_ADD;
-	else if (before_registered && !now_registered)
-		mod = EPOLL_CTL_DEL;
-	else if (before_registered && now_registered)
-		mod = EPOLL_CTL_MOD;
-	else
+	if (edge_triggered == 1 && state.registered)
+	{
+		/* Sockets stay registered for both directions, so this is only bookkeeping */
+		CheckReady(s);
 		return;
+	}
 
-	if (epoll_ctl(EngineHandle, mod, ev.data.fd, &ev) == -1)
-		 throw SocketException("Unable to epoll_ctl() fd " + stringify(ev.data.fd) + " to epoll: " + Anope::LastError());
+	if (!state.changed)
+	{
+		state.changed = true;
+		changed.push_back(s->GetFD());
+	}
+}
+
+/* Handle a socket which may be readable or writable. Handlers which stop
+ * because the socket would block set SF_READ_BLOCKED or SF_WRITE_BLOCKED,
+ * which is how edge triggered mode knows to wait for the next event.
+ * @param s The socket
+ * @param can_read Whether the socket may be read from
+ * @param can_write Whether the socket may be written to
+ * @return false if the socket was deleted
+ */
+static bool ProcessSocket(Socket *s, bool can_read, bool can_write)
+{
+	EpollState &state = GetState(s->GetFD());
+
+	s->flags[SF_READ_BLOCKED] = s->flags[SF_WRITE_BLOCKED] = false;
+	if (!s->Process())
+	{
+		if (s->flags[SF_DEAD])
+		{
+			delete s;
+			return false;
+		}
+
+		/* Still connecting or accepting, and it would block */
+		if (s->flags[SF_READABLE] && s->flags[SF_READ_BLOCKED])
+			state.readable = false;
+		if (s->flags[SF_WRITABLE] && s->flags[SF_WRITE_BLOCKED])
+			state.writable = false;
+		return true;
+	}
+
+	if (can_read && s->flags[SF_READABLE])
+	{
+		s->flags[SF_READ_BLOCKED] = false;
+		if (!s->ProcessRead())
+			s->flags[SF_DEAD] = true;
+		else if (s->flags[SF_READ_BLOCKED])
+			state.readable = false;
+	}
+
+	if (can_write && s->flags[SF_WRITABLE] && !s->flags[SF_DEAD])
+	{
+		s->flags[SF_WRITE_BLOCKED] = false;
+		if (!s->ProcessWrite())
+			s->flags[SF_DEAD] = true;
+		else if (s->flags[SF_WRITE_BLOCKED])
+			state.writable = false;
+	}
+
+	if (s->flags[SF_DEAD])
+	{
+		delete s;
+		return false;
+	}
+
+	return true;
 }
 
 void SocketEngine::Process()
 {
-	if (Sockets.size() > events.size())
-		events.resize(events.size() * 2);
+	FlushChanges();
 
-	int total = epoll_wait(EngineHandle, &events.front(), events.size(), Config->ReadTimeout * 1000);
-	Anope::CurTime = time(NULL);
+	/* Sockets which are still ready from the last iteration must not wait */
+	int timeout = ready.empty() ? TimerManager::GetTimeout(Config->ReadTimeout * 1000) : 0;
+	int total = epoll_wait(EngineHandle, &events.front(), events.size(), timeout);
+	Anope::UpdateTime();
+	LoopStats::Enter(LOOP_SOCKETS);
 
 	/* EINTR can be given if the read timeout expires */
 	if (total == -1)
@@ -86,6 +245,20 @@ void SocketEngine::Process()
 		return;
 	}
 
+	/* Size the event array from how many events we get, a full array means more may be waiting */
+	if (static_cast<unsigned>(total) == events.size())
+	{
+		events.resize(events.size() * 2);
+		idle_iterations = 0;
+	}
+	else if (static_cast<unsigned>(total) > events.size() / 4)
+		idle_iterations = 0;
+	else if (++idle_iterations > 1024 && events.size() > static_cast<unsigned>(DefaultSize))
+	{
+		events.resize(events.size() / 2);
+		idle_iterations = 0;
+	}
+
 	for (int i = 0; i < total; ++i)
 	{
 		epoll_event &ev = events[i];
@@ -102,20 +275,39 @@ void SocketEngine::Process()
 			continue;
 		}
 
-		if (!s->Process())
+		if (edge_triggered)
 		{
-			if (s->flags[SF_DEAD])
-				delete s;
+			EpollState &state = GetState(ev.data.fd);
+			if (ev.events & EPOLLIN)
+				state.readable = true;
+			if (ev.events & EPOLLOUT)
+				state.writable = true;
+			CheckReady(s);
 			continue;
 		}
 
-		if ((ev.events & EPOLLIN) && !s->ProcessRead())
-			s->flags[SF_DEAD] = true;
+		ProcessSocket(s, ev.events & EPOLLIN, ev.events & EPOLLOUT);
+	}
 
-		if ((ev.events & EPOLLOUT) && !s->ProcessWrite())
-			s->flags[SF_DEAD] = true;
+	if (ready.empty())
+		return;
 
-		if (s->flags[SF_DEAD])
-			delete s;
+	/* Give each ready socket one turn, sockets which are still ready stay queued for the next iteration */
+	std::vector<int> current;
+	current.swap(ready);
+
+	for (unsigned i = 0; i < current.size(); ++i)
+	{
+		int fd = current[i];
+		GetState(fd).ready = false;
+
+		std::map<int, Socket *>::iterator it = Sockets.find(fd);
+		if (it == Sockets.end())
+			continue;
+		Socket *s = it->second;
+
+		const EpollState &state = GetState(fd);
+		if (ProcessSocket(s, state.readable, state.writable))
+			CheckReady(s);
 	}
 }
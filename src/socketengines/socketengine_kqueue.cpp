@@ -13,6 +13,7 @@
 #include "anope.h"
 #include "sockets.h"
 #include "socketengine.h"
+#include "timers.h"
 #include "logger.h"
 #include "config.h"
 
@@ -74,10 +75,12 @@ void SocketEngine::Process()
 	if (Sockets.size() > event_events.size())
 		event_events.resize(event_events.size() * 2);
 
-	static timespec kq_timespec = { Config->ReadTimeout, 0 };
+	long timeout = TimerManager::GetTimeout(Config->ReadTimeout * 1000);
+	timespec kq_timespec = { timeout / 1000, (timeout % 1000) * 1000000 };
 	int total = kevent(kq_fd, &change_events.front(), change_count, &event_events.front(), event_events.size(), &kq_timespec);
 	change_count = 0;
-	Anope::CurTime = time(NULL);
+	Anope::UpdateTime();
+	LoopStats::Enter(LOOP_SOCKETS);
 
 	/* EINTR can be given if the read timeout expires */
 	if (total == -1)
@@ -13,6 +13,7 @@
 #include "anope.h"
 #include "sockets.h"
 #include "socketengine.h"
+#include "timers.h"
 #include "config.h"
 
 #include <errno.h>
@@ -99,8 +100,9 @@ void SocketEngine::Change(Socket *s, bool set, SocketFlag flag)
 
 void SocketEngine::Process()
 {
-	int total = poll(&events.front(), events.size(), Config->ReadTimeout * 1000);
-	Anope::CurTime = time(NULL);
+	int total = poll(&events.front(), events.size(), TimerManager::GetTimeout(Config->ReadTimeout * 1000));
+	Anope::UpdateTime();
+	LoopStats::Enter(LOOP_SOCKETS);
 
 	/* EINTR can be given if the read timeout expires */
 	if (total < 0)
@@ -13,6 +13,7 @@
 #include "anope.h"
 #include "sockets.h"
 #include "socketengine.h"
+#include "timers.h"
 #include "logger.h"
 #include "config.h"
 
@@ -85,8 +86,9 @@ void SocketEngine::Process()
 {
 	fd_set rfdset = ReadFDs, wfdset = WriteFDs, efdset = ReadFDs;
 	timeval tval;
-	tval.tv_sec = Config->ReadTimeout;
-	tval.tv_usec = 0;
+	long timeout = TimerManager::GetTimeout(Config->ReadTimeout * 1000);
+	tval.tv_sec = timeout / 1000;
+	tval.tv_usec = (timeout % 1000) * 1000;
 
 #ifdef _WIN32
 	/* We can use the socket engine to "sleep" services for a period of
@@ -103,7 +105,8 @@ void SocketEngine::Process()
 #endif
 
 	int sresult = select(MaxFD + 1, &rfdset, &wfdset, &efdset, &tval);
-	Anope::CurTime = time(NULL);
+	Anope::UpdateTime();
+	LoopStats::Enter(LOOP_SOCKETS);
 
 	if (sresult == -1)
 	{
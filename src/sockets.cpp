@@ -18,6 +18,7 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/uio.h>
 #endif
 
 std::map<int, Socket *> SocketEngine::Sockets;
@@ -407,6 +408,29 @@ int SocketIO::Send(Socket *s, const Anope::string &buf)
 	return this->Send(s, buf.c_str(), buf.length());
 }
 
+int SocketIO::Send(Socket *s, const SocketBuffer &buf)
+{
+	if (buf.Empty())
+		return 0;
+
+#ifndef _WIN32
+	/* Flush as many segments as we can with one syscall */
+	iovec iov[64];
+	int count = std::min(buf.Segments(), sizeof(iov) / sizeof(*iov));
+	for (int j = 0; j < count; ++j)
+		iov[j].iov_base = const_cast<char *>(buf.Segment(j, iov[j].iov_len));
+
+	int i = writev(s->GetFD(), iov, count);
+	if (i > 0)
+		TotalWritten += i;
+	return i;
+#else
+	size_t sz;
+	const char *data = buf.Segment(0, sz);
+	return this->Send(s, data, sz);
+#endif
+}
+
 ClientSocket *SocketIO::Accept(ListenSocket *s)
 {
 	sockaddrs conaddr;
@@ -579,7 +603,11 @@ bool ListenSocket::ProcessRead()
 	}
 	catch (const SocketException &ex)
 	{
-		Log() << ex.GetReason();
+		if (SocketEngine::WouldBlock())
+			/* There is nothing more to accept */
+			this->flags[SF_READ_BLOCKED] = true;
+		else if (!SocketEngine::IgnoreErrno())
+			Log() << ex.GetReason();
 	}
 	return true;
 }
@@ -609,3 +637,8 @@ bool SocketEngine::IgnoreErrno()
 		|| GetLastError() == EINTR
 		|| GetLastError() == EINPROGRESS;
 }
+
+bool SocketEngine::WouldBlock()
+{
+	return GetLastError() == EAGAIN || GetLastError() == EWOULDBLOCK;
+}
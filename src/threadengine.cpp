@@ -134,3 +134,181 @@ void Condition::Wait()
 {
 	pthread_cond_wait(&cond, &mutex);
 }
+
+class ThreadPool::Worker : public Thread
+{
+	ThreadPool *pool;
+
+ public:
+	Worker(ThreadPool *p) : pool(p) { }
+
+	void Run() anope_override
+	{
+		pool->lock.Lock();
+
+		for (;;)
+		{
+			if (pool->pending.empty())
+			{
+				pool->lock.Wait();
+				continue;
+			}
+
+			Task *t = pool->pending.front();
+			pool->pending.pop_front();
+			if (t == NULL)
+				break;
+
+			pool->lock.Unlock();
+			t->Run();
+			pool->lock.Lock();
+
+			pool->finished.push_back(t);
+			pool->Notify();
+		}
+
+		pool->lock.Unlock();
+	}
+
+	void OnNotify() anope_override
+	{
+		/* Workers are joined by their pool */
+	}
+};
+
+std::set<ThreadPool *> ThreadPool::Pools;
+
+ThreadPool::ThreadPool(const Anope::string &n, unsigned threads) : name(n), peak(0), completed(0)
+{
+	Pools.insert(this);
+	this->SetThreads(threads);
+}
+
+ThreadPool::~ThreadPool()
+{
+	this->ClearTasks();
+
+	Pools.erase(this);
+}
+
+void ThreadPool::ClearTasks()
+{
+	this->StopWorkers();
+
+	/* The workers are gone, so nothing else can touch the queues */
+	std::deque<Task *> tasks;
+	tasks.swap(this->pending);
+	tasks.insert(tasks.end(), this->finished.begin(), this->finished.end());
+	this->finished.clear();
+
+	for (unsigned i = 0; i < tasks.size(); ++i)
+		delete tasks[i];
+}
+
+void ThreadPool::StopWorkers()
+{
+	if (this->workers.empty())
+		return;
+
+	/* Queue one exit marker for each worker ahead of the real tasks */
+	this->lock.Lock();
+	for (unsigned i = 0; i < this->workers.size(); ++i)
+	{
+		this->pending.push_front(NULL);
+		this->lock.Wakeup();
+	}
+	this->lock.Unlock();
+
+	for (unsigned i = 0; i < this->workers.size(); ++i)
+	{
+		this->workers[i]->Join();
+		delete this->workers[i];
+	}
+	this->workers.clear();
+}
+
+const Anope::string &ThreadPool::GetName() const
+{
+	return this->name;
+}
+
+void ThreadPool::SetThreads(unsigned threads)
+{
+	if (threads == this->workers.size())
+		return;
+
+	this->StopWorkers();
+
+	for (unsigned i = 0; i < threads; ++i)
+	{
+		Worker *w = new Worker(this);
+		try
+		{
+			w->Start();
+		}
+		catch (const CoreException &)
+		{
+			delete w;
+			throw;
+		}
+		this->workers.push_back(w);
+	}
+
+	if (!this->workers.empty())
+	{
+		/* Wake the new workers for anything queued while they were stopped */
+		this->lock.Lock();
+		for (unsigned i = 0; i < this->workers.size(); ++i)
+			this->lock.Wakeup();
+		this->lock.Unlock();
+	}
+}
+
+unsigned ThreadPool::GetThreads() const
+{
+	return this->workers.size();
+}
+
+void ThreadPool::Add(Task *t)
+{
+	this->lock.Lock();
+	this->pending.push_back(t);
+	if (this->pending.size() > this->peak)
+		this->peak = this->pending.size();
+	this->lock.Wakeup();
+	this->lock.Unlock();
+}
+
+size_t ThreadPool::QueueSize()
+{
+	this->lock.Lock();
+	size_t sz = this->pending.size();
+	this->lock.Unlock();
+	return sz;
+}
+
+size_t ThreadPool::PeakQueueSize() const
+{
+	return this->peak;
+}
+
+unsigned long ThreadPool::Completed() const
+{
+	return this->completed;
+}
+
+void ThreadPool::OnNotify()
+{
+	this->lock.Lock();
+	std::deque<Task *> done;
+	done.swap(this->finished);
+	this->lock.Unlock();
+
+	for (unsigned i = 0; i < done.size(); ++i)
+	{
+		Task *t = done[i];
+		++this->completed;
+		t->OnFinish();
+		delete t;
+	}
+}
@@ -9,15 +9,57 @@
 #include "services.h"
 #include "timers.h"
 
-std::multimap<time_t, Timer *> TimerManager::Timers;
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
+/* The timer wheel. Level 0 has one slot for each millisecond, and each level
+ * above it has slots spanning all of the level below. Timers due further away
+ * than the top level can hold are parked in its last slot and placed again
+ * when that slot is cascaded.
+ */
+static const unsigned WHEEL_LEVELS = 4, ROOT_BITS = 8, LEVEL_BITS = 6;
+static const unsigned ROOT_SIZE = 1 << ROOT_BITS, LEVEL_SIZE = 1 << LEVEL_BITS;
+
+static Timer *wheel[WHEEL_LEVELS][ROOT_SIZE];
+/* Number of timers in each level */
+static unsigned long wheel_count[WHEEL_LEVELS];
+/* The next millisecond of the monotonic clock to process */
+static uint64_t wheel_time;
+/* Timers taken out of their slot which are being ticked */
+static Timer *pending;
+
+/* The system clock in milliseconds, which times given to and returned by Timer are on */
+static int64_t WallClock()
+{
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return static_cast<int64_t>(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
+/* Converts a time of the system clock, in milliseconds, to the monotonic clock the wheel runs on.
+ * Timers then keep their interval if the system time is changed after they are set.
+ */
+static uint64_t ToMonotonic(int64_t ms)
+{
+	int64_t mono = static_cast<int64_t>(Anope::MicroTime() / 1000) + ms - WallClock();
+	return mono > 0 ? mono : 0;
+}
+
+static inline unsigned LevelShift(unsigned level)
+{
+	return ROOT_BITS + (level - 1) * LEVEL_BITS;
+}
 
 Timer::Timer(long time_from_now, time_t now, bool repeating)
 {
 	owner = NULL;
-	trigger = now + time_from_now;
+	expires = ToMonotonic(static_cast<int64_t>(now + time_from_now) * 1000);
 	secs = time_from_now;
 	repeat = repeating;
 	settime = now;
+	next = NULL;
+	prev = NULL;
 
 	TimerManager::AddTimer(this);
 }
@@ -25,10 +67,12 @@ Timer::Timer(long time_from_now, time_t now, bool repeating)
 Timer::Timer(Module *creator, long time_from_now, time_t now, bool repeating)
 {
 	owner = creator;
-	trigger = now + time_from_now;
+	expires = ToMonotonic(static_cast<int64_t>(now + time_from_now) * 1000);
 	secs = time_from_now;
 	repeat = repeating;
 	settime = now;
+	next = NULL;
+	prev = NULL;
 
 	TimerManager::AddTimer(this);
 }
@@ -39,15 +83,20 @@ Timer::~Timer()
 }
 
 void Timer::SetTimer(time_t t)
+{
+	this->SetTimerMS(static_cast<uint64_t>(t) * 1000);
+}
+
+void Timer::SetTimerMS(uint64_t ms)
 {
 	TimerManager::DelTimer(this);
-	trigger = t;
+	expires = ToMonotonic(ms);
 	TimerManager::AddTimer(this);
 }
 
 time_t Timer::GetTimer() const
 {
-	return trigger;
+	return (WallClock() + static_cast<int64_t>(expires) - static_cast<int64_t>(Anope::MicroTime() / 1000)) / 1000;
 }
 
 bool Timer::GetRepeat() const
@@ -64,7 +113,7 @@ void Timer::SetSecs(time_t t)
 {
 	TimerManager::DelTimer(this);
 	secs = t;
-	trigger = Anope::CurTime + t;
+	expires = ToMonotonic(static_cast<int64_t>(Anope::CurTime + t) * 1000);
 	TimerManager::AddTimer(this);
 }
 
@@ -78,49 +127,181 @@ Module *Timer::GetOwner() const
 	return owner;
 }
 
-void TimerManager::AddTimer(Timer *t)
+void TimerManager::Place(Timer *t)
 {
-	Timers.insert(std::make_pair(t->GetTimer(), t));
+	/* Timers already due go in the next slot to be processed */
+	uint64_t when = std::max(t->expires, wheel_time), delta = when - wheel_time;
+	unsigned slot;
+
+	if (delta < ROOT_SIZE)
+	{
+		t->level = 0;
+		slot = when & (ROOT_SIZE - 1);
+	}
+	else
+	{
+		t->level = 1;
+		while (t->level < WHEEL_LEVELS - 1 && delta >> LevelShift(t->level + 1))
+			++t->level;
+
+		unsigned shift = LevelShift(t->level);
+		if (delta >> (shift + LEVEL_BITS))
+			slot = ((wheel_time >> shift) + LEVEL_SIZE - 1) & (LEVEL_SIZE - 1);
+		else
+			slot = (when >> shift) & (LEVEL_SIZE - 1);
+	}
+
+	Timer *&head = wheel[t->level][slot];
+	t->next = head;
+	if (head)
+		head->prev = &t->next;
+	head = t;
+	t->prev = &head;
+	++wheel_count[t->level];
 }
 
-void TimerManager::DelTimer(Timer *t)
+void TimerManager::Cascade(unsigned level, unsigned slot)
 {
-	std::pair<std::multimap<time_t, Timer *>::iterator, std::multimap<time_t, Timer *>::iterator> itpair = Timers.equal_range(t->GetTimer());
-	for (std::multimap<time_t, Timer *>::iterator i = itpair.first; i != itpair.second; ++i)
+	Timer *t = wheel[level][slot];
+	wheel[level][slot] = NULL;
+
+	while (t)
 	{
-		if (i->second == t)
-		{
-			Timers.erase(i);
-			break;
-		}
+		Timer *t_next = t->next;
+		--wheel_count[level];
+		Place(t);
+		t = t_next;
 	}
 }
 
+void TimerManager::AddTimer(Timer *t)
+{
+	if (!wheel_time)
+		wheel_time = Anope::MicroTime() / 1000;
+
+	Place(t);
+}
+
+void TimerManager::DelTimer(Timer *t)
+{
+	if (!t->prev)
+		return;
+
+	*t->prev = t->next;
+	if (t->next)
+		t->next->prev = t->prev;
+	t->next = NULL;
+	t->prev = NULL;
+	--wheel_count[t->level];
+}
+
 void TimerManager::TickTimers(time_t ctime)
 {
-	while (!Timers.empty())
+	uint64_t now = Anope::CurTimeMS;
+
+	while (wheel_time <= now)
 	{
-		std::multimap<time_t, Timer *>::iterator it = Timers.begin();
-		Timer *t = it->second;
+		if (!wheel_count[0])
+		{
+			/* Nothing is due soon, skip ahead to when the lowest used level is next cascaded */
+			unsigned level = 1;
+			while (level < WHEEL_LEVELS && !wheel_count[level])
+				++level;
 
-		if (t->GetTimer() > ctime)
-			break;
+			if (level == WHEEL_LEVELS)
+			{
+				wheel_time = now + 1;
+				break;
+			}
 
-		t->Tick(ctime);
+			uint64_t mask = (static_cast<uint64_t>(1) << LevelShift(level)) - 1, skip = (wheel_time + mask) & ~mask;
+			if (skip > now)
+			{
+				wheel_time = now + 1;
+				break;
+			}
+			wheel_time = skip;
+		}
 
-		if (t->GetRepeat())
-			t->SetTimer(ctime + t->GetSecs());
-		else
-			delete t;
+		if (!(wheel_time & (ROOT_SIZE - 1)))
+			for (unsigned level = 1; level < WHEEL_LEVELS; ++level)
+			{
+				unsigned slot = (wheel_time >> LevelShift(level)) & (LEVEL_SIZE - 1);
+				Cascade(level, slot);
+				if (slot)
+					break;
+			}
+
+		Timer *&head = wheel[0][wheel_time & (ROOT_SIZE - 1)];
+		pending = head;
+		if (pending)
+			pending->prev = &pending;
+		head = NULL;
+		++wheel_time;
+
+		while (pending)
+		{
+			Timer *t = pending;
+			DelTimer(t);
+
+			t->Tick(ctime);
+
+			/* ctime can be behind the wheel, such as after loading databases, and a
+			 * repeating timer rescheduled from it could be due again right away
+			 */
+			if (t->GetRepeat())
+				t->SetTimer(std::max<time_t>(ctime, WallClock() / 1000) + t->GetSecs());
+			else
+				delete t;
+		}
 	}
 }
 
 void TimerManager::DeleteTimersFor(Module *m)
 {
-	for (std::multimap<time_t, Timer *>::iterator it = Timers.begin(), it_next = it; it != Timers.end(); it = it_next)
+	std::vector<Timer *> timers;
+
+	for (Timer *t = pending; t; t = t->next)
+		if (t->GetOwner() == m)
+			timers.push_back(t);
+
+	for (unsigned level = 0; level < WHEEL_LEVELS; ++level)
+		for (unsigned slot = 0; slot < ROOT_SIZE; ++slot)
+			for (Timer *t = wheel[level][slot]; t; t = t->next)
+				if (t->GetOwner() == m)
+					timers.push_back(t);
+
+	for (unsigned i = 0; i < timers.size(); ++i)
+		delete timers[i];
+}
+
+long TimerManager::GetTimeout(long max)
+{
+	uint64_t now = Anope::MicroTime() / 1000, next = now + max;
+
+	if (wheel_count[0])
+		for (unsigned i = 0; i < ROOT_SIZE; ++i)
+			if (wheel[0][(wheel_time + i) & (ROOT_SIZE - 1)])
+			{
+				next = std::min(next, wheel_time + i);
+				break;
+			}
+
+	/* Timers in the upper levels can not be due before their slot is cascaded */
+	for (unsigned level = 1; level < WHEEL_LEVELS; ++level)
 	{
-		++it_next;
-		if (it->second->GetOwner() == m)
-			delete it->second;
+		if (!wheel_count[level])
+			continue;
+
+		unsigned shift = LevelShift(level);
+		uint64_t first = (wheel_time + (static_cast<uint64_t>(1) << shift) - 1) >> shift;
+		for (uint64_t slot = first; slot < first + LEVEL_SIZE; ++slot)
+			if (wheel[level][slot & (LEVEL_SIZE - 1)])
+			{
+				next = std::min(next, slot << shift);
+				break;
+			}
 	}
+
+	return next > now ? next - now : 0;
 }
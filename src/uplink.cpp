@@ -131,7 +131,9 @@ UplinkSocket::~UplinkSocket()
 bool UplinkSocket::ProcessRead()
 {
 	bool b = BufferedSocket::ProcessRead();
-	for (Anope::string buf; (buf = this->GetLine()).empty() == false;)
+	/* Kept between calls so its memory is reused */
+	static Anope::string buf;
+	while (this->GetLine(buf) && !buf.empty())
 	{
 		Anope::Process(buf);
 		User::QuitUsers();
@@ -209,5 +211,5 @@ UplinkSocket::Message::~Message()
 
 	Anope::string sent = IRCD->Format(message_source, this->buffer.str());
 	UplinkSock->Write(sent);
-	Log(LOG_RAWIO) << "Sent: " << sent;
+	LOG_IF_ENABLED(LOG_RAWIO) << "Sent: " << sent;
 }
@@ -23,8 +23,260 @@
 std::list<XLineManager *> XLineManager::XLineManagers;
 Serialize::Checker<std::multimap<Anope::string, XLine *, ci::less> > XLineManager::XLinesByUID("XLine");
 
+/* Wildcard hosts are indexed by up to this many characters of their literal prefix or suffix */
+static const size_t AFFIX_LENGTH = 4;
+
+struct XLineManager::Index
+{
+	enum Kind
+	{
+		/* Checked against every user */
+		FALLBACK,
+		/* A host without wildcards */
+		EXACT,
+		/* A wildcard host beginning with a literal */
+		PREFIX,
+		/* A wildcard host ending with a literal */
+		SUFFIX
+	};
+
+	struct Entry
+	{
+		/* Position in the xline list, newer xlines are checked first */
+		unsigned long order;
+		Kind kind;
+		/* The key the xline is stored under */
+		Anope::string key;
+		/* The CIDR range of the xline, if any */
+		sockaddrs cidr_addr;
+		unsigned cidr_len;
+	};
+
+	/* A node of a binary trie on the bits of an address */
+	struct Node
+	{
+		Node *children[2];
+		std::vector<XLine *> xlines;
+
+		Node() { children[0] = children[1] = NULL; }
+		~Node() { delete children[0]; delete children[1]; }
+	};
+
+	TR1NS::unordered_map<XLine *, Entry> entries;
+	Anope::hash_map<std::vector<XLine *> > exact, prefixes, suffixes;
+	std::vector<XLine *> fallback;
+	Node *ipv4, *ipv6;
+	unsigned long order;
+
+	Index() : ipv4(new Node()), ipv6(new Node()), order(0) { }
+
+	~Index()
+	{
+		delete ipv4;
+		delete ipv6;
+	}
+
+	static void Remove(std::vector<XLine *> &list, XLine *x)
+	{
+		std::vector<XLine *>::iterator it = std::find(list.begin(), list.end(), x);
+		if (it != list.end())
+			list.erase(it);
+	}
+
+	static const uint8_t *Bits(const sockaddrs &addr, unsigned &len)
+	{
+		if (addr.family() == AF_INET)
+		{
+			len = std::min(len, 32U);
+			return reinterpret_cast<const uint8_t *>(&addr.sa4.sin_addr);
+		}
+		len = std::min(len, 128U);
+		return reinterpret_cast<const uint8_t *>(&addr.sa6.sin6_addr);
+	}
+
+	Node *FindNode(const sockaddrs &addr, unsigned len, bool create)
+	{
+		const uint8_t *bits = Bits(addr, len);
+		Node *n = addr.family() == AF_INET ? ipv4 : ipv6;
+		for (unsigned i = 0; n && i < len; ++i)
+		{
+			Node *&child = n->children[(bits[i / 8] >> (7 - i % 8)) & 1];
+			if (!child && create)
+				child = new Node();
+			n = child;
+		}
+		return n;
+	}
+
+	void Clear()
+	{
+		entries.clear();
+		exact.clear();
+		prefixes.clear();
+		suffixes.clear();
+		fallback.clear();
+		delete ipv4;
+		delete ipv6;
+		ipv4 = new Node();
+		ipv6 = new Node();
+	}
+
+	void Add(XLine *x, bool by_host)
+	{
+		Entry &e = entries[x];
+		e.order = order++;
+		e.kind = FALLBACK;
+		e.cidr_len = 0;
+
+		const Anope::string &host = x->GetHost();
+		if (!by_host || x->regex || host.empty())
+		{
+			fallback.push_back(x);
+			return;
+		}
+
+		if (x->c)
+		{
+			size_t sl = host.find_last_of('/');
+			Anope::string ip = host.substr(0, sl), len = host.substr(sl + 1);
+			try
+			{
+				e.cidr_addr.pton(ip.find(':') != Anope::string::npos ? AF_INET6 : AF_INET, ip);
+				e.cidr_len = len.is_pos_number_only() ? convertTo<unsigned>(len) : 128;
+				FindNode(e.cidr_addr, e.cidr_len, true)->xlines.push_back(x);
+			}
+			catch (const CoreException &)
+			{
+				e.cidr_addr.clear();
+			}
+		}
+
+		size_t first = host.find_first_of("*?"), last = host.find_last_of("*?");
+		if (first == Anope::string::npos)
+		{
+			e.kind = EXACT;
+			e.key = host;
+			exact[e.key].push_back(x);
+		}
+		else if (last + 1 < host.length())
+		{
+			e.kind = SUFFIX;
+			e.key = host.substr(std::max(last + 1, host.length() - AFFIX_LENGTH));
+			suffixes[e.key].push_back(x);
+		}
+		else if (first > 0)
+		{
+			e.kind = PREFIX;
+			e.key = host.substr(0, std::min(first, AFFIX_LENGTH));
+			prefixes[e.key].push_back(x);
+		}
+		else
+			fallback.push_back(x);
+	}
+
+	void Del(XLine *x)
+	{
+		TR1NS::unordered_map<XLine *, Entry>::iterator it = entries.find(x);
+		if (it == entries.end())
+			return;
+
+		const Entry &e = it->second;
+
+		if (e.cidr_addr.valid())
+		{
+			Node *n = FindNode(e.cidr_addr, e.cidr_len, false);
+			if (n)
+				Remove(n->xlines, x);
+		}
+
+		switch (e.kind)
+		{
+			case EXACT:
+				Remove(exact[e.key], x);
+				break;
+			case PREFIX:
+				Remove(prefixes[e.key], x);
+				break;
+			case SUFFIX:
+				Remove(suffixes[e.key], x);
+				break;
+			default:
+				Remove(fallback, x);
+		}
+
+		entries.erase(it);
+	}
+
+	static void Append(const Anope::hash_map<std::vector<XLine *> > &map, const Anope::string &key, std::vector<XLine *> &out)
+	{
+		Anope::hash_map<std::vector<XLine *> >::const_iterator it = map.find(key);
+		if (it != map.end())
+			out.insert(out.end(), it->second.begin(), it->second.end());
+	}
+
+	void FindHost(const Anope::string &host, std::vector<XLine *> &out)
+	{
+		Append(exact, host, out);
+		for (size_t l = 1; l <= AFFIX_LENGTH && l <= host.length(); ++l)
+		{
+			Append(prefixes, host.substr(0, l), out);
+			Append(suffixes, host.substr(host.length() - l), out);
+		}
+	}
+
+	struct NewestFirst
+	{
+		Index *index;
+
+		NewestFirst(Index *i) : index(i) { }
+
+		bool operator()(XLine *a, XLine *b) const
+		{
+			return index->entries[a].order > index->entries[b].order;
+		}
+	};
+
+	/** Find the xlines a user could match, newest first
+	 */
+	void Find(User *u, std::vector<XLine *> &out)
+	{
+		out = fallback;
+
+		FindHost(u->host, out);
+
+		if (u->ip.valid())
+		{
+			FindHost(u->ip.addr(), out);
+
+			unsigned len = 128;
+			const uint8_t *bits = Bits(u->ip, len);
+			Node *n = u->ip.family() == AF_INET ? ipv4 : ipv6;
+			for (unsigned i = 0; n; ++i)
+			{
+				out.insert(out.end(), n->xlines.begin(), n->xlines.end());
+				if (i == len)
+					break;
+				n = n->children[(bits[i / 8] >> (7 - i % 8)) & 1];
+			}
+		}
+
+		std::sort(out.begin(), out.end(), NewestFirst(this));
+		out.erase(std::unique(out.begin(), out.end()), out.end());
+	}
+};
+
 void XLine::Init()
 {
+	/* Also called when the mask is changed by XLine::Unserialize */
+	delete this->regex;
+	this->regex = NULL;
+	delete this->c;
+	this->c = NULL;
+	this->nick.clear();
+	this->user.clear();
+	this->host.clear();
+	this->real.clear();
+
 	if (this->mask.length() >= 2 && this->mask[0] == '/' && this->mask[this->mask.length() - 1] == '/' && !Config->GetBlock("options")->Get<const Anope::string>("regexengine").empty())
 	{
 		Anope::string stripped_mask = this->mask.substr(1, this->mask.length() - 2);
@@ -176,15 +428,27 @@ Serializable* XLine::Unserialize(Serializable *obj, Serialize::Data &data)
 	XLine *xl;
 	if (obj)
 	{
+		Anope::string smask, suid;
+
 		xl = anope_dynamic_static_cast<XLine *>(obj);
-		data["mask"] >> xl->mask;
+		data["mask"] >> smask;
 		data["by"] >> xl->by;
 		data["reason"] >> xl->reason;
-		data["uid"] >> xl->id;
+		data["uid"] >> suid;
 
-		if (xlm != xl->manager)
+		if (xlm != xl->manager || smask != xl->mask || suid != xl->id)
 		{
-			xl->manager->DelXLine(xl);
+			/* The manager indexes the xline by its mask and uid, so take it out before changing them */
+			if (xl->manager)
+				xl->manager->RemoveXLine(xl);
+
+			xl->id = suid;
+			if (smask != xl->mask)
+			{
+				xl->mask = smask;
+				xl->Init();
+			}
+
 			xlm->AddXLine(xl);
 		}
 	}
@@ -261,13 +525,14 @@ Anope::string XLineManager::GenerateUID()
 	return id;
 }
 
-XLineManager::XLineManager(Module *creator, const Anope::string &xname, char t) : Service(creator, "XLineManager", xname), type(t), xlines("XLine")
+XLineManager::XLineManager(Module *creator, const Anope::string &xname, char t) : Service(creator, "XLineManager", xname), type(t), xlines("XLine"), xline_index(new Index()), next_expire(0)
 {
 }
 
 XLineManager::~XLineManager()
 {
 	this->Clear();
+	delete this->xline_index;
 }
 
 const char &XLineManager::Type()
@@ -290,6 +555,9 @@ void XLineManager::AddXLine(XLine *x)
 	if (!x->id.empty())
 		XLinesByUID->insert(std::make_pair(x->id, x));
 	this->xlines->push_back(x);
+	this->xline_index->Add(x, this->IndexByHost());
+	if (x->expires && (!this->next_expire || x->expires < this->next_expire))
+		this->next_expire = x->expires;
 	x->manager = this;
 }
 
@@ -314,6 +582,7 @@ void XLineManager::RemoveXLine(XLine *x)
 	{
 		this->SendDel(x);
 		this->xlines->erase(it);
+		this->xline_index->Del(x);
 	}
 }
 
@@ -337,6 +606,7 @@ bool XLineManager::DelXLine(XLine *x)
 		this->SendDel(x);
 
 		x->manager = NULL; // Don't call remove
+		this->xline_index->Del(x);
 		delete x;
 		this->xlines->erase(it);
 
@@ -360,6 +630,8 @@ void XLineManager::Clear()
 {
 	std::vector<XLine *> xl;
 	this->xlines->swap(xl);
+	this->xline_index->Clear();
+	this->next_expire = 0;
 
 	for (unsigned i = 0; i < xl.size(); ++i)
 	{
@@ -441,12 +713,39 @@ XLine* XLineManager::HasEntry(const Anope::string &mask)
 	return NULL;
 }
 
-XLine *XLineManager::CheckAllXLines(User *u)
+void XLineManager::Expire()
 {
+	if (!this->next_expire || this->next_expire >= Anope::CurTime)
+		return;
+
+	this->next_expire = 0;
 	for (unsigned i = this->xlines->size(); i > 0; --i)
 	{
 		XLine *x = this->xlines->at(i - 1);
 
+		if (!x->expires)
+			continue;
+		else if (x->expires < Anope::CurTime)
+		{
+			this->OnExpire(x);
+			this->DelXLine(x);
+		}
+		else if (!this->next_expire || x->expires < this->next_expire)
+			this->next_expire = x->expires;
+	}
+}
+
+XLine *XLineManager::CheckAllXLines(User *u)
+{
+	this->Expire();
+
+	std::vector<XLine *> candidates;
+	this->xline_index->Find(u, candidates);
+
+	for (unsigned i = 0; i < candidates.size(); ++i)
+	{
+		XLine *x = candidates[i];
+
 		if (x->expires && x->expires < Anope::CurTime)
 		{
 			this->OnExpire(x);
@@ -464,6 +763,11 @@ XLine *XLineManager::CheckAllXLines(User *u)
 	return NULL;
 }
 
+bool XLineManager::IndexByHost() const
+{
+	return false;
+}
+
 void XLineManager::OnExpire(const XLine *x)
 {
 }